@@ -0,0 +1,74 @@
+//
+//  AsyncPixelReader.cpp
+//  Relief2
+//
+//
+
+#include "AsyncPixelReader.h"
+
+
+AsyncPixelReader::~AsyncPixelReader() {
+    clear();
+}
+
+void AsyncPixelReader::setup(int width, int height) {
+    clear();
+    this->width = width;
+    this->height = height;
+
+    glGenBuffers(numPixelBuffers, pixelBuffers);
+    for (int i = 0; i < numPixelBuffers; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL, GL_STREAM_READ);
+        pending[i] = false;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    nextBuffer = 0;
+    allocated = true;
+}
+
+void AsyncPixelReader::clear() {
+    if (allocated) {
+        glDeleteBuffers(numPixelBuffers, pixelBuffers);
+        allocated = false;
+    }
+}
+
+bool AsyncPixelReader::readToPixels(ofFbo &fbo, ofPixels &pixels) {
+    if (!allocated || fbo.getWidth() != width || fbo.getHeight() != height) {
+        setup(fbo.getWidth(), fbo.getHeight());
+    }
+
+    // queue a read of this frame into the next buffer; glReadPixels returns immediately
+    // when a pack buffer is bound
+    int current = nextBuffer;
+    fbo.bind();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[current]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    fbo.unbind();
+    issuedMicros[current] = ofGetElapsedTimeMicros();
+    pending[current] = true;
+    nextBuffer = (current + 1) % numPixelBuffers;
+
+    // collect the oldest read, which the gpu has had getLatencyFrames() frames to finish
+    int previous = nextBuffer;
+    if (!pending[previous]) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return false;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[previous]);
+    unsigned char *mapped = (unsigned char *) glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    bool success = mapped != NULL;
+    if (success) {
+        pixels.setFromPixels(mapped, width, height, 4);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        latencyMillis = (ofGetElapsedTimeMicros() - issuedMicros[previous]) / 1000.0;
+    } else {
+        cout << "Error: AsyncPixelReader could not map its pixel buffer" << endl;
+    }
+    pending[previous] = false;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return success;
+}
@@ -0,0 +1,44 @@
+//
+//  AsyncPixelReader.h
+//  Relief2
+//
+//
+
+#ifndef __Relief2__AsyncPixelReader__
+#define __Relief2__AsyncPixelReader__
+
+#include "ofMain.h"
+
+
+// reads an fbo back through a ring of pixel buffer objects. the read issued in one frame is
+// collected when the ring comes back around to its buffer, so the cpu never waits for the gpu
+// to finish rendering, at the cost of one frame of latency per buffer beyond the first.
+
+class AsyncPixelReader {
+public:
+    ~AsyncPixelReader();
+
+    void setup(int width, int height);
+    void clear();
+    bool isAllocated() { return allocated; }
+
+    // start reading this frame's fbo contents, then collect the oldest read in the ring.
+    // returns false while no earlier read is available
+    bool readToPixels(ofFbo &fbo, ofPixels &pixels);
+
+    // time between issuing the collected read and collecting it
+    float getLatencyMillis() { return latencyMillis; }
+    int getLatencyFrames() { return numPixelBuffers - 1; }
+
+private:
+    static const int numPixelBuffers = 2;
+    GLuint pixelBuffers[numPixelBuffers];
+    unsigned long long issuedMicros[numPixelBuffers];
+    bool pending[numPixelBuffers];
+    int nextBuffer = 0;
+    int width = 0, height = 0;
+    bool allocated = false;
+    float latencyMillis = 0;
+};
+
+#endif /* defined(__Relief2__AsyncPixelReader__) */
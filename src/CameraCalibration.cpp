@@ -7,32 +7,612 @@
 //
 
 #include "CameraCalibration.h"
+#include "ofxXmlSettings.h"
+#include "Poco/Condition.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-// All calibrations were calculated on inFORM 1. They may need recalibration.
+
+// Default calibrations were calculated on inFORM 1. They may need recalibration.
 // All functions assume x-y coordinates normalized to [0, 1] and height [0, 255].
 
+// models resolved for every integer height, rebuilt whenever new models are set
+static ReprojectionModel modelsByHeight[256];
+static bool modelsInitialized = false;
+static int modelsVersion = 0;   // bumped on every change so dependent caches can rebuild
+static bool modelsAreDefaults = false;
+
+// the original hand-tuned models. the camera model was only measured at cube height (140) and
+// is applied at all heights; the projector model is linear in height, so two samples suffice.
+// the camera model was tuned on coordinates normalized to the camera roi; it takes table frame
+// coordinates here, converted through the default table corners (roi = 0.976 * table + 0.018
+// in x, 0.963 * table + 0.021 in y)
+static vector<ReprojectionModel> defaultReprojectionModels() {
+    vector<ReprojectionModel> models(2);
+    for (int i = 0; i < 2; i++) {
+        float height = i * 255;
+        models[i].height = height;
+        models[i].cameraScale.set(0.9331, 0.9187);
+        models[i].cameraOffset.set(0.0380, 0.0590);
+        models[i].projectorScale.set(1 - 0.0002000 * height, 1 - 0.0001588 * height);
+        models[i].projectorOffset.set(0.00012 * height, -0.00002 * height);
+        models[i].projectorOffset.y -= 0.0333; // short-term calibration hack: note that this breaks the intended structure of the math
+    }
+    return models;
+}
+
+// the original projector model, evaluated exactly as first written. interpolating the default
+// models rounds differently in the last bit, enough to move one table column at cube height, so
+// the defaults are evaluated through these to keep reprojection bit-identical to the original
+static float defaultProjectorXCoordinateFromHeight(float x, int height) {
+    return (1 - 0.0002000 * height) * x + 0.00012 * height;
+}
+
+static float defaultProjectorYCoordinateFromHeight(float y, int height) {
+    float reprojected = (1 - 0.0001588 * height) * y - 0.00002 * height;
+    reprojected -= 0.0333; // short-term calibration hack: note that this breaks the intended structure of the math
+    return reprojected;
+}
+
+void setReprojectionModels(vector<ReprojectionModel> &models) {
+    if (models.empty()) {
+        cout << "Error: setReprojectionModels needs at least one model" << endl;
+        return;
+    }
+    modelsAreDefaults = false;
+
+    // models must be sorted by height for interpolation
+    vector<ReprojectionModel> sorted = models;
+    for (int i = 1; i < sorted.size(); i++) {
+        for (int j = i; j > 0 && sorted[j].height < sorted[j - 1].height; j--) {
+            swap(sorted[j], sorted[j - 1]);
+        }
+    }
+
+    for (int height = 0; height < 256; height++) {
+        if (sorted.size() == 1) {
+            modelsByHeight[height] = sorted[0];
+            modelsByHeight[height].height = height;
+            continue;
+        }
+
+        // interpolate within the bracketing pair, or extrapolate from the nearest end pair
+        int k = 0;
+        while (k < sorted.size() - 2 && height > sorted[k + 1].height) {
+            k++;
+        }
+        ReprojectionModel &a = sorted[k];
+        ReprojectionModel &b = sorted[k + 1];
+        float t = (b.height == a.height) ? 0 : (height - a.height) / (b.height - a.height);
+
+        ReprojectionModel &model = modelsByHeight[height];
+        model.height = height;
+        model.cameraScale = a.cameraScale + (b.cameraScale - a.cameraScale) * t;
+        model.cameraOffset = a.cameraOffset + (b.cameraOffset - a.cameraOffset) * t;
+        model.projectorScale = a.projectorScale + (b.projectorScale - a.projectorScale) * t;
+        model.projectorOffset = a.projectorOffset + (b.projectorOffset - a.projectorOffset) * t;
+    }
+    modelsInitialized = true;
+    modelsVersion++;
+}
+
+const ReprojectionModel &reprojectionModelAtHeight(int height) {
+    if (!modelsInitialized) {
+        vector<ReprojectionModel> defaults = defaultReprojectionModels();
+        setReprojectionModels(defaults);
+        modelsAreDefaults = true;
+    }
+    return modelsByHeight[(int) ofClamp(height, 0, 255)];
+}
+
+// load fitted models, keeping the current ones if the file is missing or empty
+bool loadReprojectionModels(string fileName) {
+    ofxXmlSettings xml;
+    if (!xml.loadFile(fileName)) {
+        return false;
+    }
+
+    vector<ReprojectionModel> models(xml.getNumTags("MODEL"));
+    for (int i = 0; i < models.size(); i++) {
+        xml.pushTag("MODEL", i);
+        models[i].height = xml.getValue("HEIGHT", 0.0);
+        models[i].cameraScale.set(xml.getValue("CAMERA_SCALE_X", 1.0), xml.getValue("CAMERA_SCALE_Y", 1.0));
+        models[i].cameraOffset.set(xml.getValue("CAMERA_OFFSET_X", 0.0), xml.getValue("CAMERA_OFFSET_Y", 0.0));
+        models[i].projectorScale.set(xml.getValue("PROJECTOR_SCALE_X", 1.0), xml.getValue("PROJECTOR_SCALE_Y", 1.0));
+        models[i].projectorOffset.set(xml.getValue("PROJECTOR_OFFSET_X", 0.0), xml.getValue("PROJECTOR_OFFSET_Y", 0.0));
+        xml.popTag();
+    }
+    if (models.empty()) {
+        return false;
+    }
+    setReprojectionModels(models);
+    return true;
+}
+
+void saveReprojectionModels(vector<ReprojectionModel> &models, string fileName) {
+    ofxXmlSettings xml;
+    for (int i = 0; i < models.size(); i++) {
+        xml.addTag("MODEL");
+        xml.pushTag("MODEL", i);
+        xml.setValue("HEIGHT", models[i].height);
+        xml.setValue("CAMERA_SCALE_X", models[i].cameraScale.x);
+        xml.setValue("CAMERA_SCALE_Y", models[i].cameraScale.y);
+        xml.setValue("CAMERA_OFFSET_X", models[i].cameraOffset.x);
+        xml.setValue("CAMERA_OFFSET_Y", models[i].cameraOffset.y);
+        xml.setValue("PROJECTOR_SCALE_X", models[i].projectorScale.x);
+        xml.setValue("PROJECTOR_SCALE_Y", models[i].projectorScale.y);
+        xml.setValue("PROJECTOR_OFFSET_X", models[i].projectorOffset.x);
+        xml.setValue("PROJECTOR_OFFSET_Y", models[i].projectorOffset.y);
+        xml.popTag();
+    }
+    xml.saveFile(fileName);
+}
+
 // note: for now, assume conversion is always from cube height (140) to ground.
 void reprojectColorCameraCoordinateFromHeight(ofPoint &rawXYZPoint, ofPoint &output) {
-    output.x = 0.9557 * rawXYZPoint.x + 0.0204;
-    output.y = 0.9538 * rawXYZPoint.y + 0.0389;
+    const ReprojectionModel &model = reprojectionModelAtHeight(STANDARD_CUBE_HEIGHT);
+    output.x = model.cameraScale.x * rawXYZPoint.x + model.cameraOffset.x;
+    output.y = model.cameraScale.y * rawXYZPoint.y + model.cameraOffset.y;
     output.z = 0;
 }
 
 float reprojectProjectorXCoordinateFromHeight(float x, int height) {
-    return (1 - 0.0002000 * height) * x + 0.00012 * height;
+    const ReprojectionModel &model = reprojectionModelAtHeight(height);
+    if (modelsAreDefaults) {
+        return defaultProjectorXCoordinateFromHeight(x, height);
+    }
+    return model.projectorScale.x * x + model.projectorOffset.x;
 }
 
 float reprojectProjectorYCoordinateFromHeight(float y, int height) {
-    float reprojected = (1 - 0.0001588 * height) * y - 0.00002 * height;
-    reprojected -= 0.0333; // short-term calibration hack: note that this breaks the intended structure of the math
-    return reprojected;
+    const ReprojectionModel &model = reprojectionModelAtHeight(height);
+    if (modelsAreDefaults) {
+        return defaultProjectorYCoordinateFromHeight(y, height);
+    }
+    return model.projectorScale.y * y + model.projectorOffset.y;
+}
+
+// source lookups for reprojectProjectorPixelsForHeightMap. the x mapping depends only on the
+// output column and height level and the y mapping only on the output row and height level, so
+// each level needs just a column table and a row table. levels are 255, 140 and 0.
+static const int numReprojectionLevels = 3;
+static const int reprojectionLevelHeights[numReprojectionLevels] = {255, 140, 0};
+
+struct ReprojectionTables {
+    int width2D = -1;
+    int height2D = -1;
+    int modelsVersion = -1;
+    int xMin, yMin, width, height;
+    vector<int> columns[numReprojectionLevels];     // source x per output column, or -1 if out of range
+    vector<int> rows[numReprojectionLevels];        // source row offset (y * width2D) per output row, or -1
+
+    // continuous mode: the same lookups at every height, plus each output column's and row's
+    // projector ray in pin units, position = base + slope * height
+    bool continuousBuilt = false;
+    vector<int> columnsByHeight;                    // [height * width + column]
+    vector<int> rowsByHeight;                       // [height * height + row]
+    vector<float> rayBaseX, raySlopeX, rayInverseSlopeX;
+    vector<float> rayBaseY, raySlopeY, rayInverseSlopeY;
+};
+
+static ReprojectionTables reprojectionTables;
+static ReprojectionMode reprojectionMode = REPROJECT_HEIGHT_LEVELS;
+static float reprojectionMillis = 0;    // smoothed time per reprojectProjectorPixelsForHeightMap call
+
+void setReprojectionMode(ReprojectionMode mode) {
+    reprojectionMode = mode;
+}
+
+ReprojectionMode getReprojectionMode() {
+    return reprojectionMode;
+}
+
+float getReprojectionMillis() {
+    return reprojectionMillis;
+}
+
+// rebuild the tables when the input size or the reprojection models change. the arithmetic
+// mirrors the original per-pixel calculation exactly, so with the default models results are
+// bit-identical to it
+static void updateReprojectionTables(int width2D, int height2D) {
+    reprojectionModelAtHeight(0); // make sure models exist before checking their version
+    ReprojectionTables &tables = reprojectionTables;
+    if (tables.width2D == width2D && tables.height2D == height2D && tables.modelsVersion == modelsVersion) {
+        return;
+    }
+    tables.width2D = width2D;
+    tables.height2D = height2D;
+    tables.modelsVersion = modelsVersion;
+    tables.continuousBuilt = false;
+
+    // calculate dimensions of reprojected graphics
+    tables.xMin = (int) (RELIEF_PROJECTOR_SIZE_X * projectorMinXCoordinateBoundaryAtCubeHeight);
+    tables.yMin = (int) (RELIEF_PROJECTOR_SIZE_Y * projectorMinYCoordinateBoundaryAtCubeHeight);
+    int xMax = (int) (RELIEF_PROJECTOR_SIZE_X * projectorMaxXCoordinateBoundaryAtCubeHeight);
+    int yMax = (int) (RELIEF_PROJECTOR_SIZE_Y * projectorMaxYCoordinateBoundaryAtCubeHeight);
+    tables.width = xMax - tables.xMin;
+    tables.height = yMax - tables.yMin;
+
+    for (int level = 0; level < numReprojectionLevels; level++) {
+        int levelHeight = reprojectionLevelHeights[level];
+        tables.columns[level].resize(tables.width);
+        tables.rows[level].resize(tables.height);
+
+        for (int i = 0; i < tables.width; i++) {
+            float xRP = tables.xMin + i;
+            int x;
+            if (levelHeight == 0 && modelsAreDefaults) {
+                // the default x model is the identity at the surface
+                x = (int) (width2D * xRP / RELIEF_PROJECTOR_SIZE_X);
+            } else {
+                x = (int) (width2D * reprojectProjectorXCoordinateFromHeight(1.0 * xRP / RELIEF_PROJECTOR_SIZE_X, levelHeight));
+            }
+            tables.columns[level][i] = (0 <= x && x < width2D) ? x : -1;
+        }
+
+        for (int j = 0; j < tables.height; j++) {
+            float yRP = tables.yMin + j;
+            int y;
+            if (levelHeight == 0 && modelsAreDefaults) {
+                // as for x; the models' y calibration offset does not apply at the surface
+                y = (int) (height2D * yRP / RELIEF_PROJECTOR_SIZE_Y);
+            } else {
+                y = (int) (height2D * reprojectProjectorYCoordinateFromHeight(1.0 * yRP / RELIEF_PROJECTOR_SIZE_Y, levelHeight));
+            }
+            tables.rows[level][j] = (0 <= y && y < height2D) ? y * width2D : -1;
+        }
+    }
+}
+
+// build the continuous mode tables on first use after the level tables have been updated
+static void updateContinuousReprojectionTables() {
+    ReprojectionTables &tables = reprojectionTables;
+    if (tables.continuousBuilt) {
+        return;
+    }
+    int width2D = tables.width2D;
+    int height2D = tables.height2D;
+    tables.columnsByHeight.resize(256 * tables.width);
+    tables.rowsByHeight.resize(256 * tables.height);
+    tables.rayBaseX.resize(tables.width);
+    tables.raySlopeX.resize(tables.width);
+    tables.rayInverseSlopeX.resize(tables.width);
+    tables.rayBaseY.resize(tables.height);
+    tables.raySlopeY.resize(tables.height);
+    tables.rayInverseSlopeY.resize(tables.height);
+
+    // height 0 shares the level 0 tables, so both modes agree on the table surface
+    for (int i = 0; i < tables.width; i++) {
+        float x = 1.0 * (tables.xMin + i) / RELIEF_PROJECTOR_SIZE_X;
+        tables.columnsByHeight[i] = tables.columns[2][i];
+        for (int height = 1; height < 256; height++) {
+            int sourceX = (int) (width2D * reprojectProjectorXCoordinateFromHeight(x, height));
+            tables.columnsByHeight[height * tables.width + i] = (0 <= sourceX && sourceX < width2D) ? sourceX : -1;
+        }
+        float bottom = RELIEF_SIZE_X * reprojectProjectorXCoordinateFromHeight(x, 0);
+        float top = RELIEF_SIZE_X * reprojectProjectorXCoordinateFromHeight(x, 255);
+        tables.rayBaseX[i] = bottom;
+        tables.raySlopeX[i] = (top - bottom) / 255;
+        tables.rayInverseSlopeX[i] = (top == bottom) ? 0 : 255 / (top - bottom);
+    }
+
+    for (int j = 0; j < tables.height; j++) {
+        float y = 1.0 * (tables.yMin + j) / RELIEF_PROJECTOR_SIZE_Y;
+        tables.rowsByHeight[j] = tables.rows[2][j];
+        for (int height = 1; height < 256; height++) {
+            int sourceY = (int) (height2D * reprojectProjectorYCoordinateFromHeight(y, height));
+            tables.rowsByHeight[height * tables.height + j] = (0 <= sourceY && sourceY < height2D) ? sourceY * width2D : -1;
+        }
+        float bottom = RELIEF_SIZE_Y * reprojectProjectorYCoordinateFromHeight(y, 0);
+        float top = RELIEF_SIZE_Y * reprojectProjectorYCoordinateFromHeight(y, 255);
+        tables.rayBaseY[j] = bottom;
+        tables.raySlopeY[j] = (top - bottom) / 255;
+        tables.rayInverseSlopeY[j] = (top == bottom) ? 0 : 255 / (top - bottom);
+    }
+
+    tables.continuousBuilt = true;
+}
+
+// max-height mip pyramid over the pin height field, padded to a power of two. level 0 holds one
+// pin per cell and each coarser level holds the max of the 2x2 cells below it
+static const int heightFieldSize = 32;
+static const int heightFieldLevels = 6;     // 32, 16, 8, 4, 2 and 1 cells across
+static unsigned char heightPyramid[heightFieldLevels][heightFieldSize * heightFieldSize];
+
+static void buildHeightPyramid(const unsigned char *heightMap, int width2D, int height2D, int numChannels) {
+    // sample the height map at pin centers
+    memset(heightPyramid[0], 0, sizeof(heightPyramid[0]));
+    for (int j = 0; j < RELIEF_SIZE_Y; j++) {
+        int y = (int) ((j + 0.5) * height2D / RELIEF_SIZE_Y);
+        for (int i = 0; i < RELIEF_SIZE_X; i++) {
+            int x = (int) ((i + 0.5) * width2D / RELIEF_SIZE_X);
+            heightPyramid[0][j * heightFieldSize + i] = heightMap[(y * width2D + x) * numChannels];
+        }
+    }
+
+    for (int level = 1; level < heightFieldLevels; level++) {
+        int cells = heightFieldSize >> level;
+        unsigned char *finer = heightPyramid[level - 1];
+        unsigned char *coarser = heightPyramid[level];
+        for (int cy = 0; cy < cells; cy++) {
+            for (int cx = 0; cx < cells; cx++) {
+                int i = 2 * cy * 2 * cells + 2 * cx;
+                coarser[cy * cells + cx] = max(max(finer[i], finer[i + 1]), max(finer[i + 2 * cells], finer[i + 2 * cells + 1]));
+            }
+        }
+    }
+}
+
+// march a projector ray down from height 255 and return the height where it first meets the
+// pin height field. rays hitting a pin below its top strike its side wall at the entry height.
+// empty cells are skipped at the coarsest level whose max lies below the ray
+static float marchHeightField(float baseX, float slopeX, float inverseSlopeX, float baseY, float slopeY, float inverseSlopeY) {
+    // nothing lies above the tallest pin, so start there
+    float height = min(255, (int) heightPyramid[heightFieldLevels - 1][0]);
+    int level = 2;
+
+    for (int iteration = 0; iteration < 64 && height > 0; iteration++) {
+        // integer pin coordinates, floored via an offset so negative positions round down too
+        int pinX = (int) (baseX + slopeX * height + heightFieldSize) - heightFieldSize;
+        int pinY = (int) (baseY + slopeY * height + heightFieldSize) - heightFieldSize;
+        int size = 1 << level;
+        int cells = heightFieldSize >> level;
+        int cx = pinX >> level;
+        int cy = pinY >> level;
+        bool inside = cx >= 0 && cx < cells && cy >= 0 && cy < cells;
+        float cellMax = inside ? heightPyramid[level][cy * cells + cx] : 0;
+
+        // the ray is already below this cell's max: look closer, or report a side wall hit
+        if (cellMax >= height) {
+            if (level == 0) {
+                return height;
+            }
+            level--;
+            continue;
+        }
+
+        // height at which the descending ray leaves this cell
+        float exitHeight = 0;
+        if (slopeX > 0) {
+            exitHeight = max(exitHeight, (cx * size - baseX) * inverseSlopeX);
+        } else if (slopeX < 0) {
+            exitHeight = max(exitHeight, ((cx + 1) * size - baseX) * inverseSlopeX);
+        }
+        if (slopeY > 0) {
+            exitHeight = max(exitHeight, (cy * size - baseY) * inverseSlopeY);
+        } else if (slopeY < 0) {
+            exitHeight = max(exitHeight, ((cy + 1) * size - baseY) * inverseSlopeY);
+        }
+
+        // the ray drops to the cell's max before leaving: land on a pin top, or look closer
+        if (exitHeight <= cellMax) {
+            if (level == 0) {
+                return cellMax;
+            }
+            height = cellMax;
+            level--;
+            continue;
+        }
+
+        // the ray passes over this cell; step just past its boundary and widen the search
+        height = min(exitHeight, height) - 0.05;
+        if (level < heightFieldLevels - 1) {
+            level++;
+        }
+    }
+    return max(height, 0.0f);
+}
+
+// copy gathered source pixels into an output row, skipping pixels without a source (-1). rgba
+// pixels are copied as whole words, keeping the output's opaque alpha
+static void copyGatheredPixels(const unsigned char *pixels2D, const int *sources, unsigned char *output, int count, int numChannels) {
+    int i = 0;
+    if (numChannels == 4) {
+#if defined(__SSE2__)
+        // four pixels per store: gather their color words, then keep the output's alpha byte and
+        // every byte of pixels without a source
+        const __m128i alphaMask = _mm_set1_epi32((int) 0xFF000000);
+        const __m128i noSource = _mm_set1_epi32(-1);
+        for (; i + 4 <= count; i += 4) {
+            int words[4] = {0, 0, 0, 0};
+            for (int k = 0; k < 4; k++) {
+                if (sources[i + k] >= 0) {
+                    memcpy(&words[k], pixels2D + sources[i + k] * 4, 4);
+                }
+            }
+            __m128i color = _mm_loadu_si128((const __m128i *) words);
+            __m128i missing = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (sources + i)), noSource);
+            __m128i keep = _mm_or_si128(alphaMask, missing);
+            __m128i current = _mm_loadu_si128((const __m128i *) (output + i * 4));
+            _mm_storeu_si128((__m128i *) (output + i * 4), _mm_or_si128(_mm_and_si128(keep, current), _mm_andnot_si128(keep, color)));
+        }
+#endif
+        for (; i < count; i++) {
+            if (sources[i] < 0) {
+                continue;
+            }
+            unsigned char *pixel = output + i * 4;
+            unsigned char alpha = pixel[3];
+            memcpy(pixel, pixels2D + sources[i] * 4, 4);
+            pixel[3] = alpha;
+        }
+    } else {
+        for (; i < count; i++) {
+            if (sources[i] < 0) {
+                continue;
+            }
+            const unsigned char *input = pixels2D + sources[i] * numChannels;
+            unsigned char *pixel = output + i * numChannels;
+            pixel[0] = input[0];
+            pixel[1] = input[1];
+            pixel[2] = input[2];
+        }
+    }
+}
+
+// continuous mode marches one ray per corner of each block of output pixels and fills blocks
+// whose four corners land on the same height without marching their inner pixels. pins are
+// about 30 output pixels across, so a 4 pixel block seldom straddles a pin edge unseen
+static const int continuousBlockSize = 4;
+
+static int marchedHeight(int i, int j) {
+    ReprojectionTables &tables = reprojectionTables;
+    float hit = marchHeightField(tables.rayBaseX[i], tables.raySlopeX[i], tables.rayInverseSlopeX[i],
+        tables.rayBaseY[j], tables.raySlopeY[j], tables.rayInverseSlopeY[j]);
+    return (int) (hit + 0.5);
+}
+
+// march the block corners along output row j: every continuousBlockSize-th column and the last
+static void marchBlockCorners(int j, vector<int> &corners) {
+    int width = reprojectionTables.width;
+    for (int c = 0; c < corners.size(); c++) {
+        corners[c] = marchedHeight(min(c * continuousBlockSize, width - 1), j);
+    }
+}
+
+// gather one band of output rows in continuous mode
+static void reprojectRowsContinuous(const unsigned char *pixels2D, const unsigned char *heightMap, unsigned char *reprojected, int numChannels, int rowBegin, int rowEnd) {
+    ReprojectionTables &tables = reprojectionTables;
+    if (rowBegin >= rowEnd) {
+        return;
+    }
+    int numCorners = (tables.width - 1 + continuousBlockSize - 1) / continuousBlockSize + 1;
+    vector<int> top(numCorners), bottom(numCorners);
+    vector<int> sources(tables.width);
+
+    marchBlockCorners(rowBegin, top);
+    for (int blockRow = rowBegin; blockRow < rowEnd; blockRow += continuousBlockSize) {
+        marchBlockCorners(min(blockRow + continuousBlockSize, tables.height - 1), bottom);
+
+        for (int j = blockRow; j < min(blockRow + continuousBlockSize, rowEnd); j++) {
+            for (int c = 0; c + 1 < numCorners; c++) {
+                int blockBegin = c * continuousBlockSize;
+                int blockEnd = (c + 2 == numCorners) ? tables.width : blockBegin + continuousBlockSize;
+                bool uniform = top[c] == top[c + 1] && top[c] == bottom[c] && top[c] == bottom[c + 1];
+                for (int i = blockBegin; i < blockEnd; i++) {
+                    int height = uniform ? top[c] : marchedHeight(i, j);
+                    int column = tables.columnsByHeight[height * tables.width + i];
+                    int row = tables.rowsByHeight[height * tables.height + j];
+                    sources[i] = (column < 0 || row < 0) ? -1 : row + column;
+                }
+            }
+            copyGatheredPixels(pixels2D, &sources[0], reprojected + j * tables.width * numChannels, tables.width, numChannels);
+        }
+        top.swap(bottom);
+    }
 }
 
+// gather one band of output rows
+static void reprojectRows(const unsigned char *pixels2D, const unsigned char *heightMap, unsigned char *reprojected, int numChannels, int rowBegin, int rowEnd) {
+    ReprojectionTables &tables = reprojectionTables;
+    const int *columns255 = &tables.columns[0][0];
+    const int *columns140 = &tables.columns[1][0];
+    const int *columns0 = &tables.columns[2][0];
+    vector<int> sources(tables.width);
+
+    for (int j = rowBegin; j < rowEnd; j++) {
+        int row255 = tables.rows[0][j];
+        int row140 = tables.rows[1][j];
+        int row0 = tables.rows[2][j];
+
+        for (int i = 0; i < tables.width; i++) {
+            // since the height map pixels are grayscale regardless of image type, the first channel
+            // is sufficient to gauge pin height.
+            //
+            // NOTE: this approximates all heights as being either 255, 140, or 0
+            int source = -1;
+            if (row255 >= 0 && columns255[i] >= 0 && heightMap[(row255 + columns255[i]) * numChannels] > 200) {
+                source = row255 + columns255[i];
+            } else if (row140 >= 0 && columns140[i] >= 0) {
+                source = row140 + columns140[i];
+            } else if (row0 >= 0 && columns0[i] >= 0) {
+                source = row0 + columns0[i];
+            }
+            sources[i] = source;
+        }
+        copyGatheredPixels(pixels2D, &sources[0], reprojected + j * tables.width * numChannels, tables.width, numChannels);
+    }
+}
+
+typedef void (*ReprojectionKernel)(const unsigned char *, const unsigned char *, unsigned char *, int, int, int);
+
+// persistent worker reprojecting one band of rows per frame. it is started on first use and
+// sleeps until handed a band, so a frame costs a wake-up rather than a thread start and join
+class ReprojectionWorker : public ofThread {
+public:
+    // stop before the condition variables are destroyed under a sleeping thread
+    ~ReprojectionWorker() {
+        stopThread();
+        waitForThread(false);
+    }
+
+    void run(ReprojectionKernel kernel, const unsigned char *pixels2D, const unsigned char *heightMap, unsigned char *reprojected, int numChannels, int rowBegin, int rowEnd) {
+        if (!isThreadRunning()) {
+            startThread(true, false);   // blocking, not verbose
+        }
+        lock();
+        this->kernel = kernel;
+        this->pixels2D = pixels2D;
+        this->heightMap = heightMap;
+        this->reprojected = reprojected;
+        this->numChannels = numChannels;
+        this->rowBegin = rowBegin;
+        this->rowEnd = rowEnd;
+        pending = true;
+        workReady.signal();
+        unlock();
+    }
+
+    // wait for the band handed over by run() to be done
+    void finish() {
+        lock();
+        while (pending) {
+            workDone.wait(mutex);
+        }
+        unlock();
+    }
+
+private:
+    void threadedFunction() {
+        while (isThreadRunning()) {
+            // wake up now and then to notice stopThread()
+            lock();
+            while (!pending && isThreadRunning()) {
+                workReady.tryWait(mutex, 100);
+            }
+            bool hasBand = pending;
+            unlock();
+            if (!hasBand) {
+                break;
+            }
+
+            kernel(pixels2D, heightMap, reprojected, numChannels, rowBegin, rowEnd);
+
+            lock();
+            pending = false;
+            workDone.broadcast();
+            unlock();
+        }
+    }
+
+    Poco::Condition workReady, workDone;
+    bool pending = false;
+    ReprojectionKernel kernel;
+    const unsigned char *pixels2D;
+    const unsigned char *heightMap;
+    unsigned char *reprojected;
+    int numChannels, rowBegin, rowEnd;
+};
+
+static const int numReprojectionBands = 4;
+static ReprojectionWorker reprojectionWorkers[numReprojectionBands - 1];
+
 // reproject 2D pixels for projection onto a height map
 //
-// NOTE: this function approximates all heights as being either 255, 140, or 0.
-// An efficient correct implementation of this functionality would be nice to have.
+// NOTE: by default this function approximates all heights as being either 255, 140, or 0. the
+// continuous reprojection mode resolves every height level and occlusion between pins.
 void reprojectProjectorPixelsForHeightMap(ofPixels &pixels2D, ofPixels &heightMap, ofPixels &reprojectedPixels) {
     // get input dimensions
     int width2D = pixels2D.getWidth();
@@ -48,72 +628,38 @@ void reprojectProjectorPixelsForHeightMap(ofPixels &pixels2D, ofPixels &heightMa
         return;
     }
 
-    // calculate dimensions of reprojected graphics
-    ofPoint reprojectedGraphicsBoundaries[2]; // min and max coordinates for reprojected pixels
-    reprojectedGraphicsBoundaries[0].x = (int) (RELIEF_PROJECTOR_SIZE_X * projectorMinXCoordinateBoundaryAtCubeHeight);
-    reprojectedGraphicsBoundaries[0].y = (int) (RELIEF_PROJECTOR_SIZE_Y * projectorMinYCoordinateBoundaryAtCubeHeight);
-    reprojectedGraphicsBoundaries[1].x = (int) (RELIEF_PROJECTOR_SIZE_X * projectorMaxXCoordinateBoundaryAtCubeHeight);
-    reprojectedGraphicsBoundaries[1].y = (int) (RELIEF_PROJECTOR_SIZE_Y * projectorMaxYCoordinateBoundaryAtCubeHeight);
-    ofPoint reprojectedGraphicsDimensions(reprojectedGraphicsBoundaries[1].x - reprojectedGraphicsBoundaries[0].x,
-        reprojectedGraphicsBoundaries[1].y - reprojectedGraphicsBoundaries[0].y);
+    unsigned long long startMicros = ofGetElapsedTimeMicros();
+    updateReprojectionTables(width2D, height2D);
+    ReprojectionTables &tables = reprojectionTables;
 
     // ensure reprojectedPixels object is allocated and has appropriate dimensions
     if (!reprojectedPixels.isAllocated()) {
-        reprojectedPixels.allocate(reprojectedGraphicsDimensions.x, reprojectedGraphicsDimensions.y, numChannels);
+        reprojectedPixels.allocate(tables.width, tables.height, numChannels);
     } else {
         reprojectedPixels.setNumChannels(numChannels);
-        reprojectedPixels.resize(reprojectedGraphicsDimensions.x, reprojectedGraphicsDimensions.y);
-    }
-
-    // xy coordinates and pixel array indices for reprojectedPixels object and for various height
-    // reprojection mappings of 2D pixel objects
-    ofPoint xyRP;
-    int xMinRP = reprojectedGraphicsBoundaries[0].x;
-    int yMinRP = reprojectedGraphicsBoundaries[0].y;
-    int iRP = 0;
-    ofPoint xyAt255, xyAt140, xyAt0;
-    int indexAt255, indexAt140, indexAt0;
-    bool indexInRangeAt255, indexInRangeAt140, indexInRangeAt0;
-    
-    // reproject 2D pixels for projection onto the height map
+        reprojectedPixels.resize(tables.width, tables.height);
+    }
     reprojectedPixels.setColor(0);
-    for (xyRP.y = yMinRP; xyRP.y < reprojectedGraphicsBoundaries[1].y; xyRP.y += 1) {
-        // reproject y coordinate
-        xyAt255.y = (int) (height2D * reprojectProjectorYCoordinateFromHeight(1.0 * xyRP.y / RELIEF_PROJECTOR_SIZE_Y, 255));
-        xyAt140.y = (int) (height2D * reprojectProjectorYCoordinateFromHeight(1.0 * xyRP.y / RELIEF_PROJECTOR_SIZE_Y, 140));
-        xyAt0.y = (int) (height2D * xyRP.y / RELIEF_PROJECTOR_SIZE_Y);
-
-        for (xyRP.x = xMinRP; xyRP.x < reprojectedGraphicsBoundaries[1].x; xyRP.x += 1, iRP += numChannels) {
-            // reproject x coordinate
-            xyAt255.x = (int) (width2D * reprojectProjectorXCoordinateFromHeight(1.0 * xyRP.x / RELIEF_PROJECTOR_SIZE_X, 255));
-            xyAt140.x = (int) (width2D * reprojectProjectorXCoordinateFromHeight(1.0 * xyRP.x / RELIEF_PROJECTOR_SIZE_X, 140));
-            xyAt0.x = (int) (width2D * xyRP.x / RELIEF_PROJECTOR_SIZE_X);
-
-            // update 2D pixels indices
-            indexAt255 = (xyAt255.x + xyAt255.y * width2D) * numChannels;
-            indexAt140 = (xyAt140.x + xyAt140.y * width2D) * numChannels;
-            indexAt0 = (xyAt0.x + xyAt0.y * width2D) * numChannels;
-            indexInRangeAt255 = 0 <= xyAt255.x && xyAt255.x < width2D && 0 <= xyAt255.y && xyAt255.y < height2D;
-            indexInRangeAt140 = 0 <= xyAt140.x && xyAt140.x < width2D && 0 <= xyAt140.y && xyAt140.y < height2D;
-            indexInRangeAt0 = 0 <= xyAt0.x && xyAt0.x < width2D && 0 <= xyAt0.y && xyAt0.y < height2D;
 
-            // since the height map pixels are grayscale regardless of image type, the first channel
-            // is sufficient to gauge pin height.
-            //
-            // NOTE: this approximates all heights as being either 255, 140, or 0
-            if (indexInRangeAt255 && heightMap[indexAt255] > 200) {
-                reprojectedPixels[iRP + 0] = pixels2D[indexAt255 + 0];
-                reprojectedPixels[iRP + 1] = pixels2D[indexAt255 + 1];
-                reprojectedPixels[iRP + 2] = pixels2D[indexAt255 + 2];
-            } else if (indexInRangeAt140) {// && heightMap[indexAt140] > 100) {    // short-term calibration hack
-                reprojectedPixels[iRP + 0] = pixels2D[indexAt140 + 0];
-                reprojectedPixels[iRP + 1] = pixels2D[indexAt140 + 1];
-                reprojectedPixels[iRP + 2] = pixels2D[indexAt140 + 2];
-            } else if (indexInRangeAt0) {
-                reprojectedPixels[iRP + 0] = pixels2D[indexAt0 + 0];
-                reprojectedPixels[iRP + 1] = pixels2D[indexAt0 + 1];
-                reprojectedPixels[iRP + 2] = pixels2D[indexAt0 + 2];
-            }
-        }
+    ReprojectionKernel kernel = reprojectRows;
+    if (reprojectionMode == REPROJECT_CONTINUOUS) {
+        updateContinuousReprojectionTables();
+        buildHeightPyramid(heightMap.getPixels(), width2D, height2D, numChannels);
+        kernel = reprojectRowsContinuous;
     }
-}
\ No newline at end of file
+
+    // split rows into bands for the workers; the calling thread takes the last band itself
+    int rowsPerBand = (tables.height + numReprojectionBands - 1) / numReprojectionBands;
+    for (int b = 0; b < numReprojectionBands - 1; b++) {
+        reprojectionWorkers[b].run(kernel, pixels2D.getPixels(), heightMap.getPixels(), reprojectedPixels.getPixels(), numChannels,
+            min(b * rowsPerBand, tables.height), min((b + 1) * rowsPerBand, tables.height));
+    }
+    kernel(pixels2D.getPixels(), heightMap.getPixels(), reprojectedPixels.getPixels(), numChannels,
+        min((numReprojectionBands - 1) * rowsPerBand, tables.height), tables.height);
+    for (int b = 0; b < numReprojectionBands - 1; b++) {
+        reprojectionWorkers[b].finish();
+    }
+
+    float millis = (ofGetElapsedTimeMicros() - startMicros) / 1000.0;
+    reprojectionMillis = (reprojectionMillis == 0) ? millis : 0.9 * reprojectionMillis + 0.1 * millis;
+}
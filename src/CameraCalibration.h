@@ -14,9 +14,33 @@
 #define __Relief2__CameraCalibration__
 
 
-// All calibrations were calculated on inFORM 1. They may need recalibration.
+// Default calibrations were calculated on inFORM 1. Fitted replacements are produced by
+// ProjectorCameraCalibrator and loaded with loadReprojectionModels.
 // All functions assume coordinates normalized to [0, 1].
 
+// linear reprojection models for a single pin height. models between sampled heights are
+// interpolated, and extrapolated beyond them
+struct ReprojectionModel {
+    float height;
+    ofPoint cameraScale, cameraOffset;          // ground = cameraScale * camera + cameraOffset
+    ofPoint projectorScale, projectorOffset;    // surface = projectorScale * projector + projectorOffset
+};
+
+bool loadReprojectionModels(string fileName);
+void saveReprojectionModels(vector<ReprojectionModel> &models, string fileName);
+void setReprojectionModels(vector<ReprojectionModel> &models);
+const ReprojectionModel &reprojectionModelAtHeight(int height);
+
+// how reprojectProjectorPixelsForHeightMap resolves pin heights
+enum ReprojectionMode {
+    REPROJECT_HEIGHT_LEVELS,    // snap heights to 0, 140 or 255; the original fast approximation
+    REPROJECT_CONTINUOUS        // ray-march the pin height field at full height resolution
+};
+
+void setReprojectionMode(ReprojectionMode mode);
+ReprojectionMode getReprojectionMode();
+float getReprojectionMillis();
+
 void reprojectColorCameraCoordinateFromHeight(ofPoint &rawXYZPoint, ofPoint &output);
 void reprojectProjectorPixelsForHeightMap(ofPixels &pixels2D, ofPixels &heightMap, ofPixels &reprojectedPixels);
 float reprojectProjectorXCoordinateFromHeight(float x, int height);
@@ -0,0 +1,169 @@
+//
+//  CameraRemap.cpp
+//  Relief2
+//
+//
+
+#include "CameraRemap.h"
+
+
+void CameraRemap::setup(int outputWidth, int outputHeight, int sourceWidth, int sourceHeight) {
+    this->outputWidth = outputWidth;
+    this->outputHeight = outputHeight;
+    this->sourceWidth = sourceWidth;
+    this->sourceHeight = sourceHeight;
+    startThread(true, false);   // blocking, not verbose
+}
+
+void CameraRemap::exit() {
+    stopThread();
+    waitForThread(false);
+}
+
+// read depth to color registration, if it has been calibrated
+void CameraRemap::loadSettings(string fileName) {
+    ofxXmlSettings xml;
+    if (!xml.loadFile(fileName) || !xml.tagExists("REGISTRATION")) {
+        return;
+    }
+    registrationScale.x = xml.getValue("REGISTRATION:SCALE_X", 1.0);
+    registrationScale.y = xml.getValue("REGISTRATION:SCALE_Y", 1.0);
+    registrationOffset.x = xml.getValue("REGISTRATION:OFFSET_X", 0.0);
+    registrationOffset.y = xml.getValue("REGISTRATION:OFFSET_Y", 0.0);
+    registrationCalibrated = registrationScale.x != 0 && registrationScale.y != 0;
+}
+
+void CameraRemap::saveSettings(string fileName) {
+    ofxXmlSettings xml;
+    xml.setValue("REGISTRATION:SCALE_X", registrationScale.x);
+    xml.setValue("REGISTRATION:SCALE_Y", registrationScale.y);
+    xml.setValue("REGISTRATION:OFFSET_X", registrationOffset.x);
+    xml.setValue("REGISTRATION:OFFSET_Y", registrationOffset.y);
+    xml.saveFile(fileName);
+}
+
+void CameraRemap::setRegistration(ofPoint scale, ofPoint offset) {
+    registrationScale = scale;
+    registrationOffset = offset;
+    registrationCalibrated = scale.x != 0 && scale.y != 0;
+}
+
+void CameraRemap::rebuild(TableFrame &frame, ofRectangle roi, bool keystone) {
+    Parameters parameters;
+    parameters.frame = frame;
+    parameters.roi = roi;
+    parameters.keystone = keystone;
+    parameters.registrationScale = registrationScale;
+    parameters.registrationOffset = registrationOffset;
+    parameters.registrationCalibrated = registrationCalibrated;
+
+    // the first tables are built right away so the tracker never runs without them
+    if (colorTable.empty()) {
+        buildTables(parameters, colorTable, depthTable);
+        return;
+    }
+
+    lock();
+    pendingParameters = parameters;
+    rebuildRequested = true;
+    unlock();
+}
+
+bool CameraRemap::update() {
+    bool swapped = false;
+    lock();
+    if (rebuildReady) {
+        colorTable.swap(builtColorTable);
+        depthTable.swap(builtDepthTable);
+        rebuildReady = false;
+        swapped = true;
+    }
+    unlock();
+    return swapped;
+}
+
+void CameraRemap::threadedFunction() {
+    Parameters parameters;
+    vector<int> colorOut, depthOut;
+
+    while (isThreadRunning()) {
+        lock();
+        bool build = rebuildRequested;
+        if (build) {
+            parameters = pendingParameters;
+            rebuildRequested = false;
+        }
+        unlock();
+
+        if (!build) {
+            ofSleepMillis(20);
+            continue;
+        }
+
+        buildTables(parameters, colorOut, depthOut);
+
+        lock();
+        builtColorTable.swap(colorOut);
+        builtDepthTable.swap(depthOut);
+        rebuildReady = true;
+        unlock();
+    }
+}
+
+void CameraRemap::buildTables(Parameters &parameters, vector<int> &colorOut, vector<int> &depthOut) {
+    int size = outputWidth * outputHeight;
+    colorOut.resize(size);
+    depthOut.resize(size);
+
+    for (int y = 0; y < outputHeight; y++) {
+        for (int x = 0; x < outputWidth; x++) {
+            // raw color position for this output pixel
+            ofPoint color;
+            if (parameters.keystone) {
+                color.set((x + 0.5) / outputWidth, (y + 0.5) / outputHeight);
+                parameters.frame.tableToCamera(color);
+            } else {
+                color.set(parameters.roi.x + x, parameters.roi.y + y);
+            }
+
+            // raw depth position; without calibrated registration depth arrives registered
+            ofPoint depth = color;
+            if (parameters.registrationCalibrated) {
+                depth.x = (color.x - parameters.registrationOffset.x) / parameters.registrationScale.x;
+                depth.y = (color.y - parameters.registrationOffset.y) / parameters.registrationScale.y;
+            }
+
+            int i = y * outputWidth + x;
+            int colorX = (int) floor(color.x + 0.5), colorY = (int) floor(color.y + 0.5);
+            int depthX = (int) floor(depth.x + 0.5), depthY = (int) floor(depth.y + 0.5);
+            bool colorInside = colorX >= 0 && colorX < sourceWidth && colorY >= 0 && colorY < sourceHeight;
+            bool depthInside = depthX >= 0 && depthX < sourceWidth && depthY >= 0 && depthY < sourceHeight;
+            colorOut[i] = colorInside ? colorY * sourceWidth + colorX : -1;
+            depthOut[i] = depthInside ? depthY * sourceWidth + depthX : -1;
+        }
+    }
+}
+
+void CameraRemap::remapColor(const unsigned char *source, unsigned char *output) {
+    int size = colorTable.size();
+    for (int i = 0; i < size; i++) {
+        int index = colorTable[i];
+        if (index < 0) {
+            output[0] = output[1] = output[2] = 0;
+        } else {
+            const unsigned char *pixel = source + index * 3;
+            output[0] = pixel[0];
+            output[1] = pixel[1];
+            output[2] = pixel[2];
+        }
+        output += 3;
+    }
+}
+
+void CameraRemap::remapDepth(const unsigned char *source, unsigned char *output) {
+    int size = depthTable.size();
+    for (int i = 0; i < size; i++) {
+        int index = depthTable[i];
+        output[i] = index < 0 ? 0 : source[index];
+    }
+}
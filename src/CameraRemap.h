@@ -0,0 +1,83 @@
+//
+//  CameraRemap.h
+//  Relief2
+//
+//
+
+#ifndef __Relief2__CameraRemap__
+#define __Relief2__CameraRemap__
+
+#include "ofMain.h"
+#include "ofThread.h"
+#include "ofxXmlSettings.h"
+#include "TableFrame.h"
+
+
+// Precomputed gather tables that produce the tracker's input images straight from raw kinect
+// frames. One table entry per output pixel holds the raw source pixel index (or -1 for none),
+// so crop, optional keystone correction and depth to color registration cost a single lookup
+// per pixel, evaluated only inside the table region.
+//
+// Registration is modelled as an axis-aligned scale and offset from depth to color pixels at
+// table depth, measured by ProjectorCameraCalibrator. Until it has been calibrated the tables
+// assume depth is already registered by the kinect driver.
+//
+// Tables are rebuilt on a background thread whenever calibration changes; update() swaps a
+// finished rebuild in from the main thread.
+
+class CameraRemap : public ofThread {
+public:
+    void setup(int outputWidth, int outputHeight, int sourceWidth, int sourceHeight);
+    void exit();
+
+    void loadSettings(string fileName);
+    void saveSettings(string fileName);
+    bool hasRegistration() { return registrationCalibrated; }
+
+    // calibrated registration takes effect with the next rebuild
+    void setRegistration(ofPoint scale, ofPoint offset);
+
+    // request a rebuild for a new table frame. with keystone off the output is a plain crop of
+    // the roi; with keystone on each output pixel samples the matching table position
+    void rebuild(TableFrame &frame, ofRectangle roi, bool keystone);
+
+    // swap in finished tables. returns true when new tables were installed
+    bool update();
+
+    void remapColor(const unsigned char *source, unsigned char *output);
+    void remapDepth(const unsigned char *source, unsigned char *output);
+
+private:
+    struct Parameters {
+        TableFrame frame;
+        ofRectangle roi;
+        bool keystone;
+        ofPoint registrationScale;
+        ofPoint registrationOffset;
+        bool registrationCalibrated;
+    };
+
+    void threadedFunction();
+    void buildTables(Parameters &parameters, vector<int> &colorOut, vector<int> &depthOut);
+
+    int outputWidth, outputHeight;
+    int sourceWidth, sourceHeight;
+
+    // color = depth * scale + offset, in raw pixels
+    ofPoint registrationScale = ofPoint(1, 1);
+    ofPoint registrationOffset = ofPoint(0, 0);
+    bool registrationCalibrated = false;
+
+    // tables in use, owned by the main thread
+    vector<int> colorTable;
+    vector<int> depthTable;
+
+    // shared with the rebuild thread; guarded by lock()
+    Parameters pendingParameters;
+    bool rebuildRequested = false;
+    vector<int> builtColorTable;
+    vector<int> builtDepthTable;
+    bool rebuildReady = false;
+};
+
+#endif /* defined(__Relief2__CameraRemap__) */
@@ -0,0 +1,385 @@
+/*
+ *  ReliefBusEmulator.cpp
+ *  Relief
+ *
+ */
+
+#include "ReliefBusEmulator.h"
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+ReliefBusEmulator::ReliefBusEmulator(int baudRate) {
+	bytesPerSecond = baudRate / 10.0;
+	lateMillis = 50;
+	pinSpeed = 400;
+	memset(pinPositions, 0, sizeof(pinPositions));
+	memset(pinFaults, 0, sizeof(pinFaults));
+	memset(faultsChanged, 0, sizeof(faultsChanged));
+	memset(lastReplyMicros, 0, sizeof(lastReplyMicros));
+	resetStats();
+	
+	int firstBoardIds[NUM_SERIAL_CONNECTIONS + 1] = {SERIAL_PORT_0_FIRST_ID, SERIAL_PORT_1_FIRST_ID,
+		SERIAL_PORT_2_FIRST_ID, SERIAL_PORT_3_FIRST_ID, SERIAL_PORT_4_FIRST_ID, NUM_ARDUINOS + 1};
+	for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+		ports[i].firstBoardId = firstBoardIds[i];
+		ports[i].lastBoardId = firstBoardIds[i + 1] - 1;
+		ports[i].receivedLength = 0;
+		ports[i].replyBudget = 0;
+		ports[i].replyCursor = ports[i].firstBoardId;
+		ports[i].linkName = "/tmp/reliefBus-" + ofToString(getpid()) + "-" + ofToString(i);
+		ports[i].unpluggedUntilMicros = 0;
+		resetBoards(ports[i]);
+		if (!openPort(ports[i])) {
+			ofLog(OF_LOG_ERROR, "ReliefBusEmulator: could not open a pseudo-terminal for serial connection " + ofToString(i));
+		}
+	}
+	
+	startThread(true, false);   // blocking, verbose
+}
+
+ReliefBusEmulator::~ReliefBusEmulator() {
+	stopThread();
+	waitForThread(false);
+	for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+		if (ports[i].masterFd >= 0) close(ports[i].masterFd);
+		unlink(ports[i].linkName.c_str());
+	}
+}
+
+// boards power up with their motors on and every other value 0
+void ReliefBusEmulator::resetBoards(emulatedPort &port) {
+	for (int id = port.firstBoardId; id <= port.lastBoardId; id++) {
+		memset(boardValues[id - 1], 0, sizeof(boardValues[id - 1]));
+		memset(boardValues[id - 1][TERM_ID_MAXSPEED - TERM_ID_HEIGHT], EMULATED_DEFAULT_MAX_SPEED, NUM_PINS_ARDUINO);
+	}
+}
+
+// the host sees a hangup, then nothing at the port's name until it is plugged back in. the
+// emulator thread does the unplugging, as it may be reading the port
+void ReliefBusEmulator::unplugPort(int serialConnection, int millis) {
+	lock();
+	ports[serialConnection].unpluggedUntilMicros = ofGetElapsedTimeMicros() + millis * 1000ULL;
+	unlock();
+}
+
+bool ReliefBusEmulator::openPort(emulatedPort &port) {
+	port.slaveName = "";
+	port.masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (port.masterFd < 0) return false;
+	if (grantpt(port.masterFd) != 0 || unlockpt(port.masterFd) != 0 || ptsname(port.masterFd) == NULL) {
+		close(port.masterFd);
+		port.masterFd = -1;
+		return false;
+	}
+	port.slaveName = ptsname(port.masterFd);
+	
+	// pass bytes through untouched, and never block the emulator thread
+	struct termios options;
+	tcgetattr(port.masterFd, &options);
+	cfmakeraw(&options);
+	tcsetattr(port.masterFd, TCSANOW, &options);
+	fcntl(port.masterFd, F_SETFL, fcntl(port.masterFd, F_GETFL) | O_NONBLOCK);
+	unlink(port.linkName.c_str());
+	symlink(port.slaveName.c_str(), port.linkName.c_str());
+	return true;
+}
+
+void ReliefBusEmulator::threadedFunction() {
+	// each port is a separate wire with the full bandwidth. a port takes in what the wire
+	// carried since the last pass; an idle wire banks no more than a uart fifo's worth
+	float byteBudget[NUM_SERIAL_CONNECTIONS] = {0};
+	unsigned long long lastPassMicros = ofGetElapsedTimeMicros();
+	unsigned char buffer[4096];
+	
+	while (isThreadRunning()) {
+		ofSleepMillis(1);
+		unsigned long long now = ofGetElapsedTimeMicros();
+		float elapsedSeconds = (now - lastPassMicros) / 1000000.0;
+		lastPassMicros = now;
+		
+		for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+			emulatedPort &port = ports[i];
+			if (port.unpluggedUntilMicros != 0) {
+				lock();
+				if (port.masterFd >= 0) {
+					close(port.masterFd);
+					port.masterFd = -1;
+					unlink(port.linkName.c_str());
+					port.receivedLength = 0;
+					resetBoards(port);
+				} else if (now >= port.unpluggedUntilMicros) {
+					port.unpluggedUntilMicros = 0;
+					openPort(port);
+				}
+				unlock();
+			}
+			if (port.masterFd < 0) continue;
+			
+			lock();
+			movePins(port, elapsedSeconds);
+			sendReplies(port, elapsedSeconds);
+			unlock();
+			
+			byteBudget[i] += elapsedSeconds * bytesPerSecond;
+			int bytesToRead = min((int) byteBudget[i], (int) sizeof(buffer));
+			if (bytesToRead == 0) continue;
+			
+			// the bytes read now have waited about as long as the backlog takes to cross the wire
+			int bytesWaiting = 0;
+			ioctl(port.masterFd, FIONREAD, &bytesWaiting);
+			float lineDelayMillis = bytesWaiting * 1000.0 / bytesPerSecond;
+			
+			int bytesRead = read(port.masterFd, buffer, bytesToRead);
+			if (bytesRead <= 0) {
+				byteBudget[i] = min(byteBudget[i], (float) EMULATED_UART_FIFO_SIZE);
+				continue;
+			}
+			byteBudget[i] -= bytesRead;
+			
+			lock();
+			for (int j = 0; j < bytesRead; j++) {
+				receiveByte(port, buffer[j], lineDelayMillis);
+			}
+			unlock();
+		}
+		
+		lock();
+		if (now - rateWindowStartMicros >= 1000000) {
+			messagesPerSecond = rateWindowMessages * 1000000.0 / (now - rateWindowStartMicros);
+			rateWindowStartMicros = now;
+			rateWindowMessages = 0;
+		}
+		unlock();
+	}
+}
+
+// frame messages on their term id; a stray byte in front of one is skipped. 8-byte messages
+// may carry any value, but no byte inside a v2 frame is a term id, so one cuts the frame short
+void ReliefBusEmulator::receiveByte(emulatedPort &port, unsigned char byte, float lineDelayMillis) {
+	bool inFrame = port.receivedLength > 0 && port.received[0] == TERM_ID_FRAME;
+	if (inFrame && byte >= TERM_ID_HEIGHT) {
+		messagesDropped++;
+		port.receivedLength = 0;
+	}
+	if (port.receivedLength == 0 && (byte < TERM_ID_HEIGHT || byte > TERM_ID_FRAME)) {
+		messagesDropped++;
+		return;
+	}
+	port.received[port.receivedLength++] = byte;
+	
+	if (port.received[0] == TERM_ID_FRAME) {
+		int frameLength = getFrameLength(port.received, port.receivedLength);
+		if (frameLength > V2_MAX_FRAME_LENGTH || (frameLength == 0 && port.receivedLength == V2_MAX_FRAME_LENGTH)) {
+			messagesDropped++;
+			port.receivedLength = 0;
+			return;
+		}
+		if (frameLength == 0 || port.receivedLength < frameLength) return;
+	} else if (port.receivedLength < MSGS_SIZE) {
+		return;
+	}
+	int length = port.receivedLength;
+	port.receivedLength = 0;
+	
+	messagesReceived++;
+	rateWindowMessages++;
+	if (lineDelayMillis > lateMillis) messagesLate++;
+	if (port.received[0] == TERM_ID_FRAME) {
+		applyFrame(port, port.received, length);
+	} else {
+		applyMessage(port, port.received);
+	}
+}
+
+// length of a v2 frame, or 0 if not enough of it has arrived to tell
+int ReliefBusEmulator::getFrameLength(const unsigned char *frame, int receivedLength) {
+	int position = 1 + V2_BOARD_BITMAP_BYTES;
+	if (receivedLength < position) return 0;
+	int numBoards = 0;
+	for (int k = 1; k <= V2_BOARD_BITMAP_BYTES; k++) {
+		numBoards += __builtin_popcount(frame[k] & 0x7f);
+	}
+	for (int n = 0; n < numBoards; n++) {
+		if (receivedLength <= position) return 0;
+		int numPins = __builtin_popcount(frame[position] & ((1 << NUM_PINS_ARDUINO) - 1));
+		position += 1 + ((frame[position] & V2_FLAG_DELTAS) ? (numPins + 1) / 2 : numPins);
+	}
+	return position + 1;
+}
+
+void ReliefBusEmulator::applyMessage(emulatedPort &port, unsigned char *message) {
+	int termIndex = message[0] - TERM_ID_HEIGHT;
+	int boardId = message[1];
+	
+	// board 0 addresses every board on the port
+	int firstBoardId = boardId, lastBoardId = boardId;
+	if (boardId == 0) {
+		firstBoardId = port.firstBoardId;
+		lastBoardId = port.lastBoardId;
+	} else if (boardId < port.firstBoardId || boardId > port.lastBoardId) {
+		messagesDropped++;
+		return;
+	}
+	
+	for (int id = firstBoardId; id <= lastBoardId; id++) {
+		if (termIndex == 0) {
+			for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+				setPinHeight(id, j, message[2 + j]);
+			}
+		} else {
+			memcpy(boardValues[id - 1][termIndex], &message[2], NUM_PINS_ARDUINO);
+		}
+	}
+}
+
+void ReliefBusEmulator::applyFrame(emulatedPort &port, unsigned char *frame, int frameLength) {
+	unsigned char checksum = 0;
+	for (int k = 1; k < frameLength - 1; k++) {
+		checksum += frame[k];
+	}
+	if ((checksum & 0x7f) != frame[frameLength - 1]) {
+		messagesDropped++;
+		return;
+	}
+	
+	int position = 1 + V2_BOARD_BITMAP_BYTES;
+	for (int n = 0; n < V2_MAX_BOARDS_PER_FRAME; n++) {
+		if (!((frame[1 + n / 7] >> (n % 7)) & 1)) continue;
+		int boardId = port.firstBoardId + n;
+		bool validBoard = boardId <= port.lastBoardId;
+		if (!validBoard) messagesDropped++;
+		
+		unsigned char pins = frame[position++];
+		bool deltas = pins & V2_FLAG_DELTAS;
+		int numNibbles = 0;
+		for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+			if (!((pins >> j) & 1)) continue;
+			int height;
+			if (deltas) {
+				int nibble = (numNibbles++ % 2 == 0) ? frame[position] & 0x0f : frame[position++] >> 4;
+				height = (validBoard ? boardValues[boardId - 1][0][j] : 0) + nibble - V2_PIN_DELTA_MAX;
+			} else {
+				height = frame[position++];
+			}
+			if (validBoard) setPinHeight(boardId, j, height);
+		}
+		if (numNibbles % 2 == 1) position++;
+	}
+}
+
+void ReliefBusEmulator::setPinHeight(int boardId, int pin, unsigned char height) {
+	if (boardValues[boardId - 1][0][pin] != height) pinUpdates++;
+	boardValues[boardId - 1][0][pin] = height;
+	lastHeightMicros[boardId - 1] = ofGetElapsedTimeMicros();
+}
+
+void ReliefBusEmulator::movePins(emulatedPort &port, float elapsedSeconds) {
+	float step = pinSpeed * elapsedSeconds;
+	for (int id = port.firstBoardId; id <= port.lastBoardId; id++) {
+		for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+			if (boardValues[id - 1][TERM_ID_MAXSPEED - TERM_ID_HEIGHT][j] == 0) continue;
+			float &position = pinPositions[id - 1][j];
+			float target = boardValues[id - 1][0][j];
+			position = (target > position) ? min(target, position + step) : max(target, position - step);
+		}
+	}
+}
+
+// each board reports its positions every REPLY_INTERVAL_MILLIS, and its faults when they
+// change, as far as the wire back to the host allows
+void ReliefBusEmulator::sendReplies(emulatedPort &port, float elapsedSeconds) {
+	port.replyBudget = min(port.replyBudget + elapsedSeconds * bytesPerSecond, (float) EMULATED_UART_FIFO_SIZE);
+	unsigned long long now = ofGetElapsedTimeMicros();
+	int numBoards = port.lastBoardId - port.firstBoardId + 1;
+	for (int n = 0; n < numBoards && port.replyBudget >= MSGS_SIZE; n++) {
+		int id = port.replyCursor;
+		port.replyCursor = (id == port.lastBoardId) ? port.firstBoardId : id + 1;
+		
+		unsigned char reply[MSGS_SIZE];
+		reply[1] = id;
+		if (faultsChanged[id - 1]) {
+			reply[0] = TERM_ID_STATUS;
+			memcpy(&reply[2], pinFaults[id - 1], NUM_PINS_ARDUINO);
+			faultsChanged[id - 1] = false;
+		} else if (now - lastReplyMicros[id - 1] >= REPLY_INTERVAL_MILLIS * 1000) {
+			reply[0] = TERM_ID_POSITION;
+			for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+				reply[2 + j] = (unsigned char) (pinPositions[id - 1][j] + 0.5);
+			}
+			lastReplyMicros[id - 1] = now;
+		} else {
+			continue;
+		}
+		if (write(port.masterFd, reply, MSGS_SIZE) != MSGS_SIZE) break;
+		port.replyBudget -= MSGS_SIZE;
+	}
+}
+
+unsigned char ReliefBusEmulator::getPinPosition(int boardId, int pin) {
+	lock();
+	unsigned char position = (unsigned char) (pinPositions[boardId - 1][pin] + 0.5);
+	unlock();
+	return position;
+}
+
+void ReliefBusEmulator::setPinFaults(int boardId, int pin, unsigned char faults) {
+	lock();
+	pinFaults[boardId - 1][pin] = faults;
+	faultsChanged[boardId - 1] = true;
+	unlock();
+}
+
+unsigned char ReliefBusEmulator::getBoardValue(int boardId, unsigned char termId, int pin) {
+	lock();
+	unsigned char value = boardValues[boardId - 1][termId - TERM_ID_HEIGHT][pin];
+	unlock();
+	return value;
+}
+
+float ReliefBusEmulator::getUpdateAgeMillis(int boardId) {
+	lock();
+	unsigned long long lastUpdate = lastHeightMicros[boardId - 1];
+	unlock();
+	return (ofGetElapsedTimeMicros() - lastUpdate) / 1000.0;
+}
+
+reliefBusStats ReliefBusEmulator::getStats() {
+	reliefBusStats stats;
+	lock();
+	stats.messagesPerSecond = messagesPerSecond;
+	stats.messagesReceived = messagesReceived;
+	stats.messagesDropped = messagesDropped;
+	stats.messagesLate = messagesLate;
+	stats.pinUpdates = pinUpdates;
+	stats.poweredPins = 0;
+	for (int i = 0; i < NUM_ARDUINOS; i++) {
+		for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+			if (boardValues[i][TERM_ID_MAXSPEED - TERM_ID_HEIGHT][j] > 0) stats.poweredPins++;
+		}
+	}
+	unsigned long long oldestUpdate = lastHeightMicros[0];
+	for (int i = 1; i < NUM_ARDUINOS; i++) {
+		oldestUpdate = min(oldestUpdate, lastHeightMicros[i]);
+	}
+	unlock();
+	stats.maxUpdateAgeMillis = (ofGetElapsedTimeMicros() - oldestUpdate) / 1000.0;
+	return stats;
+}
+
+void ReliefBusEmulator::resetStats() {
+	lock();
+	unsigned long long now = ofGetElapsedTimeMicros();
+	for (int i = 0; i < NUM_ARDUINOS; i++) {
+		lastHeightMicros[i] = now;
+	}
+	messagesReceived = 0;
+	messagesDropped = 0;
+	messagesLate = 0;
+	pinUpdates = 0;
+	rateWindowStartMicros = now;
+	rateWindowMessages = 0;
+	messagesPerSecond = 0;
+	unlock();
+}
@@ -0,0 +1,101 @@
+/*
+ *  ReliefBusEmulator.h
+ *  Relief
+ *
+ *  Stands in for the table: opens a pseudo-terminal for each serial connection, decodes
+ *  the 8-byte board messages and v2 frames from it and keeps the pin state the boards
+ *  would have. pins with their motor on travel toward their targets at a fixed speed,
+ *  and each board reports its positions back every REPLY_INTERVAL_MILLIS.
+ *  Point the serial connections at getPortName() instead of the usb serial devices.
+ *  unplugPort() pulls a port's cable for a while, and its boards reset.
+ *
+ */
+
+#ifndef _RELIEF_BUS_EMULATOR
+#define _RELIEF_BUS_EMULATOR
+
+#include "ofMain.h"
+#include "ofThread.h"
+#include "Constants.h"
+#include "ReliefSerial.h"
+
+#define NUM_BOARD_TERM_IDS (TERM_ID_MAXSPEED - TERM_ID_HEIGHT + 1)
+#define EMULATED_UART_FIFO_SIZE 64 // bytes a board can take in at once after the line was idle
+#define REPLY_INTERVAL_MILLIS 50
+#define EMULATED_DEFAULT_MAX_SPEED 110 // boards start with their motors on
+
+
+struct reliefBusStats {
+	float messagesPerSecond;
+	unsigned long long messagesReceived; // 8-byte messages and v2 frames
+	unsigned long long messagesDropped;  // framing or checksum errors, unknown boards, boards on another port
+	unsigned long long messagesLate;    // messages that waited on the line longer than the late threshold
+	float maxUpdateAgeMillis;           // time since the stalest board last got new heights
+	unsigned long long pinUpdates;      // pin heights that changed
+	int poweredPins;                    // pins with their motor on: a max speed over 0
+};
+
+class ReliefBusEmulator: public ofThread {
+private:
+	struct emulatedPort {
+		int masterFd;
+		string slaveName;
+		string linkName; // stays the same when the port is plugged back in on a new pseudo-terminal
+		unsigned long long unpluggedUntilMicros; // 0 unless unplugged, or about to be
+		int firstBoardId;
+		int lastBoardId;
+		unsigned char received[V2_MAX_FRAME_LENGTH]; // message or frame being received
+		int receivedLength;
+		float replyBudget; // bytes the wire back to the host can take
+		int replyCursor;   // next board to reply, round-robin
+	};
+	
+	void threadedFunction();
+	bool openPort(emulatedPort &port);
+	void resetBoards(emulatedPort &port);
+	void receiveByte(emulatedPort &port, unsigned char byte, float lineDelayMillis);
+	void applyMessage(emulatedPort &port, unsigned char *message);
+	void applyFrame(emulatedPort &port, unsigned char *frame, int frameLength);
+	void setPinHeight(int boardId, int pin, unsigned char height);
+	int getFrameLength(const unsigned char *frame, int receivedLength);
+	void movePins(emulatedPort &port, float elapsedSeconds);
+	void sendReplies(emulatedPort &port, float elapsedSeconds);
+	
+	emulatedPort ports[NUM_SERIAL_CONNECTIONS];
+	float bytesPerSecond; // 10 bits per byte on the wire: start, 8 data, stop
+	float lateMillis;
+	
+	// simulated board state, guarded by the thread lock
+	unsigned char boardValues[NUM_ARDUINOS][NUM_BOARD_TERM_IDS][NUM_PINS_ARDUINO];
+	unsigned long long lastHeightMicros[NUM_ARDUINOS];
+	float pinPositions[NUM_ARDUINOS][NUM_PINS_ARDUINO];
+	unsigned char pinFaults[NUM_ARDUINOS][NUM_PINS_ARDUINO];
+	bool faultsChanged[NUM_ARDUINOS];
+	unsigned long long lastReplyMicros[NUM_ARDUINOS];
+	float pinSpeed; // height units per second
+	unsigned long long messagesReceived;
+	unsigned long long messagesDropped;
+	unsigned long long messagesLate;
+	unsigned long long pinUpdates;
+	unsigned long long rateWindowStartMicros;
+	unsigned long long rateWindowMessages;
+	float messagesPerSecond;
+	
+public:
+	ReliefBusEmulator(int baudRate);
+	~ReliefBusEmulator();
+	
+	string getPortName(int serialConnection) { return ports[serialConnection].linkName; }
+	void unplugPort(int serialConnection, int millis);
+	unsigned char getPinHeight(int boardId, int pin) { return getBoardValue(boardId, TERM_ID_HEIGHT, pin); }
+	unsigned char getBoardValue(int boardId, unsigned char termId, int pin);
+	unsigned char getPinPosition(int boardId, int pin);
+	void setPinSpeed(float unitsPerSecond) { pinSpeed = unitsPerSecond; }
+	void setPinFaults(int boardId, int pin, unsigned char faults);
+	float getUpdateAgeMillis(int boardId);
+	void setLateMillis(float millis) { lateMillis = millis; }
+	reliefBusStats getStats();
+	void resetStats();
+};
+
+#endif
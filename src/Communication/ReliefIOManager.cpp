@@ -8,252 +8,1049 @@
  */
 
 #include "ReliefIOManager.h"
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 ReliefIOManager::ReliefIOManager() {
-	//loadSettings(RELIEFSETTINGS);
-	
-    mSerialConnections[0] = new ReliefSerial(SERIAL_PORT_0, SERIAL_BAUD_RATE);
-    mSerialConnections[1] = new ReliefSerial(SERIAL_PORT_1, SERIAL_BAUD_RATE);
-    mSerialConnections[2] = new ReliefSerial(SERIAL_PORT_2, SERIAL_BAUD_RATE);
-    mSerialConnections[3] = new ReliefSerial(SERIAL_PORT_3, SERIAL_BAUD_RATE);
-    mSerialConnections[4] = new ReliefSerial(SERIAL_PORT_4, SERIAL_BAUD_RATE);
+    // the connections open their ports in the background, all at once
+    mBusEmulator = NULL;
+    string portNames[NUM_SERIAL_CONNECTIONS] = {SERIAL_PORT_0, SERIAL_PORT_1, SERIAL_PORT_2, SERIAL_PORT_3, SERIAL_PORT_4};
+    if (EMULATE_RELIEF_BUS) {
+        mBusEmulator = new ReliefBusEmulator(SERIAL_BAUD_RATE);
+        for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+            portNames[i] = mBusEmulator->getPortName(i);
+        }
+    } else {
+        loadSerialPortSettings(SERIAL_PORT_SETTINGS, portNames);
+    }
+    for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+        mSerialConnections[i] = new ReliefSerial(portNames[i], SERIAL_BAUD_RATE);
+        portConnections[i] = 0;
+    }
+    for (int i = 0; i < NUM_BOARD_PARAMETERS; i++) {
+        boardParameters[i] = -1;
+    }
     
-    loadSettings();
+    // a height that is still waiting when a newer one arrives for the same board is never
+    // worth sending, so by default only the newest is kept
+    setQueueMode(QUEUE_MODE_MAILBOX);
+    for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+        portProtocols[i] = PROTOCOL_V1_MESSAGES;
+    }
+    
+    for (int i = 0; i < 3; i++) {
+        heightFrames[i].publishedMicros = 0;
+    }
+    renderFrame = 0;
+    outputFrame = 1;
+    pendingFrame = 2;
+    outputTickMicros = 0;
+    trajectoryMode = TRAJECTORY_OFF;
+    trajectoryRestart = false;
+    resetOutputStats();
+    
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        boardPorts[i] = 0;
+        boardInverts[i] = 0;
+        for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+            commandedHeights[i][j] = 0;
+        }
+    }
+    numIdlePins = 0;
+    
+    memset(reliefBoardValues, 0, sizeof(reliefBoardValues));
+    for (int p = 0; p < RELIEF_SIZE_X * RELIEF_SIZE_Y; p++) {
+        pinRoutes[p].board = NO_BOARD;
+    }
+    boardMapLoaded = false;
+    if (!loadSettings(RELIEFSETTINGS)) {
+        ofLog(OF_LOG_ERROR, "ReliefIOManager: no valid board map, the pins will not be driven until one loads");
+    }
+}
+
+// load the adapter on each connection from xml, keeping the defaults for any that are missing
+void ReliefIOManager::loadSerialPortSettings(string fileName, string portNames[NUM_SERIAL_CONNECTIONS]) {
+    ofxXmlSettings xml;
+    if (!xml.loadFile(fileName)) {
+        return;
+    }
+    int numPorts = min(NUM_SERIAL_CONNECTIONS, xml.getNumTags("PORT"));
+    for (int i = 0; i < numPorts; i++) {
+        portNames[i] = xml.getValue("PORT:SERIAL", portNames[i], i);
+    }
+}
+
+void ReliefIOManager::setQueueMode(ReliefQueueMode mode) {
+    for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+        mSerialConnections[i]->setQueueMode(mode);
+    }
 }
 
 ReliefIOManager::~ReliefIOManager() {
+    stopOutputThread();
     for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
         delete mSerialConnections[i];
     }
+    delete mBusEmulator;
 }
 
-void ReliefIOManager::sendPinHeightToRelief(unsigned char pPinHeightToRelief [RELIEF_SIZE_X][RELIEF_SIZE_Y]) {
+void ReliefIOManager::sendPinHeightToRelief(const unsigned char *heightMap, int numChannels) {
+    if (!isThreadRunning()) {
+        lock();
+        writeHeightMap(heightMap, numChannels);
+        unlock();
+        return;
+    }
     
-    // make sure the values are clipped at their extremes
-    for (int i = 0; i < RELIEF_SIZE_X; i ++) {
-		for (int j = 0; j < RELIEF_SIZE_Y; j ++) {
-			if (pPinHeightToRelief[i][j] <= 15) {
-				pPinHeightToRelief[i][j] = (unsigned char) 15;
-			}
-			else if (pPinHeightToRelief[i][j] >= 240) {
-				pPinHeightToRelief[i][j] = (unsigned char) 240;
-			}
-		}
+    // keep only the heights, and hand them over. a frame no tick took yet is replaced
+    reliefHeightFrame &frame = heightFrames[renderFrame];
+    for (int i = 0; i < RELIEF_SIZE_X * RELIEF_SIZE_Y; i++) {
+        frame.heights[i] = heightMap[i * numChannels];
+    }
+    frame.publishedMicros = ofGetElapsedTimeMicros();
+    int previous = pendingFrame.exchange(renderFrame | OUTPUT_FRAME_FRESH);
+    if (previous & OUTPUT_FRAME_FRESH) framesReplaced++;
+    renderFrame = previous & ~OUTPUT_FRAME_FRESH;
+}
+
+void ReliefIOManager::startOutputThread(float ticksPerSecond) {
+    if (ticksPerSecond <= 0) {
+        stopOutputThread();
+        return;
+    }
+    outputTickMicros = 1000000 / ticksPerSecond;
+    if (!isThreadRunning()) {
+        startThread(true, false);   // blocking, verbose
+    }
+}
+
+void ReliefIOManager::stopOutputThread() {
+    if (isThreadRunning()) {
+        stopThread();
+        waitForThread(false);
+    }
+}
+
+// every tick sends the newest height map, or the last one again if none came in: the
+// scheduler still has boards to catch up on, and idle pins to time out
+void ReliefIOManager::threadedFunction() {
+    unsigned long long nextTick = ofGetElapsedTimeMicros();
+    while (isThreadRunning()) {
+        unsigned long long now = ofGetElapsedTimeMicros();
+        if (now < nextTick) {
+            usleep(nextTick - now);
+            now = ofGetElapsedTimeMicros();
+        }
+        
+        if (pendingFrame.load() & OUTPUT_FRAME_FRESH) {
+            // the frame we had becomes where trajectories start from
+            const reliefHeightFrame &previous = heightFrames[outputFrame];
+            memcpy(trajectoryFrom, previous.heights, sizeof(trajectoryFrom));
+            trajectoryFromMicros = previous.publishedMicros;
+            outputFrame = pendingFrame.exchange(outputFrame) & ~OUTPUT_FRAME_FRESH;
+        }
+        const reliefHeightFrame &frame = heightFrames[outputFrame];
+        if (frame.publishedMicros != 0) {
+            const unsigned char *heights = frame.heights;
+            if (trajectoryRestart.exchange(false)) {
+                lastShapedMicros = 0;
+            }
+            if (trajectoryMode != TRAJECTORY_OFF) {
+                shapeTrajectory(frame, now);
+                heights = shapedFrame;
+            }
+            lock();
+            writeHeightMap(heights, 1);
+            unlock();
+            recordTick(now > nextTick ? now - nextTick : 0, now - frame.publishedMicros);
+        }
+        
+        // after a stall, drop the ticks that are a whole period late instead of catching up
+        // on them in a burst; the scheduler's budget already covers the time they spanned
+        int tickMicros = outputTickMicros;
+        nextTick += tickMicros;
+        now = ofGetElapsedTimeMicros();
+        while (now >= nextTick + tickMicros) {
+            nextTick += tickMicros;
+            outputTicksSkipped++;
+        }
+    }
+}
+
+void ReliefIOManager::shapeTrajectory(const reliefHeightFrame &frame, unsigned long long now) {
+    int numPins = RELIEF_SIZE_X * RELIEF_SIZE_Y;
+    if (lastShapedMicros == 0) {
+        for (int i = 0; i < numPins; i++) {
+            shapedHeights[i] = frame.heights[i];
+            shapedVelocities[i] = 0;
+            shapedFrame[i] = frame.heights[i];
+        }
+        lastShapedMicros = now;
+        return;
     }
+    float tickSeconds = min((now - lastShapedMicros) / 1000000.0, 0.1);
+    lastShapedMicros = now;
     
+    // where along the last frame interval this tick falls. a frame that came in a long while
+    // after the one before is followed as if the render had kept its pace
+    float frameSeconds = 0;
+    float since = 0;
+    if (trajectoryFromMicros != 0 && frame.publishedMicros > trajectoryFromMicros) {
+        frameSeconds = min((frame.publishedMicros - trajectoryFromMicros) / 1000000.0, 0.1);
+        since = min((now - frame.publishedMicros) / 1000000.0, (double) frameSeconds);
+    }
+    float along = frameSeconds > 0 ? since / frameSeconds : 1;
+    if (trajectoryMode == TRAJECTORY_EXTRAPOLATE) along += 1;
     
-    for (unsigned char i = 0; i < NUM_ARDUINOS; i++) { // iterate through each board
+    for (int i = 0; i < numPins; i++) {
+        float target = trajectoryFrom[i] + (frame.heights[i] - trajectoryFrom[i]) * along;
+        float error = target - shapedHeights[i];
+        
+        // the speed that reaches the target this tick, capped by the slew limit and by the
+        // speed the pin can still brake from in time
+        float speed = fabsf(error) / tickSeconds;
+        if (pinSlewLimit > 0) speed = min(speed, pinSlewLimit);
+        if (pinAccelerationLimit > 0) speed = min(speed, sqrtf(2 * pinAccelerationLimit * fabsf(error)));
+        float velocity = error < 0 ? -speed : speed;
+        if (pinAccelerationLimit > 0) {
+            float maxChange = pinAccelerationLimit * tickSeconds;
+            velocity = ofClamp(velocity, shapedVelocities[i] - maxChange, shapedVelocities[i] + maxChange);
+        }
         
-        bool frameChanged = false;
+        shapedVelocities[i] = velocity;
+        shapedHeights[i] = ofClamp(shapedHeights[i] + velocity * tickSeconds, 0, 255);
+        shapedFrame[i] = (unsigned char) (shapedHeights[i] + 0.5);
+    }
+}
+
+void ReliefIOManager::recordTick(int jitterMicros, int frameAgeMicros) {
+    averageJitterMicros = (averageJitterMicros * 15 + jitterMicros) / 16;
+    if (jitterMicros > maxJitterMicros) maxJitterMicros = jitterMicros;
+    averageFrameAgeMicros = (averageFrameAgeMicros * 15 + frameAgeMicros) / 16;
+    if (frameAgeMicros > maxFrameAgeMicros) maxFrameAgeMicros = frameAgeMicros;
+    outputTicks++;
+}
+
+reliefOutputStats ReliefIOManager::getOutputStats() {
+    reliefOutputStats stats;
+    stats.ticksPerSecond = isThreadRunning() ? 1000000.0 / outputTickMicros : 0;
+    stats.ticks = outputTicks;
+    stats.ticksSkipped = outputTicksSkipped;
+    stats.framesReplaced = framesReplaced;
+    stats.averageJitterMillis = averageJitterMicros / 1000.0;
+    stats.maxJitterMillis = maxJitterMicros / 1000.0;
+    stats.averageFrameAgeMillis = averageFrameAgeMicros / 1000.0;
+    stats.maxFrameAgeMillis = maxFrameAgeMicros / 1000.0;
+    return stats;
+}
+
+void ReliefIOManager::resetOutputStats() {
+    outputTicks = 0;
+    outputTicksSkipped = 0;
+    framesReplaced = 0;
+    averageJitterMicros = 0;
+    maxJitterMicros = 0;
+    averageFrameAgeMicros = 0;
+    maxFrameAgeMicros = 0;
+}
+
+// convert, schedule and queue one height map. callers hold lock()
+void ReliefIOManager::writeHeightMap(const unsigned char *heightMap, int numChannels) {
+    // without a board map there is no telling which pin shows which pixel
+    if (!boardMapLoaded) return;
+    checkPortConnections();
+    if (numChannels != wireGatherChannels) {
+        buildWireGatherTable(numChannels);
+    }
+
+    // gather, clamp and invert the frame into wire payloads and flag the boards whose
+    // payload differs from what they were last sent
+    convertFrame(heightMap);
+
+    unsigned long long now = ofGetElapsedTimeMicros();
+    for (int i = 0; i < NUM_ARDUINOS; i++) { // iterate through each board
+        const unsigned char *payload = getWirePayload(i);
+        const unsigned char *sent = &sentWirePayloads[i * NUM_PINS_ARDUINO];
+        boardErrors[i] = 0;
+        boardPinMasks[i] = 0;
+        bool powerChanged = false;
+        if (!boardChanged(i)) {
+            // already holds this frame's heights: no error, only quiet time to count
+            for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+                powerChanged |= updatePinActivity(i, j, 0, now);
+            }
+            if (powerChanged) sendBoardPower(i);
+            framesSinceSent[i]++;
+            continue;
+        }
         for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-            
-            // copy the height values from the current frame values to the arduino pins
-            reliefBoardValues[i].currentFramePinHeight[j] = pPinHeightToRelief[reliefBoardValues[i].pinCoordinates[j][0]][reliefBoardValues[i].pinCoordinates[j][1]];
-            
-            // add the value to the moving average of the last 100 frames
-            reliefBoardValues[i].rollingAverageHeight[j] = (0.01 * (float)reliefBoardValues[i].currentFramePinHeight[j]) + (1.0 - 0.01) * (float)reliefBoardValues[i].rollingAverageHeight[j];
-            
-            // invert the values if needed (this affects boards mounted upside down)
-            if (reliefBoardValues[i].invertHeight) reliefBoardValues[i].currentFramePinHeight[j] = 255 - reliefBoardValues[i].currentFramePinHeight[j];
-            
-            // compare the difference between the frames, copy and set a flag if it's different
-            if(abs(reliefBoardValues[i].currentFramePinHeight[j] - reliefBoardValues[i].lastFramePinHeight[j]) > 0) {
-                reliefBoardValues[i].lastFramePinHeight[j] = reliefBoardValues[i].currentFramePinHeight[j];
-                frameChanged = true;
+            // inversion doesn't change the size of an error, so compare wire bytes
+            int error = abs(payload[j] - sent[j]);
+            if (error <= pinDeadband) error = 0;
+            if (error > 0) {
+                boardErrors[i] += error;
+                boardPinMasks[i] |= 1 << j;
             }
+            powerChanged |= updatePinActivity(i, j, error, now);
         }
-        
-        // if the frame changes, update the Arduino
-        if (frameChanged) {
-            // activate board
-            /*if(reliefBoardValues[i].isBoardIdle()) {
-                unsigned char value[NUM_PINS_ARDUINO];
-                for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-                    value[j] = (reliefBoardValues[i].rollingAverageHeight[j] > 1) ? 200/2 : 0;
-                    reliefBoardValues[i].pinIsIdle[i] = (reliefBoardValues[i].rollingAverageHeight[j] > 1) ? true : false;
+        if (powerChanged) sendBoardPower(i);
+        framesSinceSent[i]++;
+    }
+
+    scheduleBoardUpdates();
+    publishIdlePins();
+}
+
+void ReliefIOManager::scheduleBoardUpdates() {
+    // refill each port's budget for the time since the last frame. an idle port can save up
+    // at most one message per board, enough to refresh all of them at once
+    unsigned long long now = ofGetElapsedTimeMicros();
+    float frameSeconds = lastFrameMicros ? min((now - lastFrameMicros) / 1000000.0, 0.1) : 1 / 60.0;
+    lastFrameMicros = now;
+
+    int portBoards[NUM_SERIAL_CONNECTIONS][NUM_ARDUINOS];
+    int numPortBoards[NUM_SERIAL_CONNECTIONS] = {0};
+    int numBoardsOnPort[NUM_SERIAL_CONNECTIONS] = {0};
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        int port = reliefBoardValues[i].serialConnection;
+        numBoardsOnPort[port]++;
+        // boards with every motor off hold still, so they can do without keyframes
+        bool keyframeDue = portProtocols[port] == PROTOCOL_V2_FRAMES && framesSinceKeyframe[i] >= V2_KEYFRAME_FRAMES &&
+                !reliefBoardValues[i].isBoardIdle();
+        if (boardErrors[i] > 0 || keyframeDue) {
+            portBoards[port][numPortBoards[port]++] = i;
+        }
+    }
+
+    for (int port = 0; port < NUM_SERIAL_CONNECTIONS; port++) {
+        // a port that is down would only drop what we send; its boards keep their errors
+        // until it is back
+        if (!mSerialConnections[port]->isPortUp()) {
+            portByteBudget[port] = 0;
+            continue;
+        }
+        portByteBudget[port] = min(portByteBudget[port] + (float) (frameSeconds * PORT_BYTES_PER_SECOND), (float) (numBoardsOnPort[port] * MSGS_SIZE));
+        int *boards = portBoards[port];
+        int numBoards = numPortBoards[port];
+        bool framed = portProtocols[port] == PROTOCOL_V2_FRAMES;
+
+        int bytesNeeded = (framed && numBoards > 0) ? V2_FRAME_OVERHEAD : 0;
+        for (int n = 0; n < numBoards; n++) {
+            int i = boards[n];
+            boardRecordLengths[i] = framed ? encodeBoardRecord(i, boardRecords[i]) : MSGS_SIZE;
+            bytesNeeded += boardRecordLengths[i];
+        }
+
+        // over budget: move the boards with the most error, plus an allowance for the frames
+        // they have waited, to the front. nothing waits forever, as age outgrows any error
+        if (bytesNeeded > portByteBudget[port]) {
+            int scores[NUM_ARDUINOS];
+            for (int n = 0; n < numBoards; n++) {
+                int i = boards[n];
+                int score = boardErrors[i] + errorPerFrame * framesSinceSent[i];
+                int m = n;
+                for (; m > 0 && scores[m - 1] < score; m--) {
+                    scores[m] = scores[m - 1];
+                    boards[m] = boards[m - 1];
                 }
-                
-                
-                //sendValuesToBoard(TERM_ID_MAXSPEED, i + 1, value, reliefBoardValues[i].serialConnection);
-            }*/
-            
-            /*unsigned char messageContents[8];
-            messageContents[0] = TERM_ID_HEIGHT;
-            messageContents[1] = i+1;
-            for (int j = 0; j < 6; j++) {
-                messageContents[j + 2] = reliefBoardValues[i].currentFramePinHeight[j];
+                scores[m] = score;
+                boards[m] = i;
             }
-            mSerialConnections[reliefBoardValues[i].serialConnection]->writeMessage(messageContents);*/
-            
-            sendValuesToBoard(TERM_ID_HEIGHT, i + 1, reliefBoardValues[i].currentFramePinHeight, reliefBoardValues[i].serialConnection);
-            
         }
-        
-        //quick test
-        /*unsigned char value[NUM_PINS_ARDUINO];
+
+        // take boards in that order while they fit
+        bool boardSelected[NUM_ARDUINOS] = {false};
+        int bytesUsed = framed ? V2_FRAME_OVERHEAD : 0;
+        int numSelected = 0;
+        for (int n = 0; n < numBoards; n++) {
+            int i = boards[n];
+            if (bytesUsed + boardRecordLengths[i] > portByteBudget[port]) continue;
+            bytesUsed += boardRecordLengths[i];
+            boardSelected[i] = true;
+            numSelected++;
+
+            // framed boards are recorded as sent by sendFrames, once their frame is queued
+            if (framed) continue;
+            unsigned char *payload = &wirePayloads[i * NUM_PINS_ARDUINO];
+            if (queueValuesToBoard(TERM_ID_HEIGHT, i + 1, payload, port)) {
+                memcpy(&sentWirePayloads[i * NUM_PINS_ARDUINO], payload, NUM_PINS_ARDUINO);
+                publishCommandedHeights(i);
+                framesSinceSent[i] = 0;
+            }
+            // otherwise the board keeps its error and competes again next frame
+        }
+
+        if (framed) {
+            // splitting frames can cost more than estimated; the next frame's budget pays for it
+            bytesUsed = numSelected > 0 ? sendFrames(port, boardSelected) : 0;
+        }
+        portByteBudget[port] -= bytesUsed;
+    }
+
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        if (framesSinceKeyframe[i] < V2_KEYFRAME_FRAMES) framesSinceKeyframe[i]++;
+    }
+}
+
+// encode one board's v2 record: its changed pins, as deltas if they are all small enough,
+// or all pins as absolute heights when a keyframe is due. returns the record length
+int ReliefIOManager::encodeBoardRecord(int board, unsigned char *record) {
+    const unsigned char *payload = &wirePayloads[board * NUM_PINS_ARDUINO];
+    const unsigned char *sent = &sentWirePayloads[board * NUM_PINS_ARDUINO];
+
+    unsigned char mask = boardPinMasks[board];
+    bool deltas = true;
+    if (framesSinceKeyframe[board] >= V2_KEYFRAME_FRAMES) {
+        mask = (1 << NUM_PINS_ARDUINO) - 1;
+        deltas = false;
+    }
+    for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+        if (((mask >> j) & 1) && abs(payload[j] - sent[j]) > V2_PIN_DELTA_MAX) deltas = false;
+    }
+
+    int length = 1;
+    record[0] = mask | (deltas ? V2_FLAG_DELTAS : 0);
+    int numNibbles = 0;
+    for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+        if (!((mask >> j) & 1)) continue;
+        if (!deltas) {
+            record[length++] = payload[j];
+        } else if (numNibbles++ % 2 == 0) {
+            // a zero delta fills the high nibble until the next pin replaces it
+            record[length++] = (payload[j] - sent[j] + V2_PIN_DELTA_MAX) | (V2_PIN_DELTA_MAX << 4);
+        } else {
+            record[length - 1] = (record[length - 1] & 0x0f) | ((payload[j] - sent[j] + V2_PIN_DELTA_MAX) << 4);
+        }
+    }
+    return length;
+}
+
+// a board's record is on its way: what the board will hold is now what it was sent
+void ReliefIOManager::commitBoardRecord(int board) {
+    const unsigned char *payload = &wirePayloads[board * NUM_PINS_ARDUINO];
+    unsigned char *sent = &sentWirePayloads[board * NUM_PINS_ARDUINO];
+    unsigned char mask = boardRecords[board][0];
+    for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+        if ((mask >> j) & 1) sent[j] = payload[j];
+    }
+    if ((mask & ((1 << NUM_PINS_ARDUINO) - 1)) == (1 << NUM_PINS_ARDUINO) - 1 && !(mask & V2_FLAG_DELTAS)) {
+        framesSinceKeyframe[board] = 0;
+    }
+    framesSinceSent[board] = 0;
+    publishCommandedHeights(board);
+}
+
+// send the selected boards' records in as few frames as stay under V2_SPLIT_FRAME_LENGTH.
+// boards are only recorded as sent once their frame is queued; the boards of a frame the
+// connection refuses keep their error and are tried again next frame. returns the number of
+// bytes sent
+int ReliefIOManager::sendFrames(int port, const bool *boardSelected) {
+    unsigned char frame[V2_MAX_FRAME_LENGTH];
+    int frameBoards[V2_MAX_BOARDS_PER_FRAME];
+    int numFrameBoards = 0;
+    int length = 0;
+    int bytesSent = 0;
+
+    int firstBoard = portFirstBoards[port];
+    for (int n = 0; n <= V2_MAX_BOARDS_PER_FRAME; n++) {
+        int i = firstBoard + n;
+        bool lastBoard = n == V2_MAX_BOARDS_PER_FRAME || i == NUM_ARDUINOS;
+        bool addBoard = !lastBoard && boardSelected[i];
+
+        // close the frame with its checksum when the port's boards are done or the next
+        // record would make it too long
+        if (length > 0 && (lastBoard || (addBoard && length + boardRecordLengths[i] + 1 > V2_SPLIT_FRAME_LENGTH))) {
+            unsigned char checksum = 0;
+            for (int k = 1; k < length; k++) {
+                checksum += frame[k];
+            }
+            frame[length++] = checksum & 0x7f;
+            if (mSerialConnections[port]->writeFrame(frame, length)) {
+                for (int k = 0; k < numFrameBoards; k++) {
+                    commitBoardRecord(frameBoards[k]);
+                }
+                bytesSent += length;
+            }
+            length = 0;
+            numFrameBoards = 0;
+        }
+        if (lastBoard) break;
+        if (!addBoard) continue;
+
+        if (length == 0) {
+            frame[0] = TERM_ID_FRAME;
+            memset(&frame[1], 0, V2_BOARD_BITMAP_BYTES);
+            length = 1 + V2_BOARD_BITMAP_BYTES;
+        }
+        frame[1 + n / 7] |= 1 << (n % 7);
+        frameBoards[numFrameBoards++] = i;
+        memcpy(&frame[length], boardRecords[i], boardRecordLengths[i]);
+        length += boardRecordLengths[i];
+    }
+    return bytesSent;
+}
+
+// positions come back in the board's own direction, like the heights it was sent
+int ReliefIOManager::getPinPosition(int board, int pin) {
+    unsigned char position = mSerialConnections[boardPorts[board]]->getPinPosition(board + 1, pin);
+    return position ^ boardInverts[board];
+}
+
+int ReliefIOManager::getPinError(int board, int pin) {
+    return getPinPosition(board, pin) - commandedHeights[board][pin];
+}
+
+// callers hold lock()
+void ReliefIOManager::publishCommandedHeights(int board) {
+    const unsigned char *sent = &sentWirePayloads[board * NUM_PINS_ARDUINO];
+    unsigned char invert = boardInverts[board];
+    for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+        commandedHeights[board][j].store(sent[j] ^ invert, std::memory_order_relaxed);
+    }
+}
+
+// callers hold lock()
+void ReliefIOManager::publishIdlePins() {
+    int numIdle = 0;
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
         for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-            value[j] = (reliefBoardValues[i].rollingAverageHeight[j] > 1) ? 100 : 0;
-            reliefBoardValues[i].pinIsIdle[i] = (reliefBoardValues[i].rollingAverageHeight[j] > 1) ? true : false;
+            if (reliefBoardValues[i].pinIsIdle[j]) numIdle++;
         }
-        sendValuesToBoard(TERM_ID_MAXSPEED, i + 1, value, reliefBoardValues[i].serialConnection);*/
-        
-        /*else if (!reliefBoardValues[i].isBoardIdle()) {
-            
-            // deactivate if the moving average is below a certain threshold
-            unsigned char value[NUM_PINS_ARDUINO];
-            for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-                value[j] = (reliefBoardValues[i].rollingAverageHeight[j] > 1) ? 200/2 : 0;
-                reliefBoardValues[i].pinIsIdle[i] = (value[j] == 0) ? true : false;
+    }
+    numIdlePins = numIdle;
+}
+
+// track how busy a pin is and decide whether its motor should be on. returns true if that
+// changed. a pin asked to move far stays active for a while after, as it may still be travelling
+bool ReliefIOManager::updatePinActivity(int board, int pin, int error, unsigned long long now) {
+    ReliefBoard &reliefBoard = reliefBoardValues[board];
+    int activity = reliefBoard.pinActivity[pin];
+    activity += ((error << 8) - activity) >> 4; // decays to exactly 0: the shift rounds down
+    reliefBoard.pinActivity[pin] = activity;
+
+    if (error > 0) {
+        reliefBoard.pinQuietSinceMicros[pin] = now;
+        if (reliefBoard.pinIsIdle[pin]) {
+            reliefBoard.pinIsIdle[pin] = false;
+            return true;
+        }
+        return false;
+    }
+
+    if (activity >= PIN_ACTIVITY_QUIET) {
+        reliefBoard.pinQuietSinceMicros[pin] = now;
+    } else if (!reliefBoard.pinIsIdle[pin] && idleTimeoutMillis > 0 && activeMaxSpeed > 0 &&
+            now - reliefBoard.pinQuietSinceMicros[pin] >= idleTimeoutMillis * 1000ULL) {
+        reliefBoard.pinIsIdle[pin] = true;
+        return true;
+    }
+    return false;
+}
+
+// send a board's per-pin max speeds. this goes out ahead of the heights scheduled this frame
+// and comes out of the same budget
+void ReliefIOManager::sendBoardPower(int board) {
+    unsigned char maxSpeeds[NUM_PINS_ARDUINO];
+    for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+        maxSpeeds[j] = reliefBoardValues[board].pinIsIdle[j] ? 0 : activeMaxSpeed;
+    }
+    int port = reliefBoardValues[board].serialConnection;
+    queueValuesToBoard(TERM_ID_MAXSPEED, board + 1, maxSpeeds, port);
+    portByteBudget[port] -= MSGS_SIZE;
+}
+
+void ReliefIOManager::setPortProtocol(int serialConnection, ReliefProtocol protocol) {
+    lock();
+    portProtocols[serialConnection] = protocol;
+    // start the port's boards from known heights
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        if (reliefBoardValues[i].serialConnection == serialConnection) {
+            framesSinceKeyframe[i] = V2_KEYFRAME_FRAMES;
+        }
+    }
+    unlock();
+}
+
+// precompute where each wire byte comes from in the rendered height map, by inverting
+// pinRoutes: the send loop then reads the height map in whatever order the boards want it
+// and writes the wire payloads straight through
+void ReliefIOManager::buildWireGatherTable(int numChannels) {
+    // padding bytes gather the first pixel and are never sent
+    for (int k = 0; k < NUM_WIRE_PINS_PADDED; k++) {
+        wireGatherTable[k] = 0;
+        wireInvertMask[k] = 0;
+    }
+    for (int p = 0; p < RELIEF_SIZE_X * RELIEF_SIZE_Y; p++) {
+        const reliefPinRoute &route = pinRoutes[p];
+        if (route.board == NO_BOARD) continue;
+        int k = route.board * NUM_PINS_ARDUINO + route.slot;
+        wireGatherTable[k] = p * numChannels;
+        wireInvertMask[k] = route.invert;
+    }
+    wireGatherChannels = numChannels;
+}
+
+void ReliefIOManager::convertFrame(const unsigned char *heightMap) {
+    // which wire bytes differ from what their board was last sent, one bit each
+    uint64_t changedPins[NUM_WIRE_PINS_PADDED / 64 + 1];
+    memset(changedPins, 0, sizeof(changedPins));
+
+    for (int k = 0; k < NUM_WIRE_PINS_PADDED; k += 16) {
+        unsigned char *payload = &wirePayloads[k];
+        for (int n = 0; n < 16; n++) {
+            payload[n] = heightMap[wireGatherTable[k + n]];
+        }
+
+        // clamp to the pins' travel, then invert heights for boards mounted upside down
+        // (255 - v is v ^ 0xff)
+        unsigned int changed = 0;
+#if defined(__SSE2__)
+        __m128i values = _mm_loadu_si128((const __m128i *) payload);
+        values = _mm_max_epu8(values, _mm_set1_epi8((char) PIN_HEIGHT_MIN));
+        values = _mm_min_epu8(values, _mm_set1_epi8((char) PIN_HEIGHT_MAX));
+        values = _mm_xor_si128(values, _mm_loadu_si128((const __m128i *) &wireInvertMask[k]));
+        _mm_storeu_si128((__m128i *) payload, values);
+        __m128i sent = _mm_loadu_si128((const __m128i *) &sentWirePayloads[k]);
+        changed = ~_mm_movemask_epi8(_mm_cmpeq_epi8(values, sent)) & 0xffff;
+#else
+        for (int n = 0; n < 16; n++) {
+            unsigned char value = min(max(payload[n], (unsigned char) PIN_HEIGHT_MIN), (unsigned char) PIN_HEIGHT_MAX);
+            payload[n] = value ^ wireInvertMask[k + n];
+            if (payload[n] != sentWirePayloads[k + n]) {
+                changed |= 1 << n;
             }
-            //sendValuesToBoard(TERM_ID_MAXSPEED, i + 1, value, reliefBoardValues[i].serialConnection);
-        }*/
+        }
+#endif
+        changedPins[k / 64] |= (uint64_t) changed << (k % 64);
+    }
+
+    // a board changed if any of its pins did
+    memset(changedBoardMask, 0, sizeof(changedBoardMask));
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        int bit = i * NUM_PINS_ARDUINO;
+        uint64_t pins = changedPins[bit / 64] >> (bit % 64);
+        if (bit % 64 > 64 - NUM_PINS_ARDUINO) {
+            pins |= changedPins[bit / 64 + 1] << (64 - bit % 64);
+        }
+        if (pins & ((1 << NUM_PINS_ARDUINO) - 1)) {
+            changedBoardMask[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
     }
 }
 
 
 
 void ReliefIOManager::sendValuesToBoard(unsigned char termId, unsigned char boardId, unsigned char value[NUM_PINS_ARDUINO], int serialConnection) {
+    lock();
+    queueValuesToBoard(termId, boardId, value, serialConnection);
+    unlock();
+}
+
+// returns false if the connection could not queue the message
+bool ReliefIOManager::queueValuesToBoard(unsigned char termId, unsigned char boardId, const unsigned char value[NUM_PINS_ARDUINO], int serialConnection) {
     unsigned char messageContents[8];
     messageContents[0] = termId;
     messageContents[1] = boardId;
     for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
         messageContents[j + 2] = value[j];
     }
-    mSerialConnections[serialConnection]->writeMessage(messageContents);
+    return mSerialConnections[serialConnection]->writeMessage(messageContents);
 }
 
 void ReliefIOManager::sendValueToAllBoards(unsigned char termId, unsigned char value) {
+    lock();
+    recordBoardParameter(termId, value);
+    for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i ++) {
+        queueValueToPort(termId, value, i);
+    }	
+    unlock();
+}
+
+// keep a value sent to all boards, for ports that reopen. callers hold lock()
+void ReliefIOManager::recordBoardParameter(unsigned char termId, unsigned char value) {
+    if (termId >= TERM_ID_GAIN_P && termId <= TERM_ID_MAXSPEED) {
+        boardParameters[termId - TERM_ID_GAIN_P] = value;
+    }
     
+    // every motor is now at this speed, idle or not
+    if (termId == TERM_ID_MAXSPEED) {
+        activeMaxSpeed = value;
+        unsigned long long now = ofGetElapsedTimeMicros();
+        for (int i = 0; i < NUM_ARDUINOS; i++) {
+            for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+                reliefBoardValues[i].pinIsIdle[j] = false;
+                reliefBoardValues[i].pinQuietSinceMicros[j] = now;
+            }
+        }
+        numIdlePins = 0;
+    }
+}
+
+bool ReliefIOManager::sendConfiguration(const reliefParameter *parameters, int numParameters, int timeoutMillis) {
+    lock();
+    int sequence = ++configurationSequence;
+    for (int n = 0; n < numParameters; n++) {
+        recordBoardParameter(parameters[n].termId, parameters[n].value);
+    }
+    unlock();
+    
+    unsigned long long startMicros = ofGetElapsedTimeMicros();
+    bool portConfirmed[NUM_SERIAL_CONNECTIONS] = {false};
+    bool portSkipped[NUM_SERIAL_CONNECTIONS] = {false};
+    int numConfirmed = 0;
+    int numSkipped = 0;
+    for (int attempt = 1; attempt <= CONFIGURATION_ATTEMPTS && numConfirmed + numSkipped < NUM_SERIAL_CONNECTIONS; attempt++) {
+        bool portSent[NUM_SERIAL_CONNECTIONS] = {false};
+        unsigned int portSequences[NUM_SERIAL_CONNECTIONS];
+        int connections[NUM_SERIAL_CONNECTIONS];
+        unsigned long long flushedMicros[NUM_SERIAL_CONNECTIONS] = {0};
+        unsigned long long deadline = ofGetElapsedTimeMicros() + timeoutMillis * 1000ULL;
+        
+        while (numConfirmed + numSkipped < NUM_SERIAL_CONNECTIONS && ofGetElapsedTimeMicros() < deadline) {
+            for (int port = 0; port < NUM_SERIAL_CONNECTIONS; port++) {
+                if (portConfirmed[port] || portSkipped[port]) continue;
+                ReliefSerial *serial = mSerialConnections[port];
+                
+                // an unplugged adapter won't come back within the timeout; checkPortConnections
+                // sends the recorded parameters when it does
+                if (serial->isPortMissing()) {
+                    portSkipped[port] = true;
+                    numSkipped++;
+                    continue;
+                }
+                
+                // a port that is still coming up gets the parameters as soon as it is. a port
+                // that reopened since lost them with its queue and its boards' reset
+                if (portSent[port] && serial->getConnections() != connections[port]) {
+                    portSent[port] = false;
+                    flushedMicros[port] = 0;
+                }
+                if (!portSent[port]) {
+                    if (!serial->isPortUp()) continue;
+                    connections[port] = serial->getConnections();
+                    portSent[port] = true;
+                    lock();
+                    for (int n = 0; n < numParameters; n++) {
+                        unsigned char messageContents[MSGS_SIZE];
+                        messageContents[0] = parameters[n].termId;
+                        messageContents[1] = 0;
+                        memset(&messageContents[2], parameters[n].value, NUM_PINS_ARDUINO);
+                        portSent[port] &= serial->writeTrackedMessage(messageContents, portSequences[port]);
+                    }
+                    unlock();
+                    continue;
+                }
+                
+                if (flushedMicros[port] == 0) {
+                    if (!serial->isFlushed(portSequences[port])) continue;
+                    flushedMicros[port] = ofGetElapsedTimeMicros();
+                }
+                if (isConfigurationAcknowledged(port, flushedMicros[port])) {
+                    portConfirmed[port] = true;
+                    numConfirmed++;
+                }
+            }
+            if (numConfirmed + numSkipped < NUM_SERIAL_CONNECTIONS) ofSleepMillis(1);
+        }
+        
+        if (numConfirmed == NUM_SERIAL_CONNECTIONS) {
+            ofLog(OF_LOG_NOTICE, "ReliefIOManager: configuration " + ofToString(sequence) + " confirmed in " +
+                    ofToString((ofGetElapsedTimeMicros() - startMicros) / 1000) + " ms");
+            return true;
+        }
+        if (numConfirmed + numSkipped < NUM_SERIAL_CONNECTIONS) {
+            ofLog(OF_LOG_WARNING, "ReliefIOManager: configuration " + ofToString(sequence) + " unconfirmed on " +
+                    ofToString(NUM_SERIAL_CONNECTIONS - numConfirmed - numSkipped) + " ports after attempt " + ofToString(attempt));
+        }
+    }
+    if (numSkipped > 0) {
+        ofLog(OF_LOG_WARNING, "ReliefIOManager: configuration " + ofToString(sequence) + " waits on " + ofToString(numSkipped) +
+                " unplugged ports; they get it when they connect");
+    }
+    return false;
+}
+
+// boards don't answer parameter messages, but the ones that report their positions show
+// they are up and listening by reporting again after the parameters went out
+bool ReliefIOManager::isConfigurationAcknowledged(int serialConnection, unsigned long long flushedMicros) {
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        if (reliefBoardValues[i].serialConnection != serialConnection || !hasPinFeedback(i)) continue;
+        if (getFeedbackMicros(i) < flushedMicros) return false;
+    }
+    return true;
+}
+
+bool ReliefIOManager::waitUntilFlushed(int timeoutMillis) {
+    unsigned long long deadline = ofGetElapsedTimeMicros() + timeoutMillis * 1000ULL;
+    while (true) {
+        bool drained = true;
+        for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+            drained &= mSerialConnections[i]->isDrained();
+        }
+        if (drained) return true;
+        if (ofGetElapsedTimeMicros() >= deadline) return false;
+        ofSleepMillis(1);
+    }
+}
+
+// a value for every pin on every board of one connection: board id 0
+void ReliefIOManager::queueValueToPort(unsigned char termId, unsigned char value, int serialConnection) {
     unsigned char messageContents[8];
     messageContents[0] = (unsigned char) termId;
     messageContents[1] = (unsigned char) 0;
     for (int i = 0; i < NUM_PINS_ARDUINO; i++) {
         messageContents[i + 2] = (unsigned char) value;
     }
-    
-    for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i ++) {
-        mSerialConnections[i]->writeMessage(messageContents);
-    }	
+    mSerialConnections[serialConnection]->writeMessage(messageContents);
 }
 
-void ReliefIOManager::loadSettings(string pFileName) {
-	
-	mXML.loadFile(pFileName);
-	
-	// load pin lookup table
-	int numArduinos = mXML.getNumTags("BOX");
-	if (numArduinos == NUM_ARDUINOS) {
-		for (int i = 0; i < numArduinos; i ++) {
-			mXML.pushTag("BOX", i);
-			int ArduinoID = mXML.getValue("ID", 0);
-			for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-				int x = mXML.getValue("PIN:X", 0, j);
-				int y = mXML.getValue("PIN:Y", 0, j);
-				//mPinLookupTable[ArduinoID][j][0] = x;
-				//mPinLookupTable[ArduinoID][j][1] = y;
-			}
-			mXML.popTag();
-		}
-	}
-}
-
-void ReliefIOManager::loadSettings() {
-    
-    
-    // set up coordinates for 
-    for (int i = 0; i < 60; i++) {
-        // every 3rd and 4th board is mounted upside down
-        reliefBoardValues[i].invertHeight = (((i/2)%2) == 0) ? false : true;
-        // determine which serial connection each board is on
-        if (i < 28) {
-            reliefBoardValues[i].serialConnection = 0;
-        } else {
-            reliefBoardValues[i].serialConnection = 1;
+// catch up ports that opened since the last check, for the first time or after failing.
+// callers hold lock()
+void ReliefIOManager::checkPortConnections() {
+    unsigned long long now = ofGetElapsedTimeMicros();
+    for (int port = 0; port < NUM_SERIAL_CONNECTIONS; port++) {
+        int connections = mSerialConnections[port]->getConnections();
+        if (connections == portConnections[port]) continue;
+        portConnections[port] = connections;
+        
+        for (int k = 0; k < NUM_BOARD_PARAMETERS; k++) {
+            if (boardParameters[k] < 0) continue;
+            queueValueToPort(TERM_ID_GAIN_P + k, boardParameters[k], port);
+            portByteBudget[port] -= MSGS_SIZE;
         }
-        for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-            int currentRow = (int)(i / 2);
-            int currentColumn = j + (i%2 * 6);
-            reliefBoardValues[i].lastFramePinHeight[j] = 0;
-            reliefBoardValues[i].currentFramePinHeight[j] = 0;
-            reliefBoardValues[i].rollingAverageHeight[j] = 0;
-            reliefBoardValues[i].pinIsIdle[j] = true;
-            reliefBoardValues[i].pinCoordinates[j][0] = currentRow;
-            reliefBoardValues[i].pinCoordinates[j][1] = currentColumn;
+        
+        // the boards start with their motors on and no heights; resend all of them in full
+        for (int i = 0; i < NUM_ARDUINOS; i++) {
+            if (reliefBoardValues[i].serialConnection != port) continue;
+            memset(&sentWirePayloads[i * NUM_PINS_ARDUINO], 0, NUM_PINS_ARDUINO);
+            publishCommandedHeights(i);
+            framesSinceKeyframe[i] = V2_KEYFRAME_FRAMES;
+            for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+                reliefBoardValues[i].pinIsIdle[j] = false;
+                reliefBoardValues[i].pinQuietSinceMicros[j] = now;
+            }
         }
+        publishIdlePins();
+    }
+}
+
+// load the board map: each BOX has the board's ID on the wire, the PORT it is on, INVERT if it
+// is mounted upside down, and per PIN the X and Y of the height map pixel it shows. the map is
+// only used if it validates; otherwise the current one stays, or the pins stay undriven if
+// none has loaded yet
+bool ReliefIOManager::loadSettings(string pFileName) {
+    ofxXmlSettings xml;
+    if (!xml.loadFile(pFileName)) {
+        ofLog(OF_LOG_ERROR, "ReliefIOManager: could not load the board map from " + pFileName);
+        return false;
     }
     
-    for (int i = 60; i < 150; i++) {
-        // every 4th, 5th and 6th board is mounted upside down
-        
-        reliefBoardValues[i].invertHeight = ((((i-60)/3)%2) == 0) ? false : true;
-        if (i < 90) {
-            reliefBoardValues[i].serialConnection = 2;
-        } else if (i < 120){
-            reliefBoardValues[i].serialConnection = 3;
+    ReliefBoard boards[NUM_ARDUINOS];
+    bool boardFound[NUM_ARDUINOS] = {false};
+    int numProblems = 0;
+    int numBoxes = xml.getNumTags("BOX");
+    for (int n = 0; n < numBoxes; n++) {
+        xml.pushTag("BOX", n);
+        int boardId = xml.getValue("ID", 0);
+        int port = xml.getValue("PORT", -1);
+        int numPins = xml.getNumTags("PIN");
+        if (boardId < 1 || boardId > NUM_ARDUINOS || boardFound[boardId - 1]) {
+            ofLog(OF_LOG_ERROR, "ReliefIOManager: board map entry " + ofToString(n) + " has a missing, out of range or repeated board id " + ofToString(boardId));
+            numProblems++;
+        } else if (port < 0 || port >= NUM_SERIAL_CONNECTIONS || numPins != NUM_PINS_ARDUINO) {
+            ofLog(OF_LOG_ERROR, "ReliefIOManager: board " + ofToString(boardId) + " needs a port from 0 to " + ofToString(NUM_SERIAL_CONNECTIONS - 1) +
+                    " and " + ofToString(NUM_PINS_ARDUINO) + " pins");
+            numProblems++;
         } else {
-            reliefBoardValues[i].serialConnection = 4;
+            ReliefBoard &board = boards[boardId - 1];
+            boardFound[boardId - 1] = true;
+            board.serialConnection = port;
+            board.invertHeight = xml.getValue("INVERT", 0) != 0;
+            for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+                board.pinCoordinates[j][0] = board.pinCoordinates[j][1] = 0xff;
+            }
+            for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+                int slot = xml.getValue("PIN:ID", j, j);
+                int x = xml.getValue("PIN:X", -1, j);
+                int y = xml.getValue("PIN:Y", -1, j);
+                if (slot < 0 || slot >= NUM_PINS_ARDUINO || board.pinCoordinates[slot][0] != 0xff ||
+                        x < 0 || x >= RELIEF_SIZE_X || y < 0 || y >= RELIEF_SIZE_Y) {
+                    ofLog(OF_LOG_ERROR, "ReliefIOManager: board " + ofToString(boardId) + " pin entry " + ofToString(j) + " has a bad or repeated pin id or pixel");
+                    numProblems++;
+                    continue;
+                }
+                board.pinCoordinates[slot][0] = x;
+                board.pinCoordinates[slot][1] = y;
+            }
         }
-        for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-            int currentRow = (int)((i - 60) / 3);
-            int currentColumn = 12 + j + ((i-60)%3 * 6);
-            reliefBoardValues[i].lastFramePinHeight[j] = 0;
-            reliefBoardValues[i].currentFramePinHeight[j] = 0;
-            reliefBoardValues[i].rollingAverageHeight[j] = 0;
-            reliefBoardValues[i].pinIsIdle[j] = true;
-            reliefBoardValues[i].pinCoordinates[j][0] = currentRow;
-            reliefBoardValues[i].pinCoordinates[j][1] = currentColumn;
+        xml.popTag();
+    }
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        if (!boardFound[i]) {
+            ofLog(OF_LOG_ERROR, "ReliefIOManager: board " + ofToString(i + 1) + " is missing from the board map");
+            numProblems++;
         }
     }
     
-    
-    // switch the coordinates for boards that have been set out of order for serial connection 0 and 1:
-    int wrongCols[8]= {0,3,4,23,26,27,28,29};
-    for (int i = 0; i < 8; i++) {
+    if (numProblems > 0 || !validateBoardMap(boards)) {
+        ofLog(OF_LOG_ERROR, "ReliefIOManager: keeping the current board map, " + pFileName + " is invalid");
+        return false;
+    }
+    lock();
+    memcpy(reliefBoardValues, boards, sizeof(reliefBoardValues));
+    compileBoardMap();
+    boardMapLoaded = true;
+    unlock();
+    return true;
+}
+
+void ReliefIOManager::saveSettings(string pFileName) {
+    if (!boardMapLoaded) {
+        ofLog(OF_LOG_ERROR, "ReliefIOManager: no board map to save to " + pFileName);
+        return;
+    }
+    ofxXmlSettings xml;
+    lock();
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        xml.addTag("BOX");
+        xml.pushTag("BOX", i);
+        xml.setValue("ID", i + 1);
+        xml.setValue("PORT", reliefBoardValues[i].serialConnection);
+        xml.setValue("INVERT", reliefBoardValues[i].invertHeight ? 1 : 0);
         for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-            for (int k = 0; k < 2; k++) {
-                unsigned char temp = reliefBoardValues[(wrongCols[i]*2)+1].pinCoordinates[j][k];
-                reliefBoardValues[(wrongCols[i]*2)+1].pinCoordinates[j][k] = reliefBoardValues[(wrongCols[i]*2)].pinCoordinates[j][k];
-                reliefBoardValues[(wrongCols[i]*2)].pinCoordinates[j][k] = temp;
-            }
+            xml.addTag("PIN");
+            xml.setValue("PIN:ID", j, j);
+            xml.setValue("PIN:X", reliefBoardValues[i].pinCoordinates[j][0], j);
+            xml.setValue("PIN:Y", reliefBoardValues[i].pinCoordinates[j][1], j);
         }
+        xml.popTag();
     }
-    // change the row order according to how the Arduinos have been mounted
-    int rowOrder[30] = {1,0,2,3,5,4,7,6,9,8,11,10,13,12,14,15,16,17,19,18,21,20,23,22,25,24,27,26,28,29};
-    for (int i = 0; i < 15; i++) {
-        if (rowOrder[i*2] > rowOrder[(i*2) + 1]) {
-            for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-                for (int k = 0; k < 2; k++) {
-                    unsigned char temp = reliefBoardValues[(i*4)+ 2].pinCoordinates[j][k];
-                    reliefBoardValues[(i*4) + 2].pinCoordinates[j][k] = reliefBoardValues[i*4].pinCoordinates[j][k];
-                    reliefBoardValues[i*4].pinCoordinates[j][k] = temp;
-                    
-                    temp = reliefBoardValues[(i*4)+ 3].pinCoordinates[j][k];
-                    reliefBoardValues[(i*4) + 3].pinCoordinates[j][k] = reliefBoardValues[(i*4)+ 1].pinCoordinates[j][k];
-                    reliefBoardValues[(i*4)+ 1].pinCoordinates[j][k] = temp;
-                }
+    unlock();
+    xml.saveFile(pFileName);
+}
+
+// every pixel of the height map is driven by exactly one pin, and each port's boards are
+// numbered consecutively and fit in one v2 frame bitmap
+bool ReliefIOManager::validateBoardMap(const ReliefBoard *boards) {
+    int numProblems = 0;
+    short pixelPins[RELIEF_SIZE_X * RELIEF_SIZE_Y];
+    for (int p = 0; p < RELIEF_SIZE_X * RELIEF_SIZE_Y; p++) {
+        pixelPins[p] = -1;
+    }
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+            int p = boards[i].pinCoordinates[j][1] * RELIEF_SIZE_X + boards[i].pinCoordinates[j][0];
+            if (pixelPins[p] >= 0) {
+                ofLog(OF_LOG_ERROR, "ReliefIOManager: board " + ofToString(i + 1) + " pin " + ofToString(j) + " shows the same pixel as board " +
+                        ofToString(pixelPins[p] / NUM_PINS_ARDUINO + 1) + " pin " + ofToString(pixelPins[p] % NUM_PINS_ARDUINO));
+                numProblems++;
             }
+            pixelPins[p] = i * NUM_PINS_ARDUINO + j;
         }
     }
+    int numUnmapped = 0;
+    for (int p = 0; p < RELIEF_SIZE_X * RELIEF_SIZE_Y; p++) {
+        if (pixelPins[p] < 0) numUnmapped++;
+    }
+    if (numUnmapped > 0) {
+        ofLog(OF_LOG_ERROR, "ReliefIOManager: " + ofToString(numUnmapped) + " pixels of the height map have no pin");
+        numProblems++;
+    }
     
-    // invert pin order if the pins have been mounted inverted for first 60 boards
-    for (int i = 0; i < 60; i++) {
-        for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-            reliefBoardValues[i].pinCoordinates[j][1] = (!reliefBoardValues[i].invertHeight) ? 11 - reliefBoardValues[i].pinCoordinates[j][1] : reliefBoardValues[i].pinCoordinates[j][1];
+    for (int port = 0; port < NUM_SERIAL_CONNECTIONS; port++) {
+        int first = -1, last = -1, count = 0;
+        for (int i = 0; i < NUM_ARDUINOS; i++) {
+            if (boards[i].serialConnection != port) continue;
+            if (first < 0) first = i;
+            last = i;
+            count++;
+        }
+        if (count > 0 && (last - first + 1 != count || count > V2_MAX_BOARDS_PER_FRAME)) {
+            ofLog(OF_LOG_ERROR, "ReliefIOManager: the boards on port " + ofToString(port) + " must have consecutive ids, at most " +
+                    ofToString(V2_MAX_BOARDS_PER_FRAME) + " of them");
+            numProblems++;
         }
     }
-    // do the same for the remaining
-    for (int i = 60; i < 150; i++) {
+    return numProblems == 0;
+}
+
+// turn the board map into pinRoutes, and start every board over: changed, in need of a
+// full update and with its motors on. callers hold lock()
+void ReliefIOManager::compileBoardMap() {
+    unsigned long long now = ofGetElapsedTimeMicros();
+    for (int p = 0; p < RELIEF_SIZE_X * RELIEF_SIZE_Y; p++) {
+        pinRoutes[p].board = NO_BOARD;
+    }
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
         for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-            reliefBoardValues[i].pinCoordinates[j][1] = (!reliefBoardValues[i].invertHeight) ? 12 + 29 - reliefBoardValues[i].pinCoordinates[j][1] : reliefBoardValues[i].pinCoordinates[j][1];
+            reliefPinRoute &route = pinRoutes[reliefBoardValues[i].pinCoordinates[j][1] * RELIEF_SIZE_X + reliefBoardValues[i].pinCoordinates[j][0]];
+            route.port = reliefBoardValues[i].serialConnection;
+            route.board = i;
+            route.slot = j;
+            route.invert = reliefBoardValues[i].invertHeight ? 0xff : 0x00;
+            reliefBoardValues[i].pinActivity[j] = 0;
+            reliefBoardValues[i].pinQuietSinceMicros[j] = now;
+            reliefBoardValues[i].pinIsIdle[j] = false;
         }
     }
     
-    // print out the mapping
-    /*
-    for (int i = 0; i < NUM_ARDUINOS; i++) {
-        for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
-            printf("%d,%d(%d); ", reliefBoardValues[i].pinCoordinates[j][0], reliefBoardValues[i].pinCoordinates[j][1], reliefBoardValues[i].invertHeight);
+    // boards powered down under the previous map still have a max speed of 0; turn every
+    // motor back on, as the new map counts them all as active
+    int maxSpeed = boardParameters[TERM_ID_MAXSPEED - TERM_ID_GAIN_P];
+    if (maxSpeed >= 0) {
+        for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+            queueValueToPort(TERM_ID_MAXSPEED, maxSpeed, i);
         }
-        printf("\n");
-    }*/
+    }
+    
+    // the wire gather table follows from pinRoutes at the next frame
+    wireGatherChannels = 0;
+    memset(sentWirePayloads, 0, sizeof(sentWirePayloads));
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        framesSinceSent[i] = 0;
+        framesSinceKeyframe[i] = V2_KEYFRAME_FRAMES;
+        boardPorts[i] = reliefBoardValues[i].serialConnection;
+        boardInverts[i] = reliefBoardValues[i].invertHeight ? 0xff : 0x00;
+        publishCommandedHeights(i);
+    }
+    numIdlePins = 0;
+    for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+        portByteBudget[i] = 0;
+        portFirstBoards[i] = NUM_ARDUINOS;
+    }
+    for (int i = NUM_ARDUINOS - 1; i >= 0; i--) {
+        portFirstBoards[reliefBoardValues[i].serialConnection] = i;
+    }
+}
+
+// time the per-frame mapping: gather, clamp, invert and change detection over numFrames
+// frames that alternate between two height maps. leaves the frame state as it was
+float ReliefIOManager::benchmarkFrameConversion(int numFrames) {
+    unsigned char heightMaps[2][RELIEF_SIZE_X * RELIEF_SIZE_Y];
+    for (int p = 0; p < RELIEF_SIZE_X * RELIEF_SIZE_Y; p++) {
+        heightMaps[0][p] = p % 256;
+        heightMaps[1][p] = 255 - p % 256;
+    }
+    
+    lock();
+    unsigned char savedPayloads[NUM_WIRE_PINS_PADDED];
+    uint64_t savedChangedBoards[(NUM_ARDUINOS + 63) / 64];
+    memcpy(savedPayloads, wirePayloads, sizeof(wirePayloads));
+    memcpy(savedChangedBoards, changedBoardMask, sizeof(changedBoardMask));
+    int savedChannels = wireGatherChannels;
+    buildWireGatherTable(1);
+    
+    unsigned long long start = ofGetElapsedTimeMicros();
+    for (int n = 0; n < numFrames; n++) {
+        convertFrame(heightMaps[n % 2]);
+    }
+    float microsPerFrame = (ofGetElapsedTimeMicros() - start) / (float) numFrames;
+    
+    memcpy(wirePayloads, savedPayloads, sizeof(wirePayloads));
+    memcpy(changedBoardMask, savedChangedBoards, sizeof(changedBoardMask));
+    if (savedChannels != 1) wireGatherChannels = 0;
+    unlock();
+    return microsPerFrame;
 }
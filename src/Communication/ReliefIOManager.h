@@ -12,17 +12,83 @@
 
 #include "ofMain.h"
 #include "ReliefSerial.h"
+#include "ReliefBusEmulator.h"
 #include "Constants.h"
 #include "ofxXmlSettings.h"
 
+// every board's pin heights laid out back to back, as they go out on the wire
+#define NUM_WIRE_PINS (NUM_ARDUINOS * NUM_PINS_ARDUINO)
+#define NUM_WIRE_PINS_PADDED (((NUM_WIRE_PINS + 15) / 16) * 16)
+#define PIN_HEIGHT_MIN 15
+#define PIN_HEIGHT_MAX 240
+
+// a pin is quiet once its activity, the moving average of how far it is asked to move each
+// frame in 8.8 fixed point, falls below this
+#define PIN_ACTIVITY_QUIET (1 << 6)
+
+// board parameters, TERM_ID_GAIN_P to TERM_ID_MAXSPEED, as last sent to all boards
+#define NUM_BOARD_PARAMETERS (TERM_ID_MAXSPEED - TERM_ID_GAIN_P + 1)
+
+// configuration transactions: each attempt waits this long for every port to confirm
+#define CONFIGURATION_TIMEOUT_MILLIS 1000
+#define CONFIGURATION_ATTEMPTS 3
+
+// bytes each port can carry per second: 10 bits per byte on the wire
+#define PORT_BYTES_PER_SECOND (SERIAL_BAUD_RATE / 10.0)
+
+// set on the output thread's pending height frame until the thread takes it
+#define OUTPUT_FRAME_FRESH 4
+
+enum ReliefTrajectoryMode {
+    TRAJECTORY_OFF,         // every tick sends the newest frame as it is
+    TRAJECTORY_INTERPOLATE, // ticks step from the previous frame to the newest, a frame behind
+    TRAJECTORY_EXTRAPOLATE  // ticks carry on past the newest frame at the velocity between the two
+};
+
+enum ReliefProtocol {
+    PROTOCOL_V1_MESSAGES, // one 8-byte message per board
+    PROTOCOL_V2_FRAMES    // one frame of changed pins per port
+};
+
+// a height map handed from the render thread to the output thread, one byte per pin
+struct reliefHeightFrame {
+    unsigned char heights[RELIEF_SIZE_X * RELIEF_SIZE_Y];
+    unsigned long long publishedMicros; // 0 until the render thread has filled it
+};
+
+// output thread timing, readable from any thread
+struct reliefOutputStats {
+    float ticksPerSecond;               // the rate the thread was started at; 0 if it isn't running
+    unsigned long long ticks;
+    unsigned long long ticksSkipped;    // ticks dropped for starting a whole period late
+    unsigned long long framesReplaced;  // height maps overwritten by a newer one before any tick sent them
+    float averageJitterMillis;          // moving average of how late ticks start
+    float maxJitterMillis;
+    float averageFrameAgeMillis;        // moving average of the age of the height map each tick sends
+    float maxFrameAgeMillis;
+};
+
+struct reliefParameter {
+    unsigned char termId; // TERM_ID_GAIN_P to TERM_ID_MAXSPEED
+    unsigned char value;
+};
+
+// where the height in one pixel of the height map goes on the wire
+#define NO_BOARD 0xff
+struct reliefPinRoute {
+    unsigned char port;
+    unsigned char board;  // board index, one less than its id; NO_BOARD if no pin shows the pixel
+    unsigned char slot;   // pin on the board
+    unsigned char invert; // 0xff if the board is mounted upside down
+};
+
 class ReliefBoard{
 public:
-    unsigned char pinCoordinates[NUM_PINS_ARDUINO][2]; // what physical x and y does each pin on the board map to?
+    unsigned char pinCoordinates[NUM_PINS_ARDUINO][2]; // which height map pixel, x and y, does each pin on the board show?
     bool invertHeight; // is it mounted upside down? if so, the height is inverted
-    double rollingAverageHeight[NUM_PINS_ARDUINO];
-    bool pinIsIdle[NUM_PINS_ARDUINO];
-    unsigned char lastFramePinHeight[NUM_PINS_ARDUINO];
-    unsigned char currentFramePinHeight[NUM_PINS_ARDUINO];
+    unsigned short pinActivity[NUM_PINS_ARDUINO]; // 8.8 fixed point, see PIN_ACTIVITY_QUIET
+    unsigned long long pinQuietSinceMicros[NUM_PINS_ARDUINO];
+    bool pinIsIdle[NUM_PINS_ARDUINO]; // quiet past the idle timeout, with its motor powered down
     int serialConnection; // what serial connection is it on?
     bool isBoardIdle() {
         bool boardIsIdle = true;
@@ -33,21 +99,179 @@ public:
     };
 };
 
-class ReliefIOManager {
+class ReliefIOManager: public ofThread {
 private:
 	ReliefSerial * mSerialConnections [NUM_SERIAL_CONNECTIONS];
+	ReliefBusEmulator * mBusEmulator; // NULL unless EMULATE_RELIEF_BUS
 	ReliefBoard reliefBoardValues [NUM_ARDUINOS];
-	ofxXmlSettings mXML;
     void setPinsDeadzone();
+    void loadSerialPortSettings(string fileName, string portNames[NUM_SERIAL_CONNECTIONS]);
+
+    // reconnects. a port that comes back has boards that just reset: they get every parameter
+    // sent to all boards so far and then all of their heights
+    void checkPortConnections();
+    void queueValueToPort(unsigned char termId, unsigned char value, int serialConnection);
+    void recordBoardParameter(unsigned char termId, unsigned char value);
+    bool isConfigurationAcknowledged(int serialConnection, unsigned long long flushedMicros);
+    int configurationSequence = 0;
+    int portConnections[NUM_SERIAL_CONNECTIONS]; // the connection each port was on when last checked
+    int boardParameters[NUM_BOARD_PARAMETERS];   // -1 until sent
+
+    // board map, loaded from xml by loadSettings and compiled into pinRoutes, one entry per
+    // pixel of the height map, which the wire gather table is built from. there is no built-in
+    // map: until one loads, no pin is driven
+    bool validateBoardMap(const ReliefBoard *boards);
+    void compileBoardMap();
+    std::atomic<bool> boardMapLoaded;
+    reliefPinRoute pinRoutes[RELIEF_SIZE_X * RELIEF_SIZE_Y];
+
+    // frame conversion: one gather from the rendered height map straight to wire bytes.
+    // orientation and board mapping are folded into the gather table, clamping and
+    // inversion are applied 16 bytes at a time
+    void buildWireGatherTable(int numChannels);
+    void convertFrame(const unsigned char *heightMap);
+    int wireGatherTable[NUM_WIRE_PINS_PADDED];          // height map byte offset for each wire byte
+    int wireGatherChannels = 0;                         // channel count the table was built for
+    unsigned char wireInvertMask[NUM_WIRE_PINS_PADDED]; // 0xff for pins on upside-down boards
+    unsigned char wirePayloads[NUM_WIRE_PINS_PADDED];   // this frame's per-board payloads
+    uint64_t changedBoardMask[(NUM_ARDUINOS + 63) / 64]; // boards whose payload differs from what they were sent
+
+    // update scheduling. each port gets a budget of bytes per frame from its baud rate;
+    // when more boards need updating than fit, the ones furthest from their target and
+    // longest without an update go first
+    void scheduleBoardUpdates();
+    int encodeBoardRecord(int board, unsigned char *record);
+    int sendFrames(int port, const bool *boardSelected);
+    void commitBoardRecord(int board);
+    unsigned char sentWirePayloads[NUM_WIRE_PINS_PADDED]; // what each board was last sent
+    int boardErrors[NUM_ARDUINOS];                        // summed pin height error against this frame
+    unsigned char boardPinMasks[NUM_ARDUINOS];            // pins whose error is over the deadband
+    int framesSinceSent[NUM_ARDUINOS];
+    int framesSinceKeyframe[NUM_ARDUINOS];
+    unsigned char boardRecords[NUM_ARDUINOS][V2_MAX_RECORD_LENGTH];
+    int boardRecordLengths[NUM_ARDUINOS];
+    float portByteBudget[NUM_SERIAL_CONNECTIONS];
+    ReliefProtocol portProtocols[NUM_SERIAL_CONNECTIONS];
+    int portFirstBoards[NUM_SERIAL_CONNECTIONS]; // a port's boards are numbered consecutively
+
+    // idle power-down. a pin that stays quiet for idleTimeoutMillis gets a max speed of 0,
+    // which turns its motor off, and activeMaxSpeed again as soon as it is asked to move
+    bool updatePinActivity(int board, int pin, int error, unsigned long long now);
+    void sendBoardPower(int board);
+    int idleTimeoutMillis = 2000;   // 0 keeps every motor powered
+    int activeMaxSpeed = 0;         // the last max speed sent to all boards; 0 until one is
+    unsigned long long getFeedbackMicros(int board) { return mSerialConnections[boardPorts[board]]->getFeedbackMicros(board + 1); }
+
+    // what the queries below read without locking. written one atomic at a time by whoever
+    // holds lock(), whenever the board map, what a board was sent or a pin's power changes
+    void publishCommandedHeights(int board);
+    void publishIdlePins();
+    std::atomic<unsigned char> commandedHeights[NUM_ARDUINOS][NUM_PINS_ARDUINO]; // last sent, as heights
+    std::atomic<unsigned char> boardPorts[NUM_ARDUINOS];
+    std::atomic<unsigned char> boardInverts[NUM_ARDUINOS]; // 0xff if mounted upside down
+    std::atomic<int> numIdlePins;
+    unsigned long long lastFrameMicros = 0;
+    int pinDeadband = 0;    // pin errors up to this are not worth a message
+    int errorPerFrame = 4;  // how much a frame of waiting weighs against a unit of height error
+
+    // fixed-rate output. sendPinHeightToRelief only publishes the height map; the output thread
+    // wakes at a fixed rate, swaps in the newest one and sends it, so a slow render frame no
+    // longer holds up the pins. the render thread fills heightFrames[renderFrame] and exchanges
+    // it with the pending slot, the output thread exchanges outputFrame with the pending slot
+    // when it holds a fresh frame; neither ever waits for the other. lock() serializes
+    // everything that writes to the serial connections, which take one producer at a time
+    void threadedFunction();
+    void writeHeightMap(const unsigned char *heightMap, int numChannels);
+    void recordTick(int jitterMicros, int frameAgeMicros);
+    
+    // trajectory shaping. with the output thread running, ticks don't send the newest frame
+    // itself but a point on the way to it, so pins follow a 30 Hz render in 60 Hz steps. the
+    // point is interpolated or extrapolated from the last two frames, then every pin is moved
+    // towards it within its slew and acceleration limits. the steps go through the scheduler
+    // like any frame, so a busy port sends fewer, larger ones
+    void shapeTrajectory(const reliefHeightFrame &frame, unsigned long long now);
+    std::atomic<ReliefTrajectoryMode> trajectoryMode;
+    std::atomic<bool> trajectoryRestart; // set by setTrajectoryMode; the output thread restarts shaping
+    float pinSlewLimit = 1000;          // heights per second; 0 for no limit
+    float pinAccelerationLimit = 8000;  // heights per second squared; 0 for no limit
+    unsigned char trajectoryFrom[RELIEF_SIZE_X * RELIEF_SIZE_Y]; // the frame before the newest
+    unsigned long long trajectoryFromMicros = 0;                 // 0 until there is one
+    float shapedHeights[RELIEF_SIZE_X * RELIEF_SIZE_Y];
+    float shapedVelocities[RELIEF_SIZE_X * RELIEF_SIZE_Y];
+    unsigned char shapedFrame[RELIEF_SIZE_X * RELIEF_SIZE_Y];
+    unsigned long long lastShapedMicros = 0;                     // 0 to start from the next frame as it is; output thread only
+    bool queueValuesToBoard(unsigned char termId, unsigned char boardId, const unsigned char value[NUM_PINS_ARDUINO], int serialConnection);
+    reliefHeightFrame heightFrames[3];
+    int renderFrame;
+    int outputFrame;
+    std::atomic<int> pendingFrame; // frame index, plus OUTPUT_FRAME_FRESH until the output thread takes it
+    std::atomic<int> outputTickMicros;
+    std::atomic<unsigned long long> outputTicks;
+    std::atomic<unsigned long long> outputTicksSkipped;
+    std::atomic<unsigned long long> framesReplaced;
+    std::atomic<int> averageJitterMicros;
+    std::atomic<int> maxJitterMicros;
+    std::atomic<int> averageFrameAgeMicros;
+    std::atomic<int> maxFrameAgeMicros;
 	
 public:
 	ReliefIOManager();
 	~ReliefIOManager();
-	void sendPinHeightToRelief(unsigned char pPinHeightToRelief [RELIEF_SIZE_X][RELIEF_SIZE_Y]);
+
+    // send a height map laid out as rendered: RELIEF_SIZE_X by RELIEF_SIZE_Y pixels, row by
+    // row, numChannels bytes per pixel with the height in the first. with the output thread
+    // running this only hands the heights over and returns; the next tick sends them
+	void sendPinHeightToRelief(const unsigned char *heightMap, int numChannels);
+    void startOutputThread(float ticksPerSecond);
+    void stopOutputThread();
+    reliefOutputStats getOutputStats();
+    void setTrajectoryMode(ReliefTrajectoryMode mode) { trajectoryMode = mode; trajectoryRestart = true; }
+    ReliefTrajectoryMode getTrajectoryMode() { return trajectoryMode; }
+    void setPinSlewLimit(float heightsPerSecond) { pinSlewLimit = heightsPerSecond; }
+    void setPinAccelerationLimit(float heightsPerSecondSquared) { pinAccelerationLimit = heightsPerSecondSquared; }
+    void resetOutputStats();
+    const unsigned char *getWirePayload(int board) { return &wirePayloads[board * NUM_PINS_ARDUINO]; }
+    bool boardChanged(int board) { return (changedBoardMask[board / 64] >> (board % 64)) & 1; }
+    void setPinDeadband(int deadband) { pinDeadband = deadband; }
+    int getPinDeadband() { return pinDeadband; }
+    void setErrorPerFrame(int error) { errorPerFrame = error; }
+    void setIdleTimeoutMillis(int millis) { idleTimeoutMillis = millis; }
+    int getNumIdlePins() { return numIdlePins; } // doesn't lock
+    // v2 frames need board firmware that understands them; v1 messages work with any
+    void setPortProtocol(int serialConnection, ReliefProtocol protocol);
+    ReliefProtocol getPortProtocol(int serialConnection) { return portProtocols[serialConnection]; }
+
+    // what the boards report back, by board index and pin, as heights. none of these lock,
+    // so the render thread can poll them every frame
+    bool hasPinFeedback(int board) { return getFeedbackMicros(board) != 0; }
+    float getFeedbackAgeMillis(int board) { return (ofGetElapsedTimeMicros() - getFeedbackMicros(board)) / 1000.0; }
+    int getPinPosition(int board, int pin);
+    int getPinError(int board, int pin); // actual minus commanded height
+    unsigned char getPinFaults(int board, int pin) { return mSerialConnections[boardPorts[board]]->getPinFaults(board + 1, pin); }
+    reliefSerialStats getSerialStats(int serialConnection) { return mSerialConnections[serialConnection]->getStats(); }
+    bool isPortUp(int serialConnection) { return mSerialConnections[serialConnection]->isPortUp(); }
+    void setQueueMode(ReliefQueueMode mode);
+    ReliefBusEmulator * getBusEmulator() { return mBusEmulator; }
+    ReliefQueueMode getQueueMode() { return mSerialConnections[0]->getQueueMode(); }
+
 	void sendValueToAllBoards(unsigned char termId, unsigned char value);
+    // send parameters to all boards and wait until every port confirms them: they have left
+    // the port, and every board on it that reports back has reported since. a port that
+    // fails, or reopens in between, gets them again, up to CONFIGURATION_ATTEMPTS times. a port
+    // whose device is missing is not waited for; it gets the parameters when it connects.
+    // returns whether all ports confirmed
+    bool sendConfiguration(const reliefParameter *parameters, int numParameters, int timeoutMillis = CONFIGURATION_TIMEOUT_MILLIS);
+    // wait until everything queued has left the ports; returns false on timeout
+    bool waitUntilFlushed(int timeoutMillis);
 	void sendValuesToBoard(unsigned char termId, unsigned char boardId, unsigned char value[NUM_PINS_ARDUINO], int serialConnection);
-	void loadSettings(string pFileName);
-    void loadSettings();
+	// load the board map; keeps the current one and returns false if the file is missing or
+	// fails validation, with the problems logged
+	bool loadSettings(string pFileName);
+    void saveSettings(string pFileName);
+    bool isBoardMapLoaded() { return boardMapLoaded; }
+    const reliefPinRoute &getPinRoute(int x, int y) { return pinRoutes[y * RELIEF_SIZE_X + x]; }
+    // microseconds the per-frame mapping takes, averaged over numFrames
+    float benchmarkFrameConversion(int numFrames);
 };
 
 
@@ -8,11 +8,48 @@
  */
 
 #include "ReliefSerial.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 
 ReliefSerial::ReliefSerial(string pPortName, int pBaudrate) {
+	queueHead = 0;
+	queueTail = 0;
+	writerWaiting = false;
+	queueMode = QUEUE_MODE_FIFO;
+	for (int i = 0; i < MAILBOX_SLOTS; i++) {
+		mailbox[i].sequence = 0;
+	}
+	for (int i = 0; i < MAILBOX_WORDS; i++) {
+		mailboxDirty[i] = 0;
+	}
+	mailboxCursor = 0;
+	replyLength = 0;
+	portUp = false;
+	portMissing = false;
+	portConnections = 0;
+	writtenSequence = 0;
+	writing = false;
+	for (int i = 0; i <= NUM_ARDUINOS; i++) {
+		for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+			pinPositions[i][j] = 0;
+			pinFaults[i][j] = 0;
+		}
+		feedbackMicros[i] = 0;
+	}
+	resetStats();
 	
-	mSerial.enumerateDevices();
-	mSerial.setup(pPortName, pBaudrate);
+	if (pipe(wakePipe) == 0) {
+		fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+	} else {
+		wakePipe[0] = wakePipe[1] = -1;
+	}
+	
+	mPortName = pPortName;
+	mBaudrate = pBaudrate;
 	start();
 }
 
@@ -20,6 +57,8 @@ ReliefSerial::~ReliefSerial(){
     
 	this->stop();
 	mSerial.close();
+	close(wakePipe[0]);
+	close(wakePipe[1]);
 }
 
 void ReliefSerial::start(){
@@ -28,41 +67,425 @@ void ReliefSerial::start(){
 
 void ReliefSerial::stop(){
 	stopThread();
+	wakeWriter();
+	waitForThread(false);
+}
+
+void ReliefSerial::wakeWriter(){
+	// if the pipe is full the writer has a wakeup coming already
+	unsigned char wake = 0;
+	write(wakePipe[1], &wake, 1);
 }
 
+// one thread writes and reads the port: it writes a batch of pending messages, then waits
+// on the port and the wake pipe until the port has room, a reply comes in or more messages
+// are queued. the port is non-blocking, so a write may take only part of a batch. the same
+// thread brings the port up, so all ports open at once, and reopens it if it fails
 void ReliefSerial::threadedFunction(){ 
-	ofSleepMillis(500);
+	int numMessages = 0;
+	int numBytes = 0;
+	int bytesWritten = 0;
+	unsigned int batchSequence = 0;
+	while( isThreadRunning() != 0 ){
+		if (!portUp) {
+			messagesDropped += numMessages; // what was left of a batch when the port failed
+			numMessages = 0;
+			if (!openPort() && isThreadRunning()) {
+				waitForWake(PORT_RETRY_MILLIS);
+			}
+			continue;
+		}
+		
+		// once the last batch is out, gather everything pending, queued messages first
+		if (numMessages == 0) {
+			writing = true;
+			while (numMessages < WRITE_BATCH_MESSAGES && takeFromQueue(writeBatchMessages[numMessages])) numMessages++;
+			batchSequence = queueTail.load(std::memory_order_relaxed);
+			while (numMessages < WRITE_BATCH_MESSAGES && takeFromMailbox(writeBatchMessages[numMessages])) numMessages++;
+			numBytes = 0;
+			for (int i = 0; i < numMessages; i++) {
+				memcpy(&writeBatchBytes[numBytes], writeBatchMessages[i].messageContent, writeBatchMessages[i].length);
+				numBytes += writeBatchMessages[i].length;
+			}
+			bytesWritten = 0;
+		}
+		
+		if (numMessages > 0) {
+			int result = mSerial.writeBytes(&writeBatchBytes[bytesWritten], numBytes - bytesWritten);
+			writeCalls++;
+			if (result > 0) {
+				bytesWritten += result;
+			} else if (result < 0) {
+				messagesDropped += numMessages;
+				numMessages = 0;
+				closePort();
+				continue;
+			}
+			if (numMessages > 0 && bytesWritten == numBytes) {
+				recordLatencies(numMessages);
+				writtenSequence = batchSequence;
+				numMessages = 0;
+			}
+		}
+		writing = numMessages > 0;
+		
+		waitForPort(numMessages > 0);
+	}
+}
+
+// wait for room to write the rest of a batch, or, with nothing left to write, for a message
+// to be queued. replies that have come in are read either way
+void ReliefSerial::waitForPort(bool needRoom) {
+	// announce the wait before rechecking for messages, so one queued in between is never missed
+	bool idle = false;
+	if (!needRoom) {
+		writerWaiting = true;
+		idle = !hasPendingMessages();
+	}
 	
-	//while (mSerial.available()) {
-	//	mSerial.readByte();
-	//}
+	struct pollfd fds[2];
+	fds[0].fd = mSerial.getFileDescriptor();
+	fds[0].events = POLLIN | (needRoom ? POLLOUT : 0);
+	fds[1].fd = wakePipe[0];
+	fds[1].events = POLLIN;
+	fds[0].revents = fds[1].revents = 0;
+	poll(fds, 2, (idle || needRoom) ? -1 : 0);
+	writerWaiting = false;
 	
-    unsigned char messageContent[MSGS_SIZE];
-    
-	while( isThreadRunning() != 0 ){
-		lock();
-        bool sendMessage = false;
-        if(messageBuffer.size() > 0) { // if there is an element in my buffer
-            for (int i = 0; i < MSGS_SIZE; i++) { // copy the content
-                messageContent[i] = messageBuffer.front().messageContent[i];
-            }
-            messageBuffer.erase(messageBuffer.begin());
-            sendMessage = true;
-        }
-        unlock();
-        
-        if (sendMessage) mSerial.writeBytes(messageContent, 8);
-        else ofSleepMillis(4);
-	}
-}
-
-
-void ReliefSerial::writeMessage(unsigned char messageContent[MSGS_SIZE]) {
-    reliefMessage newMessage;
-    for (int i = 0; i < MSGS_SIZE; i++) {
-        newMessage.messageContent[i] = messageContent[i];
-    }
-	lock();
-        messageBuffer.push_back(newMessage);
-	unlock();
+	if (fds[1].revents & POLLIN) {
+		unsigned char wakes[64];
+		while (read(wakePipe[0], wakes, sizeof(wakes)) > 0);
+	}
+	if (fds[0].revents & POLLIN) {
+		readReplies();
+	}
+	if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		closePort(); // unplugged
+	}
+}
+
+// the device for mPortName. os x names usb serial adapters after their serial number, so
+// the port is found again if it comes back under another device
+string ReliefSerial::findDevicePath() {
+	if (mPortName.size() > 0 && mPortName[0] == '/') return mPortName;
+	vector<ofSerialDeviceInfo> devices = mSerial.getDeviceList();
+	for (int i = 0; i < devices.size(); i++) {
+		if (devices[i].getDeviceName().find(mPortName) != string::npos) {
+			return devices[i].getDevicePath();
+		}
+	}
+	return "";
+}
+
+bool ReliefSerial::openPort() {
+	// ofSerial logs an error for every failed setup, so only try devices that are there
+	string devicePath = findDevicePath();
+	portMissing = devicePath == "" || access(devicePath.c_str(), F_OK) != 0;
+	if (portMissing) {
+		return false;
+	}
+	if (!mSerial.setup(devicePath, mBaudrate)) {
+		return false;
+	}
+	
+	// let the boards boot, unless stop() comes first
+	unsigned long long settledMicros = ofGetElapsedTimeMicros() + PORT_SETTLE_MILLIS * 1000ULL;
+	unsigned long long now;
+	while (isThreadRunning() && (now = ofGetElapsedTimeMicros()) < settledMicros) {
+		waitForWake((settledMicros - now) / 1000 + 1);
+	}
+	if (!isThreadRunning()) {
+		mSerial.close();
+		return false;
+	}
+	
+	// anything queued for the boards before they reset is stale; the caller sees the new
+	// connection and sends what they need to know
+	dropPendingMessages();
+	replyLength = 0;
+	portConnections++;
+	portUp = true;
+	ofLog(OF_LOG_NOTICE, "ReliefSerial: opened " + devicePath);
+	return true;
+}
+
+void ReliefSerial::closePort() {
+	if (!portUp) return;
+	portUp = false;
+	mSerial.close();
+	dropPendingMessages();
+	ofLog(OF_LOG_WARNING, "ReliefSerial: lost " + mPortName + ", reopening it in the background");
+}
+
+void ReliefSerial::dropPendingMessages() {
+	reliefMessage message;
+	while (takeFromQueue(message)) messagesDropped++;
+	while (takeFromMailbox(message)) messagesDropped++;
+}
+
+// sleep, unless stop() wakes us first
+void ReliefSerial::waitForWake(int millis) {
+	struct pollfd wakeFd;
+	wakeFd.fd = wakePipe[0];
+	wakeFd.events = POLLIN;
+	wakeFd.revents = 0;
+	poll(&wakeFd, 1, millis);
+	if (wakeFd.revents & POLLIN) {
+		unsigned char wakes[64];
+		while (read(wakePipe[0], wakes, sizeof(wakes)) > 0);
+	}
+}
+
+void ReliefSerial::recordLatencies(int numMessages) {
+	unsigned long long now = ofGetElapsedTimeMicros();
+	for (int i = 0; i < numMessages; i++) {
+		int latency = now - writeBatchMessages[i].enqueuedMicros;
+		averageLatencyMicros = (averageLatencyMicros * 15 + latency) / 16;
+		if (latency > maxLatencyMicros) maxLatencyMicros = latency;
+		lastLatencyMicros = latency;
+	}
+	messagesWritten += numMessages;
+}
+
+// replies are 8 bytes like the messages to the boards: a term id, the board id and one
+// value per pin. they are framed on their term id; bytes in front of one are skipped
+void ReliefSerial::readReplies() {
+	unsigned char buffer[256];
+	int bytesRead;
+	while ((bytesRead = read(mSerial.getFileDescriptor(), buffer, sizeof(buffer))) != 0) {
+		if (bytesRead < 0) {
+			// nothing more to read, unless the device is gone
+			if (errno != EAGAIN && errno != EINTR) closePort();
+			return;
+		}
+		for (int i = 0; i < bytesRead; i++) {
+			if (replyLength == 0 && buffer[i] != TERM_ID_POSITION && buffer[i] != TERM_ID_STATUS) {
+				replyErrors++;
+				continue;
+			}
+			reply[replyLength++] = buffer[i];
+			if (replyLength == MSGS_SIZE) {
+				applyReply(reply);
+				replyLength = 0;
+			}
+		}
+	}
+}
+
+void ReliefSerial::applyReply(const unsigned char *reply) {
+	int boardId = reply[1];
+	if (boardId < 1 || boardId > NUM_ARDUINOS) {
+		replyErrors++;
+		return;
+	}
+	for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+		if (reply[0] == TERM_ID_POSITION) {
+			pinPositions[boardId][j].store(reply[2 + j], std::memory_order_relaxed);
+		} else {
+			pinFaults[boardId][j].store(reply[2 + j], std::memory_order_relaxed);
+		}
+	}
+	if (reply[0] == TERM_ID_POSITION) {
+		feedbackMicros[boardId].store(ofGetElapsedTimeMicros(), std::memory_order_release);
+	}
+	repliesReceived++;
+}
+
+bool ReliefSerial::hasPendingMessages() {
+	if (queueTail.load() != queueHead.load()) return true;
+	for (int i = 0; i < MAILBOX_WORDS; i++) {
+		if (mailboxDirty[i].load()) return true;
+	}
+	return false;
+}
+
+bool ReliefSerial::takeFromQueue(reliefMessage &message) {
+	unsigned int tail = queueTail.load(std::memory_order_relaxed);
+	if (tail == queueHead.load(std::memory_order_acquire)) return false;
+	message = messageQueue[tail & (MESSAGE_QUEUE_CAPACITY - 1)];
+	queueTail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+// take the next dirty mailbox slot at or after the cursor, wrapping around once
+bool ReliefSerial::takeFromMailbox(reliefMessage &message) {
+	int startWord = mailboxCursor / 64;
+	uint64_t atOrAfterCursor = ~0ULL << (mailboxCursor % 64);
+	for (int n = 0; n <= MAILBOX_WORDS; n++) {
+		int word = (startWord + n) % MAILBOX_WORDS;
+		uint64_t dirty = mailboxDirty[word].load(std::memory_order_acquire);
+		if (n == 0) dirty &= atOrAfterCursor;
+		if (n == MAILBOX_WORDS) dirty &= ~atOrAfterCursor;
+		if (!dirty) continue;
+		
+		// clear the bit before reading, so a newer message posted during the read is sent again
+		int bit = __builtin_ctzll(dirty);
+		int slot = word * 64 + bit;
+		mailboxDirty[word].fetch_and(~(1ULL << bit));
+		
+		reliefMailboxSlot &mailboxSlot = mailbox[slot];
+		unsigned int before, after;
+		do {
+			before = mailboxSlot.sequence.load(std::memory_order_acquire);
+			message = mailboxSlot.message;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = mailboxSlot.sequence.load(std::memory_order_relaxed);
+		} while ((before & 1) || before != after);
+		
+		mailboxCursor = (slot + 1) % MAILBOX_SLOTS;
+		return true;
+	}
+	return false;
+}
+
+bool ReliefSerial::postToMailbox(unsigned char messageContent[MSGS_SIZE]) {
+	int termIndex = messageContent[0] - TERM_ID_HEIGHT;
+	int boardId = messageContent[1];
+	if (termIndex < 0 || termIndex >= MAILBOX_NUM_TERM_IDS || boardId > NUM_ARDUINOS) return false;
+	int slot = boardId * MAILBOX_NUM_TERM_IDS + termIndex;
+	
+	// overwrite the slot, bracketed by sequence increments so the writer never sends a torn message
+	reliefMailboxSlot &mailboxSlot = mailbox[slot];
+	mailboxSlot.sequence.fetch_add(1, std::memory_order_acq_rel);
+	for (int i = 0; i < MSGS_SIZE; i++) {
+		mailboxSlot.message.messageContent[i] = messageContent[i];
+	}
+	mailboxSlot.message.length = MSGS_SIZE;
+	mailboxSlot.message.enqueuedMicros = ofGetElapsedTimeMicros();
+	mailboxSlot.sequence.fetch_add(1, std::memory_order_release);
+	
+	uint64_t bit = 1ULL << (slot % 64);
+	if (mailboxDirty[slot / 64].fetch_or(bit) & bit) messagesReplaced++;
+	return true;
+}
+
+
+bool ReliefSerial::writeMessage(unsigned char messageContent[MSGS_SIZE]) {
+	if (!portUp) {
+		messagesDropped++;
+		return false;
+	}
+	
+	// messages the mailbox has no slot for go through the queue
+	if (queueMode == QUEUE_MODE_MAILBOX && postToMailbox(messageContent)) {
+		int depth = getStats().queueDepth;
+		if (depth > maxQueueDepth) maxQueueDepth = depth;
+		if (writerWaiting) wakeWriter();
+		return true;
+	}
+	return queueMessage(messageContent);
+}
+
+bool ReliefSerial::queueMessage(unsigned char messageContent[MSGS_SIZE]) {
+	unsigned int head = queueHead.load(std::memory_order_relaxed);
+	int depth = head - queueTail.load(std::memory_order_acquire);
+	if (depth >= MESSAGE_QUEUE_CAPACITY) {
+		messagesDropped++;
+		return false;
+	}
+	
+	reliefMessage &message = messageQueue[head & (MESSAGE_QUEUE_CAPACITY - 1)];
+	for (int i = 0; i < MSGS_SIZE; i++) {
+		message.messageContent[i] = messageContent[i];
+	}
+	message.length = MSGS_SIZE;
+	message.enqueuedMicros = ofGetElapsedTimeMicros();
+	
+	// sequentially consistent, so that either the writer sees this message before it sleeps
+	// or we see that it is waiting
+	queueHead.store(head + 1);
+	
+	if (depth + 1 > maxQueueDepth) maxQueueDepth = depth + 1;
+	if (writerWaiting) wakeWriter();
+	return true;
+}
+
+bool ReliefSerial::writeTrackedMessage(unsigned char messageContent[MSGS_SIZE], unsigned int &sequence) {
+	if (!portUp) {
+		messagesDropped++;
+		return false;
+	}
+	bool queued = queueMessage(messageContent);
+	sequence = queueHead.load(std::memory_order_relaxed);
+	return queued;
+}
+
+bool ReliefSerial::isFlushed(unsigned int sequence) {
+	return portUp && (int) (writtenSequence.load() - sequence) >= 0 && getOutputBytes() == 0;
+}
+
+bool ReliefSerial::isDrained() {
+	return !portUp || (!writing && !hasPendingMessages() && getOutputBytes() == 0);
+}
+
+// bytes written to the port that the driver has yet to send
+int ReliefSerial::getOutputBytes() {
+	int bytes = 0;
+	ioctl(mSerial.getFileDescriptor(), TIOCOUTQ, &bytes);
+	return bytes;
+}
+
+bool ReliefSerial::writeFrame(const unsigned char *frame, int frameLength) {
+	if (!portUp) {
+		messagesDropped++;
+		return false;
+	}
+	
+	// the frame is split across queue entries, so all of them have to fit
+	int numPieces = (frameLength + MSGS_SIZE - 1) / MSGS_SIZE;
+	unsigned int head = queueHead.load(std::memory_order_relaxed);
+	int depth = head - queueTail.load(std::memory_order_acquire);
+	if (depth + numPieces > MESSAGE_QUEUE_CAPACITY) {
+		messagesDropped++;
+		return false;
+	}
+	
+	unsigned long long now = ofGetElapsedTimeMicros();
+	for (int n = 0; n < numPieces; n++) {
+		reliefMessage &message = messageQueue[(head + n) & (MESSAGE_QUEUE_CAPACITY - 1)];
+		message.length = min(MSGS_SIZE, frameLength - n * MSGS_SIZE);
+		memcpy(message.messageContent, &frame[n * MSGS_SIZE], message.length);
+		message.enqueuedMicros = now;
+	}
+	
+	// publish all pieces at once, as in writeMessage
+	queueHead.store(head + numPieces);
+	
+	if (depth + numPieces > maxQueueDepth) maxQueueDepth = depth + numPieces;
+	if (writerWaiting) wakeWriter();
+	return true;
+}
+
+reliefSerialStats ReliefSerial::getStats() {
+	reliefSerialStats stats;
+	stats.queueDepth = queueHead.load() - queueTail.load();
+	for (int i = 0; i < MAILBOX_WORDS; i++) {
+		stats.queueDepth += __builtin_popcountll(mailboxDirty[i].load());
+	}
+	stats.maxQueueDepth = maxQueueDepth;
+	stats.messagesWritten = messagesWritten;
+	stats.messagesDropped = messagesDropped;
+	stats.messagesReplaced = messagesReplaced;
+	stats.writeCalls = writeCalls;
+	stats.repliesReceived = repliesReceived;
+	stats.replyErrors = replyErrors;
+	stats.lastLatencyMillis = lastLatencyMicros / 1000.0;
+	stats.averageLatencyMillis = averageLatencyMicros / 1000.0;
+	stats.maxLatencyMillis = maxLatencyMicros / 1000.0;
+	stats.portUp = portUp;
+	stats.connections = portConnections;
+	return stats;
+}
+
+void ReliefSerial::resetStats() {
+	maxQueueDepth = 0;
+	messagesWritten = 0;
+	messagesDropped = 0;
+	messagesReplaced = 0;
+	writeCalls = 0;
+	repliesReceived = 0;
+	replyErrors = 0;
+	lastLatencyMicros = 0;
+	averageLatencyMicros = 0;
+	maxLatencyMicros = 0;
 }
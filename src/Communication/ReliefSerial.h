@@ -13,29 +13,197 @@
 #include "ofMain.h"
 #include "ofThread.h"
 #include "Constants.h"
+#include <atomic>
 
 #define MSGS_SIZE 8
+#define MESSAGE_QUEUE_CAPACITY 1024 // must be a power of two
+#define WRITE_BATCH_MESSAGES 64     // most messages coalesced into one write; one frame for a port
+#define PORT_SETTLE_MILLIS 500      // the boards reset when the port opens; wait for them to boot
+#define PORT_RETRY_MILLIS 1000      // time between attempts to open a port that is missing
 
+// one mailbox slot per (board, term id); board 0 addresses all boards. only heights are
+// coalesced: parameters such as max speed go through the queue in order, as a board's max
+// speed sent before a broadcast of it must not be written after it
+#define MAILBOX_NUM_TERM_IDS 1
+#define MAILBOX_SLOTS ((NUM_ARDUINOS + 1) * MAILBOX_NUM_TERM_IDS)
+#define MAILBOX_WORDS ((MAILBOX_SLOTS + 63) / 64)
+
+// v2 frame protocol. all boards on a port that get new heights share one frame:
+//   TERM_ID_FRAME
+//   V2_BOARD_BITMAP_BYTES bytes, 7 bits each: which of the port's boards follow, first board
+//     of the port in bit 0 of the first byte
+//   per board, in board order: one byte with the pins that follow in bits 0-5, and bit 6 set
+//     if they are deltas. then one absolute height per pin, or two deltas per byte, each
+//     stored as delta + 7 with the first pin in the low nibble
+//   a checksum: the sum of all bytes after TERM_ID_FRAME, & 0x7f
+// no byte inside a frame can be 246 or more, so a term id always starts a message or frame.
+// boards keep absolute heights, so every board gets all pins as absolute heights at least
+// every V2_KEYFRAME_FRAMES frames to recover from a frame lost to a checksum error
+#define V2_BOARD_BITMAP_BYTES 5
+#define V2_MAX_BOARDS_PER_FRAME (V2_BOARD_BITMAP_BYTES * 7)
+#define V2_FRAME_OVERHEAD (1 + V2_BOARD_BITMAP_BYTES + 1)
+#define V2_MAX_RECORD_LENGTH (1 + NUM_PINS_ARDUINO)
+#define V2_MAX_FRAME_LENGTH (V2_FRAME_OVERHEAD + V2_MAX_BOARDS_PER_FRAME * V2_MAX_RECORD_LENGTH)
+#define V2_PIN_DELTA_MAX 7
+#define V2_FLAG_DELTAS 0x40
+#define V2_KEYFRAME_FRAMES 120
+#define V2_SPLIT_FRAME_LENGTH 64 // boards only apply a frame once its checksum is in, so keep them short
+
+
+enum ReliefQueueMode {
+	QUEUE_MODE_FIFO,    // every message is written, in order
+	QUEUE_MODE_MAILBOX  // only the newest pending height message per board is written
+};
 
 struct reliefMessage {
     unsigned char messageContent[MSGS_SIZE];
+    unsigned char length; // MSGS_SIZE, or less for the last piece of a frame
+    unsigned long long enqueuedMicros;
+};
+
+// pin faults reported by the boards in TERM_ID_STATUS replies
+#define PIN_FAULT_STALLED 0x01     // the pin stopped short of its target
+#define PIN_FAULT_OVERCURRENT 0x02 // the motor driver cut out
+#define PIN_FAULT_SENSOR 0x04      // the position reading is out of range
+
+struct reliefMailboxSlot {
+	std::atomic<unsigned int> sequence; // odd while the slot is being written
+	reliefMessage message;
+};
+
+// queue health, readable from any thread
+struct reliefSerialStats {
+	int queueDepth;                     // messages waiting to be written
+	int maxQueueDepth;                  // deepest the queue has been
+	unsigned long long messagesWritten;
+	unsigned long long messagesDropped; // messages refused because the queue was full, or lost to a port error
+	unsigned long long messagesReplaced; // mailbox messages superseded before being written
+	unsigned long long writeCalls;      // writes issued to the port, each carrying a batch of messages
+	float lastLatencyMillis;            // time from enqueue to write of the last message
+	float averageLatencyMillis;         // moving average of the same
+	float maxLatencyMillis;
+	unsigned long long repliesReceived; // position and status replies from the boards
+	unsigned long long replyErrors;     // bytes skipped to find the start of a reply
+	bool portUp;                        // open, with the boards booted; messages are dropped otherwise
+	int connections;                    // times the port was opened, so counts reconnects
+};
+
+// ofSerial keeps its file descriptor to itself; the writer needs it to wait on the port
+class ReliefSerialPort: public ofSerial {
+public:
+	int getFileDescriptor() { return fd; }
 };
 
 class ReliefSerial: public ofThread{
 private:
-	ofSerial mSerial;
+	ReliefSerialPort mSerial;
+	string mPortName;
+	int mBaudrate;
     
 	void start();
 	void stop();
 	void threadedFunction();
-        
-    vector<reliefMessage> messageBuffer;
+	string findDevicePath();
+	bool openPort();
+	void closePort();
+	void dropPendingMessages();
+	void waitForWake(int millis);
+	void waitForPort(bool needRoom);
+	void wakeWriter();
+	void readReplies();
+	void applyReply(const unsigned char *reply);
+	void recordLatencies(int numMessages);
+	bool hasPendingMessages();
+	bool takeFromQueue(reliefMessage &message);
+	bool takeFromMailbox(reliefMessage &message);
+	bool postToMailbox(unsigned char messageContent[MSGS_SIZE]);
+	bool queueMessage(unsigned char messageContent[MSGS_SIZE]);
+	int getOutputBytes();
+
+	// single-producer/single-consumer ring. the caller of writeMessage owns head, the
+	// writer thread owns tail; the writer only sleeps when nothing is pending, in a poll()
+	// on the port and on wakePipe, which writeMessage writes to when writerWaiting
+	reliefMessage messageQueue[MESSAGE_QUEUE_CAPACITY];
+	std::atomic<unsigned int> queueHead;
+	std::atomic<unsigned int> queueTail;
+	std::atomic<bool> writerWaiting;
+	int wakePipe[2];
+
+	// last-write-wins mailbox. the writer scans the dirty bitmap round-robin from
+	// mailboxCursor, so every dirty slot is written within one pass over the bus
+	std::atomic<ReliefQueueMode> queueMode;
+	reliefMailboxSlot mailbox[MAILBOX_SLOTS];
+	std::atomic<uint64_t> mailboxDirty[MAILBOX_WORDS];
+	int mailboxCursor;
+
+	// pending messages are gathered here and written with as few writes as the port allows
+	reliefMessage writeBatchMessages[WRITE_BATCH_MESSAGES];
+	unsigned char writeBatchBytes[WRITE_BATCH_MESSAGES * MSGS_SIZE];
+	
+	// queue positions double as sequence numbers: the message queued at head h is number h + 1.
+	// writtenSequence is the last queued message handed to the port in full, writing is set
+	// while the writer holds a batch
+	std::atomic<unsigned int> writtenSequence;
+	std::atomic<bool> writing;
+	
+	// board replies, parsed by the writer thread between writes. every entry is written by
+	// that thread only and read without locking, one atomic at a time
+	unsigned char reply[MSGS_SIZE];
+	int replyLength;
+	std::atomic<unsigned char> pinPositions[NUM_ARDUINOS + 1][NUM_PINS_ARDUINO];
+	std::atomic<unsigned char> pinFaults[NUM_ARDUINOS + 1][NUM_PINS_ARDUINO];
+	std::atomic<unsigned long long> feedbackMicros[NUM_ARDUINOS + 1]; // 0 until a board replies
+
+	// the writer thread opens the port, and whenever it fails closes it and opens it again.
+	// while it is down, writeMessage and writeFrame drop messages instead of queueing them
+	std::atomic<bool> portUp;
+	std::atomic<bool> portMissing; // the last attempt to open the port found no device
+	std::atomic<int> portConnections;
+	
+	std::atomic<int> maxQueueDepth;
+	std::atomic<unsigned long long> messagesWritten;
+	std::atomic<unsigned long long> messagesDropped;
+	std::atomic<unsigned long long> messagesReplaced;
+	std::atomic<unsigned long long> writeCalls;
+	std::atomic<int> lastLatencyMicros;
+	std::atomic<int> averageLatencyMicros;
+	std::atomic<int> maxLatencyMicros;
+	std::atomic<unsigned long long> repliesReceived;
+	std::atomic<unsigned long long> replyErrors;
 	
 public:
+	// pPortName is a device path, or the serial number of a usb serial adapter to look for
+	// among the serial devices. the port is opened in the background, so this returns at once
 	ReliefSerial(string pPortName, int pBaudrate);
 	~ReliefSerial();
     
-    void writeMessage(unsigned char messageContent[MSGS_SIZE]);
+	// queue a message for writing; returns false if the queue is full. only one thread may
+	// write messages to a given connection
+	bool writeMessage(unsigned char messageContent[MSGS_SIZE]);
+	// queue a variable length frame; it is written whole and in order with other queued
+	// messages, never coalesced by the mailbox. returns false if it doesn't fit
+	bool writeFrame(const unsigned char *frame, int frameLength);
+	// queue a message in order, past the mailbox, and get its sequence number for isFlushed
+	bool writeTrackedMessage(unsigned char messageContent[MSGS_SIZE], unsigned int &sequence);
+	// has the message with this sequence number, and everything before it, left the port?
+	bool isFlushed(unsigned int sequence);
+	// is nothing waiting to be written or on its way out? a port that is down counts as drained
+	bool isDrained();
+	void setQueueMode(ReliefQueueMode mode) { queueMode = mode; }
+	ReliefQueueMode getQueueMode() { return queueMode; }
+	reliefSerialStats getStats();
+	bool isPortUp() { return portUp; }
+	// is the port down for want of a device, rather than still opening? false until the writer
+	// has first looked for the device
+	bool isPortMissing() { return !portUp && portMissing; }
+	int getConnections() { return portConnections; }
+	void resetStats();
+	
+	// the latest pin positions and faults the boards reported, in wire units, by board id.
+	// lock-free, so safe to call from the render thread
+	unsigned char getPinPosition(int boardId, int pin) { return pinPositions[boardId][pin].load(std::memory_order_relaxed); }
+	unsigned char getPinFaults(int boardId, int pin) { return pinFaults[boardId][pin].load(std::memory_order_relaxed); }
+	unsigned long long getFeedbackMicros(int boardId) { return feedbackMicros[boardId].load(std::memory_order_acquire); }
 };
 
-#endif
\ No newline at end of file
+#endif
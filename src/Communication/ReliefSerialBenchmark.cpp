@@ -0,0 +1,180 @@
+/*
+ *  ReliefSerialBenchmark.cpp
+ *  Relief
+ *
+ */
+
+#include "ReliefSerialBenchmark.h"
+#include <unistd.h>
+
+ReliefSerialBenchmark::ReliefSerialBenchmark() {
+	running = false;
+	numResults = 0;
+	memset(results, 0, sizeof(results));
+}
+
+ReliefSerialBenchmark::~ReliefSerialBenchmark() {
+	stopThread();
+	waitForThread(false);
+}
+
+void ReliefSerialBenchmark::start(int frameRate, float seconds) {
+	lock();
+	if (running) {
+		unlock();
+		return;
+	}
+	running = true;
+	numResults = 0;
+	unlock();
+
+	// collect the thread of the previous run before starting a new one
+	waitForThread(false);
+	this->frameRate = frameRate;
+	this->seconds = seconds;
+	startThread(true, false);   // blocking, not verbose
+}
+
+bool ReliefSerialBenchmark::isRunning() {
+	lock();
+	bool isRunning = running;
+	unlock();
+	return isRunning;
+}
+
+int ReliefSerialBenchmark::getNumResults() {
+	lock();
+	int n = numResults;
+	unlock();
+	return n;
+}
+
+reliefSerialBenchmarkResult ReliefSerialBenchmark::getResult(int n) {
+	lock();
+	reliefSerialBenchmarkResult lastResult = results[n];
+	unlock();
+	return lastResult;
+}
+
+string ReliefSerialBenchmark::getSummary(int n) {
+	reliefSerialBenchmarkResult lastResult = getResult(n);
+	return ofToString(lastResult.baudRate) + " baud, " + ofToString(lastResult.frames) + " frames: " +
+		ofToString(lastResult.writesPerFrame, 2) + " writes/frame per port, " +
+		ofToString(lastResult.messagesWritten) + " of " + ofToString(lastResult.messagesQueued) + " messages written (" +
+		ofToString(lastResult.messagesReplaced) + " replaced, " + ofToString(lastResult.messagesDropped) + " dropped), " +
+		ofToString(lastResult.messagesReceived) + " received, " + ofToString(lastResult.messagesLate) + " late, " +
+		ofToString(lastResult.kilobytesPerSecond, 1) + " KB/s, " + ofToString(lastResult.averageLatencyMillis, 2) + " ms to write";
+}
+
+void ReliefSerialBenchmark::threadedFunction() {
+	int baudRates[BENCHMARK_NUM_BAUD_RATES] = BENCHMARK_BAUD_RATES;
+	for (int n = 0; n < BENCHMARK_NUM_BAUD_RATES && isThreadRunning(); n++) {
+		reliefSerialBenchmarkResult runResult = runAtBaudRate(baudRates[n]);
+		if (!isThreadRunning()) break; // cut short; its counts mean nothing
+		lock();
+		results[n] = runResult;
+		numResults = n + 1;
+		unlock();
+		ofLog(OF_LOG_NOTICE, "ReliefSerialBenchmark: " + getSummary(n));
+	}
+
+	lock();
+	running = false;
+	unlock();
+}
+
+// one run against a fresh emulated table and fresh connections at this baud rate
+reliefSerialBenchmarkResult ReliefSerialBenchmark::runAtBaudRate(int baudRate) {
+	ReliefBusEmulator emulator(baudRate);
+	ReliefSerial *connections[NUM_SERIAL_CONNECTIONS];
+	for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+		connections[i] = new ReliefSerial(emulator.getPortName(i), baudRate);
+		connections[i]->setQueueMode(QUEUE_MODE_MAILBOX);
+	}
+
+	// the ports open in the background, and the boards boot once they do
+	unsigned long long settleStartMicros = ofGetElapsedTimeMicros();
+	bool portsUp = false;
+	while (!portsUp && isThreadRunning() && ofGetElapsedTimeMicros() - settleStartMicros < BENCHMARK_SETTLE_MILLIS * 1000ULL) {
+		ofSleepMillis(10);
+		portsUp = true;
+		for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+			if (!connections[i]->isPortUp()) portsUp = false;
+		}
+	}
+	if (!portsUp) {
+		ofLog(OF_LOG_ERROR, "ReliefSerialBenchmark: not every emulated port opened; the results count what reached the others");
+	}
+	for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+		connections[i]->resetStats();
+	}
+	emulator.resetStats();
+
+	// every board gets new heights every frame, at the frame rate
+	int firstBoardIds[NUM_SERIAL_CONNECTIONS + 1] = {SERIAL_PORT_0_FIRST_ID, SERIAL_PORT_1_FIRST_ID,
+		SERIAL_PORT_2_FIRST_ID, SERIAL_PORT_3_FIRST_ID, SERIAL_PORT_4_FIRST_ID, NUM_ARDUINOS + 1};
+	int numFrames = seconds * frameRate;
+	unsigned long long messagesQueued = 0;
+	unsigned long long startMicros = ofGetElapsedTimeMicros();
+	int frame = 0;
+	for (; frame < numFrames && isThreadRunning(); frame++) {
+		for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+			for (int boardId = firstBoardIds[i]; boardId < firstBoardIds[i + 1]; boardId++) {
+				unsigned char messageContent[MSGS_SIZE];
+				messageContent[0] = TERM_ID_HEIGHT;
+				messageContent[1] = boardId;
+				for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+					messageContent[j + 2] = (frame + boardId + j * 16) % 200;
+				}
+				if (connections[i]->writeMessage(messageContent)) messagesQueued++;
+			}
+		}
+
+		long long remainingMicros = startMicros + (frame + 1) * 1000000ULL / frameRate - ofGetElapsedTimeMicros();
+		if (remainingMicros > 0) usleep(remainingMicros);
+	}
+
+	// let the writers and the emulated line catch up before counting
+	unsigned long long drainStartMicros = ofGetElapsedTimeMicros();
+	bool drained = false;
+	while (!drained && isThreadRunning() && ofGetElapsedTimeMicros() - drainStartMicros < BENCHMARK_SETTLE_MILLIS * 1000ULL) {
+		ofSleepMillis(10);
+		drained = true;
+		for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+			if (!connections[i]->isDrained()) drained = false;
+		}
+	}
+	float elapsedSeconds = (ofGetElapsedTimeMicros() - startMicros) / 1000000.0;
+
+	// written bytes can still sit in the pseudo-terminals; wait until the emulated boards stop
+	// receiving them
+	unsigned long long messagesReceived = emulator.getStats().messagesReceived;
+	while (isThreadRunning() && ofGetElapsedTimeMicros() - drainStartMicros < BENCHMARK_SETTLE_MILLIS * 1000ULL) {
+		ofSleepMillis(100);
+		unsigned long long nowReceived = emulator.getStats().messagesReceived;
+		if (nowReceived == messagesReceived) break;
+		messagesReceived = nowReceived;
+	}
+
+	reliefSerialBenchmarkResult runResult;
+	memset(&runResult, 0, sizeof(runResult));
+	runResult.baudRate = baudRate;
+	runResult.frames = frame;
+	runResult.messagesQueued = messagesQueued;
+	unsigned long long writeCalls = 0;
+	for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+		reliefSerialStats stats = connections[i]->getStats();
+		writeCalls += stats.writeCalls;
+		runResult.messagesWritten += stats.messagesWritten;
+		runResult.messagesReplaced += stats.messagesReplaced;
+		runResult.messagesDropped += stats.messagesDropped;
+		runResult.averageLatencyMillis = max(runResult.averageLatencyMillis, stats.averageLatencyMillis);
+		delete connections[i];
+	}
+	reliefBusStats busStats = emulator.getStats();
+	runResult.messagesReceived = busStats.messagesReceived;
+	runResult.messagesLate = busStats.messagesLate;
+	runResult.writesPerFrame = frame > 0 ? (float) writeCalls / frame / NUM_SERIAL_CONNECTIONS : 0;
+	runResult.kilobytesPerSecond = runResult.messagesWritten * MSGS_SIZE / elapsedSeconds / 1024;
+	return runResult;
+}
@@ -0,0 +1,67 @@
+/*
+ *  ReliefSerialBenchmark.h
+ *  Relief
+ *
+ *  Measures what the serial writers cost per frame. streams changing heights for every
+ *  board, one message per board per frame, through a ReliefSerial per connection in mailbox
+ *  mode to an emulated table that reads at the baud rate, then reports how many writes the
+ *  ports took per frame and how many messages made it, once at each of the
+ *  BENCHMARK_BAUD_RATES. runs on its own thread against its own emulator, so it can run
+ *  beside the application; start() returns at once.
+ *
+ */
+
+#ifndef _RELIEF_SERIAL_BENCHMARK
+#define _RELIEF_SERIAL_BENCHMARK
+
+#include "ofMain.h"
+#include "ofThread.h"
+#include "Constants.h"
+#include "ReliefSerial.h"
+#include "ReliefBusEmulator.h"
+
+#define BENCHMARK_FRAME_RATE 60
+#define BENCHMARK_SECONDS 10 // at each baud rate
+#define BENCHMARK_NUM_BAUD_RATES 4
+#define BENCHMARK_BAUD_RATES {115200, 230400, 460800, 921600}
+#define BENCHMARK_SETTLE_MILLIS 5000 // most time to wait for the ports to open, and to drain
+
+
+struct reliefSerialBenchmarkResult {
+	int baudRate;
+	int frames;
+	float writesPerFrame;               // writes issued to a port per frame, averaged over the ports
+	unsigned long long messagesQueued;
+	unsigned long long messagesWritten;
+	unsigned long long messagesReplaced; // superseded in the mailbox before being written
+	unsigned long long messagesDropped;  // refused by a full queue, or lost to a port error
+	unsigned long long messagesReceived; // decoded by the emulated boards
+	unsigned long long messagesLate;
+	float averageLatencyMillis;         // enqueue to write, on the slowest port
+	float kilobytesPerSecond;           // written, over all ports
+};
+
+class ReliefSerialBenchmark: public ofThread {
+private:
+	void threadedFunction();
+	reliefSerialBenchmarkResult runAtBaudRate(int baudRate);
+
+	int frameRate;
+	float seconds;
+	bool running;   // set from start() until the run ends; guarded by the thread lock
+	int numResults; // baud rates done so far; guarded by the thread lock, as are results
+	reliefSerialBenchmarkResult results[BENCHMARK_NUM_BAUD_RATES];
+
+public:
+	ReliefSerialBenchmark();
+	~ReliefSerialBenchmark();
+
+	// does nothing while a run is in progress. results from the previous run are cleared
+	void start(int frameRate=BENCHMARK_FRAME_RATE, float seconds=BENCHMARK_SECONDS);
+	bool isRunning();
+	int getNumResults(); // baud rates measured so far, in BENCHMARK_BAUD_RATES order
+	reliefSerialBenchmarkResult getResult(int n);
+	string getSummary(int n); // one line describing a result
+};
+
+#endif
@@ -41,6 +41,9 @@
 #define TERM_ID_DEADZONE (unsigned char)250
 #define TERM_ID_GRAVITYCOMP (unsigned char)251
 #define TERM_ID_MAXSPEED (unsigned char)252
+#define TERM_ID_FRAME (unsigned char)253 // several boards' heights in one frame, see ReliefSerial.h
+#define TERM_ID_POSITION (unsigned char)254 // board reply: pin positions
+#define TERM_ID_STATUS (unsigned char)255 // board reply: pin fault flags
 
 #define BASE_HEIGHT 70
 #define MAX_HEIGHT 245
@@ -52,19 +55,29 @@
 #define NUM_PINS_ARDUINO 6
 
 
-//#define SERIAL_PORT_0 "/dev/tty.usbserial-A101NU5I"
-#define SERIAL_PORT_0 "/dev/tty.usbserial-A4011F1E"
+// the usb serial adapter on each connection, by serial number (or a device path).
+// SERIAL_PORT_SETTINGS overrides these
+//#define SERIAL_PORT_0 "A101NU5I"
+#define SERIAL_PORT_0 "A4011F1E"
 #define SERIAL_PORT_0_FIRST_ID 1
-#define SERIAL_PORT_1 "/dev/tty.usbserial-A101NU5H"
+#define SERIAL_PORT_1 "A101NU5H"
 #define SERIAL_PORT_1_FIRST_ID 29
-#define SERIAL_PORT_2 "/dev/tty.usbserial-A101NU5G"
+#define SERIAL_PORT_2 "A101NU5G"
 #define SERIAL_PORT_2_FIRST_ID 61
-#define SERIAL_PORT_3 "/dev/tty.usbserial-A101NU5F"
+#define SERIAL_PORT_3 "A101NU5F"
 #define SERIAL_PORT_3_FIRST_ID 91
-#define SERIAL_PORT_4 "/dev/tty.usbserial-A101NUAR"
+#define SERIAL_PORT_4 "A101NUAR"
 #define SERIAL_PORT_4_FIRST_ID 121
+#define SERIAL_PORT_SETTINGS "serialPortSettings.xml"
 #define SERIAL_BAUD_RATE 115200
 
+// heights sent to the table per second, whatever the render frame rate. 0 sends them from
+// update() instead
+#define PIN_OUTPUT_RATE 60
+
+// 1: talk to an emulated table on pseudo-terminals instead of the serial ports above
+#define EMULATE_RELIEF_BUS 0
+
 //#define ARDUINO_GAIN_P 150
 //#define ARDUINO_GAIN_I 35
 //#define ARDUINO_MAX_I  60
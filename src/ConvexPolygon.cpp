@@ -0,0 +1,244 @@
+//
+//  ConvexPolygon.cpp
+//  Relief2
+//
+//
+
+#include "ConvexPolygon.h"
+
+
+const float geometryEpsilon = 1e-5;
+
+ConvexPolygon::ConvexPolygon(vector<ofPoint> &points) {
+    vertices = points;
+    if (signedArea() < 0) {
+        std::reverse(vertices.begin(), vertices.end());
+    }
+}
+
+ConvexPolygon::ConvexPolygon(Rectangle &rect) {
+    vertices.push_back(ofPoint(rect.left, rect.top));
+    vertices.push_back(ofPoint(rect.left + rect.width, rect.top));
+    vertices.push_back(ofPoint(rect.left + rect.width, rect.top + rect.height));
+    vertices.push_back(ofPoint(rect.left, rect.top + rect.height));
+    if (signedArea() < 0) {
+        std::reverse(vertices.begin(), vertices.end());
+    }
+}
+
+ConvexPolygon ConvexPolygon::fromCubeReferenceFrame(Rectangle &rect, Cube &cube, float lengthScale) {
+    ConvexPolygon polygon(rect);
+    for (int i = 0; i < polygon.vertices.size(); i++) {
+        cube.transformPointFromCubeReferenceFrame(&polygon.vertices[i], &polygon.vertices[i], lengthScale);
+    }
+    return polygon;
+}
+
+// shoelace formula; positive for vertices ordered clockwise on screen
+float ConvexPolygon::signedArea() {
+    float sum = 0;
+    int n = vertices.size();
+    for (int i = 0, j = n - 1; i < n; j = i++) {
+        sum += vertices[j].x * vertices[i].y - vertices[i].x * vertices[j].y;
+    }
+    return 0.5 * sum;
+}
+
+float ConvexPolygon::area() {
+    return max(0.0f, signedArea());
+}
+
+ofPoint ConvexPolygon::centroid() {
+    float sum = 0;
+    ofPoint weighted(0, 0);
+    int n = vertices.size();
+    for (int i = 0, j = n - 1; i < n; j = i++) {
+        float cross = vertices[j].x * vertices[i].y - vertices[i].x * vertices[j].y;
+        sum += cross;
+        weighted.x += (vertices[j].x + vertices[i].x) * cross;
+        weighted.y += (vertices[j].y + vertices[i].y) * cross;
+    }
+    if (sum == 0) {
+        return vertices.empty() ? ofPoint(0, 0) : vertices[0];
+    }
+    return weighted / (3 * sum);
+}
+
+bool ConvexPolygon::containsPoint(ofPoint &point) {
+    int n = vertices.size();
+    if (n < 3) {
+        return false;
+    }
+    for (int i = 0, j = n - 1; i < n; j = i++) {
+        ofPoint edge = vertices[i] - vertices[j];
+        ofPoint offset = point - vertices[j];
+        if (edge.x * offset.y - edge.y * offset.x < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// clip this polygon against each edge of the other (Sutherland-Hodgman). convex inputs give
+// a convex result
+ConvexPolygon ConvexPolygon::intersection(ConvexPolygon &other) {
+    ConvexPolygon result;
+    result.vertices = vertices;
+    int m = other.vertices.size();
+    for (int e = 0, f = m - 1; e < m && result.vertices.size() >= 3; f = e++) {
+        ofPoint &a = other.vertices[f];
+        ofPoint edge = other.vertices[e] - a;
+
+        vector<ofPoint> input;
+        input.swap(result.vertices);
+        int n = input.size();
+        for (int i = 0, j = n - 1; i < n; j = i++) {
+            ofPoint &p = input[j];
+            ofPoint &q = input[i];
+            float sideP = edge.x * (p.y - a.y) - edge.y * (p.x - a.x);
+            float sideQ = edge.x * (q.y - a.y) - edge.y * (q.x - a.x);
+            if (sideQ >= 0) {
+                if (sideP < 0) {
+                    result.vertices.push_back(p + (q - p) * (sideP / (sideP - sideQ)));
+                }
+                result.vertices.push_back(q);
+            } else if (sideP >= 0) {
+                result.vertices.push_back(p + (q - p) * (sideP / (sideP - sideQ)));
+            }
+        }
+    }
+    if (result.vertices.size() < 3) {
+        result.vertices.clear();
+    }
+    return result;
+}
+
+ConvexPolygon intersectionOfPolygons(vector<ConvexPolygon> &polygons) {
+    if (polygons.empty()) {
+        return ConvexPolygon();
+    }
+    ConvexPolygon result = polygons[0];
+    for (int i = 1; i < polygons.size() && !result.isEmpty(); i++) {
+        result = result.intersection(polygons[i]);
+    }
+    return result;
+}
+
+float areaOfIntersection(vector<ConvexPolygon> &polygons, ofPoint *centroid) {
+    ConvexPolygon region = intersectionOfPolygons(polygons);
+    float area = region.area();
+    if (centroid && area > 0) {
+        *centroid = region.centroid();
+    }
+    return area;
+}
+
+// find the parameter interval [enter, exit] of segment a->b lying inside a convex polygon
+// (Cyrus-Beck). edges running along the polygon's boundary in the same direction count as
+// inside only if sharedEdgesInside is set, so a shared boundary is counted exactly once
+static bool segmentInsidePolygon(ofPoint &a, ofPoint &b, ConvexPolygon &polygon, bool sharedEdgesInside, float &enter, float &exit) {
+    enter = 0;
+    exit = 1;
+    ofPoint direction = b - a;
+    int n = polygon.vertices.size();
+    if (n < 3) {
+        return false;
+    }
+    for (int i = 0, j = n - 1; i < n; j = i++) {
+        ofPoint &v = polygon.vertices[j];
+        ofPoint edge = polygon.vertices[i] - v;
+        float scale = max(geometryEpsilon, edge.length());
+
+        // distances inward from this edge of the segment's start and of its direction
+        float inside = (edge.x * (a.y - v.y) - edge.y * (a.x - v.x)) / scale;
+        float rate = (edge.x * direction.y - edge.y * direction.x) / scale;
+
+        if (fabs(rate) < geometryEpsilon) {
+            if (inside < -geometryEpsilon) {
+                return false;
+            }
+            if (inside < geometryEpsilon) {
+                bool sameDirection = edge.x * direction.x + edge.y * direction.y > 0;
+                if (!(sameDirection && sharedEdgesInside)) {
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        float t = -inside / rate;
+        if (rate > 0) {
+            enter = max(enter, t);
+        } else {
+            exit = min(exit, t);
+        }
+        if (enter >= exit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// by Green's theorem, a region's area and centroid follow from its boundary alone. the
+// union's boundary is every polygon edge except the parts inside other polygons
+float areaOfUnion(vector<ConvexPolygon> &polygons, ofPoint *centroid) {
+    float sum = 0;
+    ofPoint weighted(0, 0);
+    vector<pair<float, float> > hidden;
+
+    for (int i = 0; i < polygons.size(); i++) {
+        vector<ofPoint> &vertices = polygons[i].vertices;
+        int n = vertices.size();
+        if (n < 3) {
+            continue;
+        }
+        for (int e = 0, f = n - 1; e < n; f = e++) {
+            ofPoint &a = vertices[f];
+            ofPoint &b = vertices[e];
+
+            // collect the parts of this edge covered by other polygons
+            hidden.clear();
+            for (int k = 0; k < polygons.size(); k++) {
+                float enter, exit;
+                if (k != i && segmentInsidePolygon(a, b, polygons[k], k < i, enter, exit)) {
+                    hidden.push_back(pair<float, float>(enter, exit));
+                }
+            }
+            std::sort(hidden.begin(), hidden.end());
+
+            // integrate over the visible parts
+            float t = 0;
+            for (int h = 0; h <= hidden.size(); h++) {
+                float end = (h < hidden.size()) ? hidden[h].first : 1;
+                if (end > t) {
+                    ofPoint p = a + (b - a) * t;
+                    ofPoint q = a + (b - a) * end;
+                    float cross = p.x * q.y - q.x * p.y;
+                    sum += cross;
+                    weighted.x += (p.x + q.x) * cross;
+                    weighted.y += (p.y + q.y) * cross;
+                }
+                if (h < hidden.size()) {
+                    t = max(t, hidden[h].second);
+                }
+            }
+        }
+    }
+
+    float area = 0.5 * sum;
+    if (centroid && area > 0) {
+        *centroid = weighted / (3 * sum);
+    }
+    return max(0.0f, area);
+}
+
+float areaOfSymmetricDifference(vector<ConvexPolygon> &polygons, ofPoint *centroid) {
+    ofPoint unionCentroid, intersectionCentroid;
+    float unionArea = areaOfUnion(polygons, &unionCentroid);
+    float intersectionArea = areaOfIntersection(polygons, &intersectionCentroid);
+    float area = unionArea - intersectionArea;
+    if (centroid && area > 0) {
+        *centroid = (unionCentroid * unionArea - intersectionCentroid * intersectionArea) / area;
+    }
+    return max(0.0f, area);
+}
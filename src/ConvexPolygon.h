@@ -0,0 +1,50 @@
+//
+//  ConvexPolygon.h
+//  Relief2
+//
+//
+
+#ifndef __Relief2__ConvexPolygon__
+#define __Relief2__ConvexPolygon__
+
+#include "ofMain.h"
+#include "Rectangle.h"
+#include "Cube.h"
+
+
+// convex polygon geometry for cube swords and footprints. intersections, areas and centroids
+// are computed exactly from vertices, so boolean combinations of swords never need to be
+// rendered and read back to be measured.
+//
+// vertices are kept in positive-area order in image coordinates (+y down).
+
+class ConvexPolygon {
+public:
+    ConvexPolygon() {};
+    ConvexPolygon(vector<ofPoint> &points);
+    ConvexPolygon(Rectangle &rect);
+
+    // the given rectangle, expressed in a cube's reference frame, in absolute coordinates
+    static ConvexPolygon fromCubeReferenceFrame(Rectangle &rect, Cube &cube, float lengthScale=1.0);
+
+    bool isEmpty() { return vertices.size() < 3 || area() <= 0; }
+    float area();
+    ofPoint centroid();
+    bool containsPoint(ofPoint &point);
+    ConvexPolygon intersection(ConvexPolygon &other);
+
+    vector<ofPoint> vertices;
+
+private:
+    float signedArea();
+};
+
+
+// region measurements for collections of convex polygons. each function returns the region's
+// area and writes its centroid to centroid (left untouched if the area is zero)
+ConvexPolygon intersectionOfPolygons(vector<ConvexPolygon> &polygons);
+float areaOfUnion(vector<ConvexPolygon> &polygons, ofPoint *centroid=NULL);
+float areaOfIntersection(vector<ConvexPolygon> &polygons, ofPoint *centroid=NULL);
+float areaOfSymmetricDifference(vector<ConvexPolygon> &polygons, ofPoint *centroid=NULL); // union minus intersection
+
+#endif /* defined(__Relief2__ConvexPolygon__) */
@@ -21,6 +21,25 @@
 // Note that this coordinate system is left-handed! Be careful when rotating.
 
 
+// blobs whose second-order moments are at least this anisotropic are oriented by their
+// principal axis; more square blobs fall back to the 4-fold fourth-order moment
+const float elongatedBlobAnisotropy = 0.2;
+
+// contour points this close (as a fraction of the half-extents) to two sides at once are
+// corner points and are ignored when fitting edge lines
+const float edgeFittingCornerZone = 0.75;
+
+// minimum contour length (in pixels) a side needs before its fitted line is trusted
+const float edgeFittingMinimumSideLength = 3;
+
+// hysteresis thresholds for propagating candidate updates. moment-based poses jitter far
+// less than min-area rectangles, so they can use tighter thresholds
+const float centerUpdateThreshold = 0.5 * pinSize;
+const float thetaUpdateThreshold = 10;
+const float momentPoseCenterUpdateThreshold = 0.25 * pinSize;
+const float momentPoseThetaUpdateThreshold = 4;
+
+
 // Constructors
 
 Cube::Cube() :
@@ -67,6 +86,11 @@ bool Cube::isValid() {
 
 // Setters
 
+void Cube::setTableFrame(TableFrame *_tableFrame, ofPoint _roiOrigin) {
+    tableFrame = _tableFrame;
+    roiOrigin = _roiOrigin;
+}
+
 void Cube::setBlob(Blob *_blob, bool _update) {
     candidateUpdates.blob = _blob;
     if (_update) {
@@ -105,17 +129,52 @@ void Cube::calculateCandidateUpdates() {
     // locally use a shorthand alias for the candidate updates object
     CubeUpdatesBuffer &cand = candidateUpdates;
 
-    // a blob's angleBoundingRect height and width variables are flipped. furthermore, blob
-    // units are scaled by the size of the image they were found in. fix these mistakes.
-    cand.normalizationVector.set(1.0 / cand.blob->widthScale, 1.0 / cand.blob->heightScale);
-    cand.width = cand.blob->angleBoundingRect.height * cand.normalizationVector.x;
-    cand.height = cand.blob->angleBoundingRect.width * cand.normalizationVector.y;
-    cand.center.set(cand.blob->angleBoundingRect.x, cand.blob->angleBoundingRect.y);
-    cand.center *= cand.normalizationVector;
+    // estimate the blob's pose in image pixels. range is 0 <= rawTheta < 90; raw theta does
+    // not take cube orientation into account
+    ofPoint poseCenter;
+    float poseWidth, poseHeight;
+    if (useMomentPoseEstimation && estimatePoseFromMoments(*cand.blob, poseCenter, poseWidth, poseHeight, cand.rawTheta)) {
+        if (refinePoseByEdgeFitting) {
+            refinePoseWithEdgeLines(*cand.blob, poseCenter, poseWidth, poseHeight, cand.rawTheta);
+        }
+    } else {
+        // a blob's angleBoundingRect height and width variables are flipped, and its angle
+        // measures clockwise. fix these mistakes.
+        poseWidth = cand.blob->angleBoundingRect.height;
+        poseHeight = cand.blob->angleBoundingRect.width;
+        poseCenter.set(cand.blob->angleBoundingRect.x, cand.blob->angleBoundingRect.y);
+        cand.rawTheta = -cand.blob->angle;
+    }
+    cand.rawThetaRadians = cand.rawTheta * pi / 180;
+
+    // normalize blob units. blobs found in camera roi pixels are mapped onto the table through the
+    // table frame, which is close to affine across a cube, so lengths scale by its local stretch.
+    // other blobs are scaled by the size of the image they were found in
+    ofPoint normalizedMarker;
+    if (tableFrame) {
+        ofPoint center = poseCenter + roiOrigin;
+        ofPoint stepX = center + ofPoint(1, 0);
+        ofPoint stepY = center + ofPoint(0, 1);
+        tableFrame->cameraToTable(center);
+        tableFrame->cameraToTable(stepX);
+        tableFrame->cameraToTable(stepY);
+        cand.normalizationVector.set(stepX.distance(center), stepY.distance(center));
+        cand.center = center;
+        if (cand.hasMarker) {
+            normalizedMarker = cand.rawMarker + roiOrigin;
+            tableFrame->cameraToTable(normalizedMarker);
+        }
+    } else {
+        cand.normalizationVector.set(1.0 / cand.blob->widthScale, 1.0 / cand.blob->heightScale);
+        cand.center = poseCenter * cand.normalizationVector;
+        normalizedMarker = cand.rawMarker * cand.normalizationVector;
+    }
+    cand.width = poseWidth * cand.normalizationVector.x;
+    cand.height = poseHeight * cand.normalizationVector.y;
 
     // normalized marker position relative to center
     if (cand.hasMarker) {
-        cand.marker = cand.rawMarker * cand.normalizationVector - cand.center;
+        cand.marker = normalizedMarker - cand.center;
     }
 
     // the camera sees a cube's front corners on the ground and rear corners in the air, making
@@ -127,10 +186,6 @@ void Cube::calculateCandidateUpdates() {
     reprojectColorCameraCoordinateFromHeight(cand.center, doublyCorrectedCenter);
     cand.center = (cand.center + doublyCorrectedCenter) / 2;
 
-    // range is 0 <= rawTheta < 90; raw theta does not take cube orientation into account
-    cand.rawTheta = -cand.blob->angle;
-    cand.rawThetaRadians = cand.rawTheta * pi / 180;
-
     // relative corner coordinates using raw theta value
     cand.rawCorners[0].x = -cand.width/2 * cos(cand.rawThetaRadians) - cand.height/2 * sin(cand.rawThetaRadians);
     cand.rawCorners[0].y = cand.width/2 * sin(cand.rawThetaRadians) - cand.height/2 * cos(cand.rawThetaRadians);
@@ -174,6 +229,150 @@ void Cube::calculateCandidateUpdates() {
     }
 }
 
+// estimate a blob's center, edge lengths, and raw theta (0 <= theta < 90, counterclockwise) in image
+// pixels from the moments gathered during contour finding. the center is the area centroid, the
+// orientation is the principal axis for elongated blobs or the 4-fold fourth-order moment for square
+// ones, and each edge length follows from the variance along its axis (length^2 / 12 for a uniform
+// rectangle). returns false if the moments are degenerate.
+bool Cube::estimatePoseFromMoments(Blob &blob, ofPoint &poseCenter, float &poseWidth, float &poseHeight, float &poseTheta) {
+    float trace = blob.mu20 + blob.mu02;
+    if (trace <= 0) {
+        return false;
+    }
+
+    // find the image-frame direction of one of the blob's edges
+    float edgeDirection;
+    float anisotropy = sqrt((blob.mu20 - blob.mu02) * (blob.mu20 - blob.mu02) + 4 * blob.mu11 * blob.mu11) / trace;
+    if (anisotropy > elongatedBlobAnisotropy) {
+        edgeDirection = 0.5 * atan2(2 * blob.mu11, blob.mu20 - blob.mu02);
+    } else if (blob.c4Real != 0 || blob.c4Imag != 0) {
+        // the fourth-order moment of a square rotated by phi points along -exp(4 i phi)
+        edgeDirection = atan2(-blob.c4Imag, -blob.c4Real) / 4;
+    } else {
+        return false;
+    }
+
+    // since +y is down, an image-frame edge direction of phi is a cube theta of -phi
+    poseTheta = fmod(-edgeDirection * 180 / pi + 360, 90);
+
+    // the width axis u and height axis v, matching the corner layout in calculateCandidateUpdates
+    float thetaRadians = poseTheta * pi / 180;
+    float ux = cos(thetaRadians), uy = -sin(thetaRadians);
+    float vx = sin(thetaRadians), vy = cos(thetaRadians);
+    float varianceU = blob.mu20 * ux * ux + 2 * blob.mu11 * ux * uy + blob.mu02 * uy * uy;
+    float varianceV = blob.mu20 * vx * vx + 2 * blob.mu11 * vx * vy + blob.mu02 * vy * vy;
+
+    poseWidth = sqrt(12 * max(0.0f, varianceU));
+    poseHeight = sqrt(12 * max(0.0f, varianceV));
+    poseCenter.set(blob.centroid.x, blob.centroid.y);
+    return true;
+}
+
+// refine a moment-based pose to sub-pixel accuracy by fitting a line to the contour points of each
+// of the blob's four edges. edge directions refine theta; edge offsets refine the center and the
+// edge lengths. sides with too little contour support keep their moment-based estimates.
+void Cube::refinePoseWithEdgeLines(Blob &blob, ofPoint &poseCenter, float &poseWidth, float &poseHeight, float &poseTheta) {
+    int numPoints = blob.pts.size();
+    if (numPoints < 4 || poseWidth <= 0 || poseHeight <= 0) {
+        return;
+    }
+
+    float thetaRadians = poseTheta * pi / 180;
+    ofPoint u(cos(thetaRadians), -sin(thetaRadians));
+    ofPoint v(sin(thetaRadians), cos(thetaRadians));
+
+    // per-side weighted sums of center-relative contour points; sides are ordered top (-v),
+    // right (+u), bottom (+v), left (-u)
+    double sideWeight[4] = {0, 0, 0, 0};
+    double sumX[4] = {0, 0, 0, 0}, sumY[4] = {0, 0, 0, 0};
+    double sumXX[4] = {0, 0, 0, 0}, sumXY[4] = {0, 0, 0, 0}, sumYY[4] = {0, 0, 0, 0};
+
+    for (int i = 0; i < numPoints; i++) {
+        ofPoint &point = blob.pts[i];
+        ofPoint &previous = blob.pts[(i + numPoints - 1) % numPoints];
+        ofPoint &next = blob.pts[(i + 1) % numPoints];
+
+        // approximated contours skip straight runs, so weight each point by the contour length it represents
+        float weight = 0.5 * (point.distance(previous) + point.distance(next));
+
+        ofPoint r = point - poseCenter;
+        float a = r.dot(u) / (0.5 * poseWidth);
+        float b = r.dot(v) / (0.5 * poseHeight);
+        if (fabs(a) > edgeFittingCornerZone && fabs(b) > edgeFittingCornerZone) {
+            continue;
+        }
+
+        int side;
+        if (fabs(a) > fabs(b)) {
+            side = a > 0 ? 1 : 3;
+        } else {
+            side = b > 0 ? 2 : 0;
+        }
+        sideWeight[side] += weight;
+        sumX[side] += weight * r.x;
+        sumY[side] += weight * r.y;
+        sumXX[side] += weight * r.x * r.x;
+        sumXY[side] += weight * r.x * r.y;
+        sumYY[side] += weight * r.y * r.y;
+    }
+
+    // fit a total-least-squares line to each supported side and average the line directions
+    // modulo 90 degrees (as 4-fold angles), weighted by side length
+    double directionSumReal = 0, directionSumImag = 0;
+    int numFittedSides = 0;
+    for (int side = 0; side < 4; side++) {
+        if (sideWeight[side] < edgeFittingMinimumSideLength) {
+            continue;
+        }
+        double meanX = sumX[side] / sideWeight[side];
+        double meanY = sumY[side] / sideWeight[side];
+        double covXX = sumXX[side] / sideWeight[side] - meanX * meanX;
+        double covXY = sumXY[side] / sideWeight[side] - meanX * meanY;
+        double covYY = sumYY[side] / sideWeight[side] - meanY * meanY;
+        double lineDirection = 0.5 * atan2(2 * covXY, covXX - covYY);
+        directionSumReal += sideWeight[side] * cos(4 * lineDirection);
+        directionSumImag += sideWeight[side] * sin(4 * lineDirection);
+        numFittedSides++;
+    }
+    if (numFittedSides < 2) {
+        return;
+    }
+
+    // accept the refined theta only if it agrees with the moment estimate; large disagreements
+    // mean the side assignment was wrong
+    float refinedTheta = fmod(-atan2(directionSumImag, directionSumReal) / 4 * 180 / pi + 360, 90);
+    float thetaChange = fabs(refinedTheta - poseTheta);
+    if (min(thetaChange, 90 - thetaChange) > 10) {
+        return;
+    }
+    poseTheta = refinedTheta;
+    thetaRadians = poseTheta * pi / 180;
+    u.set(cos(thetaRadians), -sin(thetaRadians));
+    v.set(sin(thetaRadians), cos(thetaRadians));
+
+    // each side's offset from the center is the mean projection of its points onto its outward normal
+    ofPoint outwardNormals[4] = {-v, u, v, -u};
+    float sideOffset[4];
+    bool sideFitted[4];
+    for (int side = 0; side < 4; side++) {
+        sideFitted[side] = sideWeight[side] >= edgeFittingMinimumSideLength;
+        if (sideFitted[side]) {
+            ofPoint sideMean(sumX[side] / sideWeight[side], sumY[side] / sideWeight[side]);
+            sideOffset[side] = sideMean.dot(outwardNormals[side]);
+        }
+    }
+
+    // opposing fitted sides determine an edge length and re-center the pose along that axis
+    if (sideFitted[1] && sideFitted[3]) {
+        poseWidth = sideOffset[1] + sideOffset[3];
+        poseCenter += u * (0.5 * (sideOffset[1] - sideOffset[3]));
+    }
+    if (sideFitted[0] && sideFitted[2]) {
+        poseHeight = sideOffset[0] + sideOffset[2];
+        poseCenter += v * (0.5 * (sideOffset[2] - sideOffset[0]));
+    }
+}
+
 // since theta angles are cyclic, with 0 == 360, find the degrees betweewn two angles
 float Cube::thetaDistance(float theta1, float theta2) {
     // restrict angles to 0 <= theta < 360
@@ -250,9 +449,13 @@ bool Cube::candidateUpdatesAreSignificant() {
 
     if (hasMarker != cand.hasMarker || blobId != cand.blob->id) {
         return true;
-    } else if (center.distance(cand.center) > 0.5 * pinSize) {
+    }
+
+    float centerThreshold = useMomentPoseEstimation ? momentPoseCenterUpdateThreshold : centerUpdateThreshold;
+    float thetaThreshold = useMomentPoseEstimation ? momentPoseThetaUpdateThreshold : thetaUpdateThreshold;
+    if (center.distance(cand.center) > centerThreshold) {
         return true;
-    } else if (abs(theta - cand.theta) > 10) {
+    } else if (thetaDistance(theta, cand.theta) > thetaThreshold) {
         return true;
     }
 
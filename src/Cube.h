@@ -9,6 +9,7 @@
 #include "Constants.h"
 #include "utils.h"
 #include "CameraCalibration.h"
+#include "TableFrame.h"
 #include "ofxKCore.h"
 #include <vector>
 
@@ -63,6 +64,7 @@ public:
     void setMarker(ofPoint _marker, bool _update=true);
     void setBlobAndMarker(Blob *_blob, ofPoint _marker, bool _update=true);
     void clearMarker(bool _update=true);
+    void setTableFrame(TableFrame *_tableFrame, ofPoint _roiOrigin);
     Blob *getCandidateBlob();
     void transformPointToCubeReferenceFrame(ofPoint *src, ofPoint *dst, float lengthScale=1.0);
     void transformPointFromCubeReferenceFrame(ofPoint *src, ofPoint *dst, float lengthScale=1.0);
@@ -85,13 +87,22 @@ public:
     float minX, maxX, minY, maxY; // cube boundary descriptors (absolute coordinates)
     int cubeTrackingId = -1; // cube managers may assign cube ids if desired
 
+    // pose estimation options. moment-based poses are much less jittery than the blob's
+    // min-area rectangle, which lets update hysteresis thresholds be tightened
+    bool useMomentPoseEstimation = true;    // derive pose from blob moments instead of the min-area rectangle
+    bool refinePoseByEdgeFitting = true;    // refine moment pose by fitting lines to the blob's four edges
+
 private:
     CubeUpdatesBuffer candidateUpdates;
+    TableFrame *tableFrame = NULL;  // maps blobs found in camera roi pixels onto the table, if set
+    ofPoint roiOrigin;              // camera pixel position of the roi blobs were found in
     const static int recentThetaCandidatesLength = 5;
     float recentThetaCandidates[recentThetaCandidatesLength];
 
     void initialize();
     void calculateCandidateUpdates();
+    bool estimatePoseFromMoments(Blob &blob, ofPoint &poseCenter, float &poseWidth, float &poseHeight, float &poseTheta);
+    void refinePoseWithEdgeLines(Blob &blob, ofPoint &poseCenter, float &poseWidth, float &poseHeight, float &poseTheta);
     float thetaDistance(float theta1, float theta2);
     float thetaUsingMarkerHysteresis(float thetaCandidate);
     bool candidateUpdatesAreSignificant();
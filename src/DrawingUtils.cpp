@@ -95,24 +95,31 @@ void interpolateBezierControlPoints(vector<pair<float, FloatType> > &controlPoin
 void verticalBezierGradientRect(Rectangle &rect, vector<pair<float, float> > &controlPoints, float stepSize) {
     vector<pair<float, float> > interpolatedPoints;
     interpolateBezierControlPoints(controlPoints, interpolatedPoints, stepSize);
-    int n = interpolatedPoints.size();
+    verticalProfileGradientRect(rect, interpolatedPoints);
+}
+
+// verticalProfileGradientRect
+//
+// draw a rectangle with a piecewise linear gradient profile stretching from top to bottom
+void verticalProfileGradientRect(Rectangle &rect, vector<pair<float, float> > &profile) {
+    int n = profile.size();
 
     ofMesh mesh;
     mesh.setMode(OF_PRIMITIVE_TRIANGLE_STRIP);
     mesh.enableColors();
 
     for (int i = 0; i < n; i++) {
-        ofColor color(min(255, max(0, (int) interpolatedPoints[i].second)));
-        mesh.addVertex(ofPoint(rect.left, rect.top + rect.height * interpolatedPoints[i].first));
+        ofColor color(min(255, max(0, (int) profile[i].second)));
+        mesh.addVertex(ofPoint(rect.left, rect.top + rect.height * profile[i].first));
         mesh.addColor(ofColor(color));
-        mesh.addVertex(ofPoint(rect.left + rect.width, rect.top + rect.height * interpolatedPoints[i].first));
+        mesh.addVertex(ofPoint(rect.left + rect.width, rect.top + rect.height * profile[i].first));
         mesh.addColor(ofColor(color));
     }
 
     mesh.draw();
 }
 
-// verticalBezierInterpolatedGradientRect
+// bezierInterpolatedGradientProfile
 //
 // basic bezier curve interpolator through three given points. this does not guarantee
 // preservation of interpolation point extrema in the generated bezier curve (unless
@@ -121,7 +128,7 @@ void verticalBezierGradientRect(Rectangle &rect, vector<pair<float, float> > &co
 // See verticalBezierSmartInterpolatedGradientRect for stronger guarantees.
 //
 // Note: currently, only the case with three interpolation points has been implemented.
-void verticalBezierInterpolatedGradientRect(Rectangle &rect, vector<pair<float, float> > &interpolationPoints, float stepSize, float q) {
+void bezierInterpolatedGradientProfile(vector<pair<float, float> > &interpolationPoints, vector<pair<float, float> > &profile, float stepSize, float q) {
     if (interpolationPoints.size() != 3) {
         cout << "ERROR: verticalBezierInterpolatedGradientRect expects interpolationPoints parameter to have length 3. More general behavior has not yet been implemented." << endl;
     }
@@ -157,20 +164,29 @@ void verticalBezierInterpolatedGradientRect(Rectangle &rect, vector<pair<float,
     controlPoints.push_back(pair<float, float>(cpIndex1, cpValue1));
     controlPoints.push_back(interpolationPoints[2]);
 
-    // draw rectangle using control points
-    verticalBezierGradientRect(rect, controlPoints, stepSize);
+    // interpolate the profile from the control points
+    interpolateBezierControlPoints(controlPoints, profile, stepSize);
 }
 
-// verticalBezierSmartInterpolatedGradientRect
+// verticalBezierInterpolatedGradientRect
 //
-// Draw a rectangle with a bezier curve gradient stretching from top to bottom.
+// draw a rectangle with a gradient from bezierInterpolatedGradientProfile
+void verticalBezierInterpolatedGradientRect(Rectangle &rect, vector<pair<float, float> > &interpolationPoints, float stepSize, float q) {
+    vector<pair<float, float> > profile;
+    bezierInterpolatedGradientProfile(interpolationPoints, profile, stepSize, q);
+    verticalProfileGradientRect(rect, profile);
+}
+
+// bezierSmartInterpolatedGradientProfile
+//
+// Calculate a bezier curve gradient profile stretching from top to bottom.
 // The curve gradient will pass through each point in the interpolationPoints parameter.
 //
 // For the case with three interpolation points, if the middle point is an extremum of the
 // three points (i.e. maximum or minimum), the gradient will preserve this extremum.
 //
 // Note: currently, only the case with three interpolation points has been implemented.
-void verticalBezierSmartInterpolatedGradientRect(Rectangle &rect, vector<pair<float, float> > &interpolationPoints, float stepSize) {
+void bezierSmartInterpolatedGradientProfile(vector<pair<float, float> > &interpolationPoints, vector<pair<float, float> > &profile, float stepSize) {
     if (interpolationPoints.size() != 3) {
         cout << "ERROR: verticalBezierInterpolatedGradientRect expects interpolationPoints parameter to have length 3. More general behavior has not yet been implemented." << endl;
     }
@@ -277,7 +293,17 @@ void verticalBezierSmartInterpolatedGradientRect(Rectangle &rect, vector<pair<fl
         cout << "    (" << interpolationPoints[2].first << ", " << interpolationPoints[2].second << ")" << endl;
     }
 
-    // pass q parameter to function that draws a bezier rect through interpolation points.
+    // pass q parameter to function that interpolates a bezier profile through interpolation points.
     // if no q was found, q is still -1, correctly yielding to the default q behavior
-    verticalBezierInterpolatedGradientRect(rect, interpolationPoints, stepSize, q);
+    bezierInterpolatedGradientProfile(interpolationPoints, profile, stepSize, q);
+}
+
+// verticalBezierSmartInterpolatedGradientRect
+//
+// Draw a rectangle with a gradient from bezierSmartInterpolatedGradientProfile. The gradient
+// passes through each interpolation point and preserves a middle extremum.
+void verticalBezierSmartInterpolatedGradientRect(Rectangle &rect, vector<pair<float, float> > &interpolationPoints, float stepSize) {
+    vector<pair<float, float> > profile;
+    bezierSmartInterpolatedGradientProfile(interpolationPoints, profile, stepSize);
+    verticalProfileGradientRect(rect, profile);
 }
\ No newline at end of file
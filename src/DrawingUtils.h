@@ -23,6 +23,12 @@ void verticalLinearGradientRect(Rectangle &rect, int colorTop, int colorBottom);
 void verticalBezierGradientRect(Rectangle &rect, vector<pair<float, float> > &controlPoints, float stepSize=0.01);
 void verticalBezierInterpolatedGradientRect(Rectangle &rect, vector<pair<float, float> > &interpolationPoints, float stepSize=0.01, float q=-1);
 void verticalBezierSmartInterpolatedGradientRect(Rectangle &rect, vector<pair<float, float> > &interpolationPoints, float stepSize=0.01);
+void verticalProfileGradientRect(Rectangle &rect, vector<pair<float, float> > &profile);
+
+// gradient profiles: (fraction along the rectangle's height, value) pairs, piecewise linear
+// between entries. shared by the GL drawing functions above and PinRasterizer
+void bezierInterpolatedGradientProfile(vector<pair<float, float> > &interpolationPoints, vector<pair<float, float> > &profile, float stepSize=0.01, float q=-1);
+void bezierSmartInterpolatedGradientProfile(vector<pair<float, float> > &interpolationPoints, vector<pair<float, float> > &profile, float stepSize=0.01);
 
 template<typename FloatType>
 void interpolateBezierControlPoints(vector<pair<float, FloatType> > &controlPoints, vector<pair<float, FloatType> > &interpolatedPoints, float stepSize=0.01);
@@ -0,0 +1,112 @@
+//
+//  HeightMapCompositor.cpp
+//  Relief2
+//
+//
+
+#include "HeightMapCompositor.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+HeightMapCompositor::HeightMapCompositor(int width, int height) : width(width), height(height) {
+}
+
+void HeightMapCompositor::clear() {
+    layers.clear();
+}
+
+void HeightMapCompositor::pushLayer(PinRasterizer &layer, LayerBlendMode mode) {
+    if (layer.getWidth() != width || layer.getHeight() != height) {
+        cout << "Error: HeightMapCompositor layer dimensions do not match the compositor" << endl;
+        return;
+    }
+    pushLayer(layer.getData(), mode);
+}
+
+void HeightMapCompositor::pushLayer(const unsigned char *values, LayerBlendMode mode) {
+    layers.push_back(pair<const unsigned char *, LayerBlendMode>(values, mode));
+}
+
+void HeightMapCompositor::pushLayers(HeightMapCompositor &other) {
+    if (other.width != width || other.height != height) {
+        cout << "Error: HeightMapCompositor layer dimensions do not match the compositor" << endl;
+        return;
+    }
+    layers.insert(layers.end(), other.layers.begin(), other.layers.end());
+}
+
+void HeightMapCompositor::compose(PinRasterizer &output, int background) {
+    if (output.getWidth() != width || output.getHeight() != height) {
+        cout << "Error: HeightMapCompositor output dimensions do not match the compositor" << endl;
+        return;
+    }
+    compose(output.getData(), background);
+}
+
+void HeightMapCompositor::compose(unsigned char *output, int background) {
+    int count = width * height;
+    memset(output, ofClamp(background, 0, 255), count);
+    for (int i = 0; i < layers.size(); i++) {
+        blend(output, layers[i].first, count, layers[i].second);
+    }
+}
+
+// one loop per mode, so the mode test stays out of the inner loop
+template<LayerBlendMode mode>
+static void blendLayer(unsigned char *dst, const unsigned char *src, int count) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        if (mode == BLEND_REPLACE) {
+            __m128i transparent = _mm_cmpeq_epi8(s, zero);
+            d = _mm_or_si128(_mm_and_si128(transparent, d), _mm_andnot_si128(transparent, s));
+        } else if (mode == BLEND_MAX) {
+            d = _mm_max_epu8(d, s);
+        } else if (mode == BLEND_MIN) {
+            d = _mm_min_epu8(d, s);
+        } else if (mode == BLEND_ADD) {
+            d = _mm_adds_epu8(d, s);
+        } else if (mode == BLEND_SUBTRACT) {
+            d = _mm_subs_epu8(d, s);
+        } else if (mode == BLEND_MASK) {
+            d = _mm_andnot_si128(_mm_cmpeq_epi8(s, zero), d);
+        }
+        _mm_storeu_si128((__m128i *) (dst + i), d);
+    }
+#endif
+    for (; i < count; i++) {
+        if (mode == BLEND_REPLACE) {
+            if (src[i]) {
+                dst[i] = src[i];
+            }
+        } else if (mode == BLEND_MAX) {
+            dst[i] = max(dst[i], src[i]);
+        } else if (mode == BLEND_MIN) {
+            dst[i] = min(dst[i], src[i]);
+        } else if (mode == BLEND_ADD) {
+            dst[i] = min(255, dst[i] + src[i]);
+        } else if (mode == BLEND_SUBTRACT) {
+            dst[i] = max(0, dst[i] - src[i]);
+        } else if (mode == BLEND_MASK) {
+            if (!src[i]) {
+                dst[i] = 0;
+            }
+        }
+    }
+}
+
+void HeightMapCompositor::blend(unsigned char *dst, const unsigned char *src, int count, LayerBlendMode mode) {
+    switch (mode) {
+        case BLEND_REPLACE: blendLayer<BLEND_REPLACE>(dst, src, count); break;
+        case BLEND_MAX: blendLayer<BLEND_MAX>(dst, src, count); break;
+        case BLEND_MIN: blendLayer<BLEND_MIN>(dst, src, count); break;
+        case BLEND_ADD: blendLayer<BLEND_ADD>(dst, src, count); break;
+        case BLEND_SUBTRACT: blendLayer<BLEND_SUBTRACT>(dst, src, count); break;
+        case BLEND_MASK: blendLayer<BLEND_MASK>(dst, src, count); break;
+    }
+}
@@ -0,0 +1,49 @@
+//
+//  HeightMapCompositor.h
+//  Relief2
+//
+//
+
+#ifndef __Relief2__HeightMapCompositor__
+#define __Relief2__HeightMapCompositor__
+
+#include "ofMain.h"
+#include "Constants.h"
+#include "PinRasterizer.h"
+
+
+// how a layer combines with the layers beneath it
+enum LayerBlendMode {
+    BLEND_REPLACE,      // layer value wherever the layer is nonzero; zero is transparent
+    BLEND_MAX,          // raise to the layer value
+    BLEND_MIN,          // cap at the layer value
+    BLEND_ADD,          // add, saturating at 255
+    BLEND_SUBTRACT,     // subtract, saturating at 0
+    BLEND_MASK          // keep only where the layer is nonzero
+};
+
+
+// composites a stack of pin resolution height map layers, bottom to top, onto a background.
+// layers are referenced, not copied, so they must stay valid until compose is called
+class HeightMapCompositor {
+public:
+    HeightMapCompositor(int width=RELIEF_SIZE_X, int height=RELIEF_SIZE_Y);
+
+    void clear();
+    void pushLayer(PinRasterizer &layer, LayerBlendMode mode);
+    void pushLayer(const unsigned char *values, LayerBlendMode mode);
+    void pushLayers(HeightMapCompositor &other);    // append other's layer stack
+    int getNumLayers() { return layers.size(); }
+
+    void compose(PinRasterizer &output, int background=0);
+    void compose(unsigned char *output, int background=0);
+
+    // blend count values of src into dst
+    static void blend(unsigned char *dst, const unsigned char *src, int count, LayerBlendMode mode);
+
+private:
+    int width, height;
+    vector<pair<const unsigned char *, LayerBlendMode> > layers;
+};
+
+#endif /* defined(__Relief2__HeightMapCompositor__) */
@@ -10,11 +10,9 @@
 
 HybridTokens::HybridTokens(KinectTracker *tracker) {
     kinectTracker = tracker;
-    pinHeightMapImage.allocate(lengthScale, lengthScale, GL_RGBA);
-    cubeFootprintsFbo.allocate(lengthScale, lengthScale, GL_RGBA);
-    cubeFootprintPixels.allocate(lengthScale, lengthScale, GL_RGBA);
-    pinHeightMapContentPixels.allocate(lengthScale, lengthScale, GL_RGBA);
-    pinGraphicsPixels.allocate(lengthScale, lengthScale, GL_RGBA);
+    pinHeightMapContentPixels.allocate(lengthScale, lengthScale, OF_IMAGE_COLOR_ALPHA);
+    pinGraphicsPixels.allocate(lengthScale, lengthScale, OF_IMAGE_COLOR_ALPHA);
+    pinGraphicsPixels.set(3, 255);
 
     mode = BOOLEAN_SWORDS;
 
@@ -49,10 +47,8 @@ void HybridTokens::drawGraphics() {
 }
 
 void HybridTokens::update(float dt) {
-    // draw height map content
-    pinHeightMapImage.begin();
-    ofBackground(0);
-    ofSetColor(255);
+    // rasterize height map layers on the cpu at pin resolution, then composite them
+    heightMapCompositor.clear();
 
     if (mode == BOOLEAN_SWORDS) {
         drawBooleanSwords();
@@ -70,58 +66,48 @@ void HybridTokens::update(float dt) {
         drawVerticalDeformationSwords();
     }
 
-    pinHeightMapImage.end();
+    heightMapCompositor.compose(heightMapCanvas);
 
-    // store height map content for graphics computations
-    pinHeightMapImage.readToPixels(pinHeightMapContentPixels);
+    // store height map content for drawing
+    heightMapCanvas.toPixels(pinHeightMapContentPixels);
+    pinHeightMapImage.setFromPixels(pinHeightMapContentPixels);
 
-    // record cube footprints in a pixels object for graphics computations
-    cubeFootprintsFbo.begin();
-    ofBackground(0);
-    ofSetColor(255);
-    setCubeHeights(cubeHeight);
-    cubeFootprintsFbo.end();
-    cubeFootprintsFbo.readToPixels(cubeFootprintPixels);
+    // record cube footprints for graphics computations
+    cubeFootprintsCanvas.clear(0);
+    setCubeHeights(cubeFootprintsCanvas, cubeHeight);
 
     updateGraphics();
 }
 
+// provide this frame's height map layers. they stay valid until the next update
+bool HybridTokens::composeHeightMap(HeightMapCompositor &compositor) {
+    compositor.pushLayers(heightMapCompositor);
+    return true;
+}
+
 // paint pins according to their heights
 void HybridTokens::updateGraphics() {
-    // some bug in ofPixels causes it to break without this initialization; only necessary once
-    if (!initializedInUpdate) {
-        pinHeightMapImage.readToPixels(pinGraphicsPixels);
-        initializedInUpdate = true;
-    }
-
     // paint pins for 2D display
     int numChannels = pinGraphicsPixels.getNumChannels(); // this should be 4
-    for (int i = 0; i < pinGraphicsPixels.size(); i += numChannels) {
+    for (int i = 0, j = 0; i < pinGraphicsPixels.size(); i += numChannels, j++) {
         // if a cube sits here, do not paint graphics onto it
-        if (cubeFootprintPixels[i]) {
+        if (cubeFootprintsCanvas[j]) {
             // do not paint this pixel
             pinGraphicsPixels[i + 0] = 0;
             pinGraphicsPixels[i + 1] = 0;
             pinGraphicsPixels[i + 2] = 0;
 
-            // furthermore, ensure this pixel is reprojected to the location of the cube surface
-            pinHeightMapContentPixels[i + 0] += cubeHeight;
-            pinHeightMapContentPixels[i + 1] += cubeHeight;
-            pinHeightMapContentPixels[i + 2] += cubeHeight;
-
         // otherwise, calculate this pixel's color
         } else {
-            // since the height map rgba pixels are grayscale, the first channel is sufficient
-            // to distinguish pin height
-            if (pinHeightMapContentPixels[i] > STANDARD_CUBE_HEIGHT) {
+            if (heightMapCanvas[j] > STANDARD_CUBE_HEIGHT) {
                 pinGraphicsPixels[i + 0] = pinColorIfHigh[0];
                 pinGraphicsPixels[i + 1] = pinColorIfHigh[1];
                 pinGraphicsPixels[i + 2] = pinColorIfHigh[2];
-            } else if (pinHeightMapContentPixels[i] == STANDARD_CUBE_HEIGHT - 1) {
+            } else if (heightMapCanvas[j] == STANDARD_CUBE_HEIGHT - 1) {
                 pinGraphicsPixels[i + 0] = pinColorAltIfOn[0];
                 pinGraphicsPixels[i + 1] = pinColorAltIfOn[1];
                 pinGraphicsPixels[i + 2] = pinColorAltIfOn[2];
-            } else if (pinHeightMapContentPixels[i] > 0) {
+            } else if (heightMapCanvas[j] > 0) {
                 pinGraphicsPixels[i + 0] = pinColorIfOn[0];
                 pinGraphicsPixels[i + 1] = pinColorIfOn[1];
                 pinGraphicsPixels[i + 2] = pinColorIfOn[2];
@@ -133,58 +119,65 @@ void HybridTokens::updateGraphics() {
         }
     }
 
+    // ensure pixels under cubes are reprojected to the location of the cube surface
+    reprojectionCompositor.clear();
+    reprojectionCompositor.pushLayer(heightMapCanvas, BLEND_REPLACE);
+    reprojectionCompositor.pushLayer(cubeFootprintsCanvas, BLEND_ADD);
+    reprojectionCompositor.compose(reprojectionHeightsCanvas);
+    reprojectionHeightsCanvas.toPixels(pinHeightMapContentPixels);
+
     // paint pins for projection onto 2.5D surface
     reprojectProjectorPixelsForHeightMap(pinGraphicsPixels, pinHeightMapContentPixels, reprojectedPinGraphicsPixels);
 }
 
 // lift cubes slightly above neighboring pins to facilitate smooth sliding
-void HybridTokens::setCubeHeight(Cube &cube, int height, float edgeLengthMultiplier) {
-    ofSetColor(height);
+void HybridTokens::setCubeHeight(PinRasterizer &canvas, Cube &cube, int height, float edgeLengthMultiplier) {
+    canvas.setValue(height);
 
     // draw cube footprint
-    glPushMatrix();
-    glTranslatef(cube.center.x * lengthScale, cube.center.y * lengthScale, 0.0f);
-    glRotatef(-cube.theta, 0.0f, 0.0f, 1.0f);
+    canvas.pushMatrix();
+    canvas.translate(cube.center.x * lengthScale, cube.center.y * lengthScale);
+    canvas.rotate(-cube.theta);
     float scaledEdgeLength = cubeEdgeLength * lengthScale * edgeLengthMultiplier;
-    ofRect(-scaledEdgeLength / 2, -scaledEdgeLength / 2, scaledEdgeLength, scaledEdgeLength);
-    glPopMatrix();
+    canvas.fillRect(-scaledEdgeLength / 2, -scaledEdgeLength / 2, scaledEdgeLength, scaledEdgeLength);
+    canvas.popMatrix();
 }
 
 // lift cubes slightly above neighboring pins to facilitate smooth sliding
-void HybridTokens::setCubeHeights(int height, float edgeLengthMultiplier, TouchCondition touchCondition) {
+void HybridTokens::setCubeHeights(PinRasterizer &canvas, int height, float edgeLengthMultiplier, TouchCondition touchCondition) {
     for (vector<Cube>::iterator cube = kinectTracker->redCubes.begin(); cube < kinectTracker->redCubes.end(); cube++) {
         if (touchCondition == UNDEFINED || (touchCondition == TOUCHED && cube->isTouched) ||
                 (touchCondition == NOT_TOUCHED && !cube->isTouched)) {
-            setCubeHeight(*cube, height, edgeLengthMultiplier);
+            setCubeHeight(canvas, *cube, height, edgeLengthMultiplier);
         }
     }
 }
 
 // height value defaults to cube height. passing a non-negative value to farHeight
 // linearly interpolates the sword height
-void HybridTokens::drawSword(int height, int farHeight) {
+void HybridTokens::drawSword(PinRasterizer &canvas, int height, int farHeight) {
     // if a second height was given, draw a gradient sword
     if (farHeight >= 0) {
-        verticalLinearGradientRect(swordRectangle, farHeight, height);
+        canvas.fillVerticalLinearGradientRect(swordRectangle, farHeight, height);
 
     // else draw a simple sword
     } else {
-        ofSetColor(height);
-        ofRect(swordRectangle.left, swordRectangle.top, swordRectangle.width, swordRectangle.height);
+        canvas.setValue(height);
+        canvas.fillRect(swordRectangle);
     }
 }
 
 // draw sword with a bezier gradient passing through the given interpolation points
-void HybridTokens::drawSword(vector<pair<float, float> > &interpolationPoints) {
+void HybridTokens::drawSword(PinRasterizer &canvas, vector<pair<float, float> > &interpolationPoints) {
     // if too few interpolation points are passed in, gracefully fall through to
     // simpler cases. if too many points are passed in, complain and exit.
     if (interpolationPoints.size() != 3) {
         if (interpolationPoints.size() == 0) {
-            drawSword();
+            drawSword(canvas);
         } else if (interpolationPoints.size() == 1) {
-            drawSword(interpolationPoints[0].second);
+            drawSword(canvas, interpolationPoints[0].second);
         } else if (interpolationPoints.size() == 2) {
-            drawSword(interpolationPoints[0].second, interpolationPoints[1].second);
+            drawSword(canvas, interpolationPoints[0].second, interpolationPoints[1].second);
         } else {
             cout << "Error: drawSword does not currently support more than three interpolation points." << endl;
         }
@@ -194,82 +187,58 @@ void HybridTokens::drawSword(vector<pair<float, float> > &interpolationPoints) {
     // draw sword - use an inverted sword rectangle so that interpolation indices map to
     // distance from cube (e.g. index 0 is the cube, index 1 is the top tip of the sword)
     Rectangle invertedTopAndBottomSword = swordRectangle.withInvertedTopAndBottom();
-    verticalBezierSmartInterpolatedGradientRect(invertedTopAndBottomSword, interpolationPoints);
+    vector<pair<float, float> > profile;
+    bezierSmartInterpolatedGradientProfile(interpolationPoints, profile);
+    canvas.fillGradientRect(invertedTopAndBottomSword, profile);
 }
 
 // height value defaults to cube height. passing a non-negative value to farHeight
 // linearly interpolates the sword height
-void HybridTokens::drawSwordForCube(Cube &cube, int height, int farHeight) {
+void HybridTokens::drawSwordForCube(PinRasterizer &canvas, Cube &cube, int height, int farHeight) {
     // transition to the cube's reference frame
-    glPushMatrix();
-    glTranslatef(cube.center.x * lengthScale, cube.center.y * lengthScale, 0.0f);
-    glRotatef(-cube.theta, 0.0f, 0.0f, 1.0f);
+    canvas.pushMatrix();
+    canvas.translate(cube.center.x * lengthScale, cube.center.y * lengthScale);
+    canvas.rotate(-cube.theta);
 
     // draw sword
-    drawSword(height, farHeight);
+    drawSword(canvas, height, farHeight);
 
     // reset coordinate system
-    glPopMatrix();
+    canvas.popMatrix();
 }
 
 // draw sword with a bezier gradient passing through the given interpolation points
-void HybridTokens::drawSwordForCube(Cube &cube, vector<pair<float, float> > &interpolationPoints) {
+void HybridTokens::drawSwordForCube(PinRasterizer &canvas, Cube &cube, vector<pair<float, float> > &interpolationPoints) {
     // transition to the cube's reference frame
-    glPushMatrix();
-    glTranslatef(cube.center.x * lengthScale, cube.center.y * lengthScale, 0.0f);
-    glRotatef(-cube.theta, 0.0f, 0.0f, 1.0f);
+    canvas.pushMatrix();
+    canvas.translate(cube.center.x * lengthScale, cube.center.y * lengthScale);
+    canvas.rotate(-cube.theta);
 
     // draw sword
-    drawSword(interpolationPoints);
+    drawSword(canvas, interpolationPoints);
 
     // reset coordinate system
-    glPopMatrix();
+    canvas.popMatrix();
 }
 
 // make it easy to move cubes by clearing space around them and lifting up touched cubes
 void HybridTokens::drawStandardClearingsAndRisers() {
-    // don't draw swords under the cubes
-    setCubeHeights(0, 1.5);
+    // don't draw swords under the cubes: cap heights at depressions in a white background
+    clearingsLayer.clear(255);
+    setCubeHeights(clearingsLayer, 0, 1.5);
+    heightMapCompositor.pushLayer(clearingsLayer, BLEND_MIN);
 
     // lift touched cubes slightly off the surface for a smooth dragging experience
-    setCubeHeights(40, 1.0, TOUCHED);
+    risersLayer.clear(0);
+    setCubeHeights(risersLayer, 40, 1.0, TOUCHED);
+    heightMapCompositor.pushLayer(risersLayer, BLEND_MAX);
 }
 
-// calculate the intersection and union drawings of the swords for all cubes
-void HybridTokens::getSwordsIntersectionAndUnion(ofPixels &swordsIntersection, ofPixels &swordsUnion) {
-    // buffer repository for drawing a single sword into; associated pixels object for manipulating the result
-    ofFbo swordBuffer;
-    ofPixels swordPixels;
-    swordBuffer.allocate(lengthScale, lengthScale, GL_RGBA);
-
-    // pixels objects used to calculate the swords' intersection and union
-    swordsIntersection.allocate(lengthScale, lengthScale, 1);
-    swordsUnion.allocate(lengthScale, lengthScale, 1);
-    swordsIntersection.set(255);
-    swordsUnion.set(0);
-
-    // draw each cube's sword and update the swords' intersection and union
+// get each cube's sword as a polygon in height map coordinates
+void HybridTokens::getSwordPolygons(vector<ConvexPolygon> &swords) {
+    swords.clear();
     for (int i = 0; i < kinectTracker->redCubes.size(); i++) {
-        // draw sword into buffer
-        swordBuffer.begin();
-        ofBackground(0);
-        drawSwordForCube(kinectTracker->redCubes[i]);
-        swordBuffer.end();
-
-        // extract sword data as grayscale pixels
-        swordBuffer.readToPixels(swordPixels);
-        swordPixels.setNumChannels(1);
-
-        for (int j = 0; j < swordPixels.size(); j++) {
-            // update intersection pixel
-            if (swordsIntersection[j]) {
-                swordsIntersection[j] = swordPixels[j];
-            }
-            // update union pixel
-            if (swordPixels[j]) {
-                swordsUnion[j] = swordPixels[j];
-            }
-        }
+        swords.push_back(ConvexPolygon::fromCubeReferenceFrame(swordRectangle, kinectTracker->redCubes[i], lengthScale));
     }
 }
 
@@ -302,42 +271,14 @@ void HybridTokens::getSwordsAxesIntersectionPoint(Cube &firstCube, Cube &secondC
     dst.set(intersectionPoint);
 }
 
-// use the blob finder to find the center point of the swords' intersection
-void HybridTokens::getCenterOfImageBlob(ofPixels &thresholdedPixels, ofPoint &dst) {
-    // set up blob finder parameters
-    blobFinder.bTrackBlobs = true;
-    blobFinder.bTrackFingers = false;
-
-    // convert pixels to a cvImage
-    int width = thresholdedPixels.getWidth();
-    int height = thresholdedPixels.getHeight();
-    ofxCvGrayscaleImage cvImage;
-    cvImage.allocate(width, height);
-    cvImage.setFromPixels(thresholdedPixels);
-
-    // find blob
-    blobFinder.findContours(cvImage, 1, width * height, 1, 20.0, false);
-    vector<Blob> blobs = blobFinder.blobs;
-
-    // for now, take the simplest exit route when no blobs are found
-    if (!blobs.size()) {
-        cout << "Error: blob detection failed in getCenterOfImageBlob" << endl;
-        return;
-    }
-
-    // set dst to the normalized blob centroid
-    Blob *intersectionBlob = &blobs[0];
-    ofPoint normalizationVector(1.0 / intersectionBlob->widthScale, 1.0 / intersectionBlob->heightScale);
-    dst.set(intersectionBlob->centroid * normalizationVector * lengthScale);
-}
-
 void HybridTokens::drawSwords() {
     // draw the swords
-    ofSetColor(255);
-    ofBackground(0);
+    swordsLayer.clear(0);
+    swordsLayer.setValue(255);
     for (int i = 0; i < kinectTracker->redCubes.size(); i++) {
-        drawSwordForCube(kinectTracker->redCubes[i]);
+        drawSwordForCube(swordsLayer, kinectTracker->redCubes[i]);
     }
+    heightMapCompositor.pushLayer(swordsLayer, BLEND_REPLACE);
 
     // but give cubes room to move
     drawStandardClearingsAndRisers();
@@ -349,45 +290,40 @@ void HybridTokens::drawBooleanSwords() {
         return;
     }
 
-    // calculate intersection and union of swords
-    ofPixels swordsIntersection, swordsUnion;
-    getSwordsIntersectionAndUnion(swordsIntersection, swordsUnion);
+    // calculate the swords' intersection geometrically
+    vector<ConvexPolygon> swords;
+    getSwordPolygons(swords);
+    ConvexPolygon swordsIntersection = intersectionOfPolygons(swords);
 
-    // calculate appropriate output drawing given the active schema
-    ofPixels swordsOutput;
-    swordsOutput.allocate(lengthScale, lengthScale, 1);
+    // rasterize the swords' union and intersection once each
+    swordsLayer.clear(0);
+    swordsLayer.setValue(255);
+    for (int i = 0; i < swords.size(); i++) {
+        swordsLayer.fillPolygon(swords[i].vertices);
+    }
+    overlayLayer.clear(0);
+    overlayLayer.setValue(255);
+    overlayLayer.fillPolygon(swordsIntersection.vertices);
 
     // union of swords
     if (booleanSwordsSchema == UNION) {
-        swordsOutput = swordsUnion;
+        heightMapCompositor.pushLayer(swordsLayer, BLEND_REPLACE);
 
     // intersection of swords
     } else if (booleanSwordsSchema == INTERSECTION) {
-        swordsOutput = swordsIntersection;
+        heightMapCompositor.pushLayer(overlayLayer, BLEND_REPLACE);
 
     // sum of swords (add intersection on top of union)
     } else if (booleanSwordsSchema == SUM) {
-        swordsOutput = swordsUnion;
-        for (int j = 0; j < swordsOutput.size(); j++) {
-            if (swordsIntersection[j]) {
-                swordsOutput[j] = 255; //swordsOutput[j] += swordsIntersection[j];
-            }
-        }
+        heightMapCompositor.pushLayer(swordsLayer, BLEND_REPLACE);
+        heightMapCompositor.pushLayer(overlayLayer, BLEND_MAX);
 
     // xor of swords (subtract intersection from union)
     } else if (booleanSwordsSchema == XOR) {
-        swordsOutput = swordsUnion;
-        for (int j = 0; j < swordsOutput.size(); j++) {
-            if (swordsIntersection[j]) {
-                swordsOutput[j] = 0;
-            }
-        }
+        heightMapCompositor.pushLayer(swordsLayer, BLEND_REPLACE);
+        heightMapCompositor.pushLayer(overlayLayer, BLEND_SUBTRACT);
     }
 
-    // draw the swords
-    ofSetColor(255);
-    ofImage(swordsOutput).draw(0,0);
-
     // but give cubes room to move
     drawStandardClearingsAndRisers();
 }
@@ -442,12 +378,11 @@ void HybridTokens::drawFlexibleSwords(int height) {
     }
 
     // draw the 2D curve
-    ofSetColor(height);
-    ofSetLineWidth(0);
-    ofFill();
-    ofBeginShape();
-    ofVertices(vector<ofPoint>(boundaryVertices, boundaryVertices + 2 * sampleSize));
-    ofEndShape();
+    vector<ofPoint> boundary(boundaryVertices, boundaryVertices + 2 * sampleSize);
+    swordsLayer.clear(0);
+    swordsLayer.setValue(height);
+    swordsLayer.fillPolygon(boundary);
+    heightMapCompositor.pushLayer(swordsLayer, BLEND_REPLACE);
 
     // but give cubes room to move
     drawStandardClearingsAndRisers();
@@ -503,18 +438,11 @@ void HybridTokens::drawPhysicsSwords() {
         topCube = &kinectTracker->redCubes[0];
     }
 
-    // calculate intersection and union of swords
-    ofPixels swordsIntersection, swordsUnion;
-    getSwordsIntersectionAndUnion(swordsIntersection, swordsUnion);
-
-    // determine whether the swords intersect
-    bool swordsIntersect = false;
-    for (int i = 0; i < swordsIntersection.size(); i++) {
-        if (swordsIntersection[i]) {
-            swordsIntersect = true;
-            break;
-        }
-    }
+    // calculate the swords' intersection and determine whether the swords intersect
+    vector<ConvexPolygon> swords;
+    getSwordPolygons(swords);
+    ConvexPolygon swordsIntersection = intersectionOfPolygons(swords);
+    bool swordsIntersect = !swordsIntersection.isEmpty();
 
     // determine the target sword height for the top cube (the bottom cube will just lie flat)
     int targetHeightNearTopCube, targetHeightFarFromTopCube;
@@ -552,64 +480,41 @@ void HybridTokens::drawPhysicsSwords() {
     physicsTopSwordHeightNearCube += nearHeightAdjustment;
     physicsTopSwordHeightFarFromCube += farHeightAdjustment;
 
-    // allocate a drawing repository
-    ofFbo drawBuffer;
-    drawBuffer.allocate(lengthScale, lengthScale, GL_RGBA);
-    
-    // draw swords to buffer
-    drawBuffer.begin();
-    ofBackground(0);
+    // draw swords into the swords layer
+    PinRasterizer &swordPixels = swordsLayer;
+    swordPixels.clear(0);
+    swordPixels.setValue(255);
     
     // bottom cube gets a normal sword
-    drawSwordForCube(*bottomCube);
+    drawSwordForCube(swordPixels, *bottomCube);
     
     // top cube gets a sword with the calculated heights
-    drawSwordForCube(*topCube, physicsTopSwordHeightNearCube, physicsTopSwordHeightFarFromCube);
-    
-    drawBuffer.end();
-    
-    // extract sword data as grayscale pixels
-    ofPixels swordPixels;
-    drawBuffer.readToPixels(swordPixels);
-    swordPixels.setNumChannels(1);
+    drawSwordForCube(swordPixels, *topCube, physicsTopSwordHeightNearCube, physicsTopSwordHeightFarFromCube);
     
     // draw cube footprints as depressions into a white background.
     // footprints include clearings and touch-sensitive risers
-    drawBuffer.begin();
-    ofBackground(255);
+    PinRasterizer &drawBuffer = clearingsLayer;
+    drawBuffer.clear(255);
 
     // top cube's footprint
     int topCubeBaseHeight = physicsTopSwordHeightNearCube - cubeHeight;
     if (topCube->isTouched) {
         int clearingHeight = max(0, topCubeBaseHeight - 40);
-        setCubeHeight(*topCube, clearingHeight, 1.5);
-        setCubeHeight(*topCube, clearingHeight + 40);
+        setCubeHeight(drawBuffer, *topCube, clearingHeight, 1.5);
+        setCubeHeight(drawBuffer, *topCube, clearingHeight + 40);
     } else {
-        setCubeHeight(*topCube, topCubeBaseHeight, 1.5);
+        setCubeHeight(drawBuffer, *topCube, topCubeBaseHeight, 1.5);
     }
     
     // bottom cube's footprint
-    setCubeHeight(*bottomCube, 0, 1.5);
+    setCubeHeight(drawBuffer, *bottomCube, 0, 1.5);
     if (bottomCube->isTouched) {
-        setCubeHeight(*bottomCube, 40);
+        setCubeHeight(drawBuffer, *bottomCube, 40);
     }
-    drawBuffer.end();
-    
-    // extract cube footprint data as grayscale pixels
-    ofPixels cubeFootprintPixels;
-    drawBuffer.readToPixels(cubeFootprintPixels);
-    cubeFootprintPixels.setNumChannels(1);
     
     // cap sword pixel heights at footprint pixel depressions
-    for (int i = 0; i < swordPixels.size(); i++) {
-        if (swordPixels[i] > cubeFootprintPixels[i]) {
-            swordPixels[i] = cubeFootprintPixels[i];
-        }
-    }
-    
-    // draw the swords
-    ofSetColor(255);
-    ofImage(swordPixels).draw(0,0);
+    heightMapCompositor.pushLayer(swordPixels, BLEND_REPLACE);
+    heightMapCompositor.pushLayer(drawBuffer, BLEND_MIN);
 }
 
 void HybridTokens::drawDynamicallyConstrainedSwords(int height) {
@@ -636,13 +541,14 @@ void HybridTokens::drawDynamicallyConstrainedSwords(int height) {
     // for now, assume all cubes are aligned to the coordinate axes
 
     // draw static sword right
-    ofSetColor(height + 1); // increase height to receive special high color
+    swordsLayer.clear(0);
+    swordsLayer.setValue(height + 1); // increase height to receive special high color
     int fixedLeft, fixedRight, fixedTop, fixedBottom;
     fixedLeft = (fixedCube->center.x + 0.5 * cubeEdgeLength) * lengthScale;
     fixedRight = (fixedCube->center.x + (0.5 + 3) * cubeEdgeLength) * lengthScale;
     fixedTop = (fixedCube->center.y - 0.5 * cubeEdgeLength) * lengthScale;
     fixedBottom = (fixedCube->center.y + 0.5 * cubeEdgeLength) * lengthScale;
-    ofRect(fixedLeft, fixedTop, fixedRight - fixedLeft, fixedBottom - fixedTop);
+    swordsLayer.fillRect(fixedLeft, fixedTop, fixedRight - fixedLeft, fixedBottom - fixedTop);
     
     // get dynamic sword boundaries
     int left, right, top, bottom;
@@ -654,25 +560,28 @@ void HybridTokens::drawDynamicallyConstrainedSwords(int height) {
     bool swordMayPass = top > fixedBottom || bottom < fixedTop;
 
     // draw dynamic sword up - if it's on a collision course, make sure it doesn't accidentally pass the static sword
-    ofSetColor(height);
+    swordsLayer.setValue(height);
     if (swordMayPass) {
-        ofRect(left, top, right - left, bottom - top);
+        swordsLayer.fillRect(left, top, right - left, bottom - top);
     } else {
-        ofRect(max(left, fixedRight), top, right - left, bottom - top);
+        swordsLayer.fillRect(max(left, fixedRight), top, right - left, bottom - top);
     }
+    heightMapCompositor.pushLayer(swordsLayer, BLEND_REPLACE);
 
     // but give cubes room to move
     drawStandardClearingsAndRisers();
 
     // draw blockade if appropriate
     if (!swordMayPass) {
-        ofSetColor(height - 1); // decrease height to get special alt color
+        overlayLayer.clear(0);
+        overlayLayer.setValue(height - 1); // decrease height to get special alt color
         int closeDistance = 0.5 * cubeEdgeLength * lengthScale;
         if (left < fixedRight + closeDistance) {
             int adjWidth = cubeEdgeLength * lengthScale;
             int adjHeight = cubeEdgeLength * lengthScale;
             int cubeBottom = (dynamicCube->center.y + 0.5 * cubeEdgeLength) * lengthScale;
-            ofRect(fixedRight - adjWidth / 4, cubeBottom - adjHeight, adjWidth / 4, adjHeight);
+            overlayLayer.fillRect(fixedRight - adjWidth / 4, cubeBottom - adjHeight, adjWidth / 4, adjHeight);
+            heightMapCompositor.pushLayer(overlayLayer, BLEND_REPLACE);
         }
     }
 }
@@ -699,18 +608,11 @@ void HybridTokens::drawVerticalDeformationSwords() {
         topCube = &kinectTracker->redCubes[0];
     }
 
-    // calculate intersection and union of swords
-    ofPixels swordsIntersection, swordsUnion;
-    getSwordsIntersectionAndUnion(swordsIntersection, swordsUnion);
-
-    // determine whether the swords intersect
-    bool swordsIntersect = false;
-    for (int i = 0; i < swordsIntersection.size(); i++) {
-        if (swordsIntersection[i]) {
-            swordsIntersect = true;
-            break;
-        }
-    }
+    // calculate the swords' intersection and determine whether the swords intersect
+    vector<ConvexPolygon> swords;
+    getSwordPolygons(swords);
+    ConvexPolygon swordsIntersection = intersectionOfPolygons(swords);
+    bool swordsIntersect = !swordsIntersection.isEmpty();
 
     // if there's no intersection, just draw regular swords
     if (!swordsIntersect) {
@@ -719,8 +621,7 @@ void HybridTokens::drawVerticalDeformationSwords() {
     }
 
     // find the center of the swords' intersection
-    ofPoint intersectionPoint;
-    getCenterOfImageBlob(swordsIntersection, intersectionPoint);
+    ofPoint intersectionPoint = swordsIntersection.centroid();
 
     // transform the intersection point into a displacement vector along the top sword's axis
     topCube->transformPointToCubeReferenceFrame(&intersectionPoint, &intersectionPoint, lengthScale);
@@ -753,63 +654,40 @@ void HybridTokens::drawVerticalDeformationSwords() {
     // distance to the cube's base falls from 0.8 to 0.4
     int topCubeRiserHeight = (255 - cubeHeight) / (1 + exp(10 * (intersectionDistance - 0.6)));
 
-    // allocate a drawing repository
-    ofFbo drawBuffer;
-    drawBuffer.allocate(lengthScale, lengthScale, GL_RGBA);
-    
-    // draw swords to buffer
-    drawBuffer.begin();
-    ofBackground(0);
+    // draw swords into the swords layer
+    PinRasterizer &swordPixels = swordsLayer;
+    swordPixels.clear(0);
+    swordPixels.setValue(255);
     
     // bottom cube gets a normal sword
-    drawSwordForCube(*bottomCube);
+    drawSwordForCube(swordPixels, *bottomCube);
     
     // top cube gets a sword interpolated through the intersection distance
-    drawSwordForCube(*topCube, deformationInterpolationPoints);
+    drawSwordForCube(swordPixels, *topCube, deformationInterpolationPoints);
 
-    drawBuffer.end();
-    
-    // extract sword data as grayscale pixels
-    ofPixels swordPixels;
-    drawBuffer.readToPixels(swordPixels);
-    swordPixels.setNumChannels(1);
-    
     // draw cube footprints as depressions into a white background.
     // footprints include clearings and touch-sensitive risers
-    drawBuffer.begin();
-    ofBackground(255);
+    PinRasterizer &drawBuffer = clearingsLayer;
+    drawBuffer.clear(255);
 
     // top cube's footprint
     if (topCube->isTouched) {
         int clearingHeight = max(0, topCubeRiserHeight - 40);
-        setCubeHeight(*topCube, clearingHeight, 1.5);
-        setCubeHeight(*topCube, clearingHeight + 40);
+        setCubeHeight(drawBuffer, *topCube, clearingHeight, 1.5);
+        setCubeHeight(drawBuffer, *topCube, clearingHeight + 40);
     } else {
-        setCubeHeight(*topCube, topCubeRiserHeight, 1.5);
+        setCubeHeight(drawBuffer, *topCube, topCubeRiserHeight, 1.5);
     }
     
     // bottom cube's footprint
-    setCubeHeight(*bottomCube, 0, 1.5);
+    setCubeHeight(drawBuffer, *bottomCube, 0, 1.5);
     if (bottomCube->isTouched) {
-        setCubeHeight(*bottomCube, 40);
+        setCubeHeight(drawBuffer, *bottomCube, 40);
     }
-    drawBuffer.end();
-    
-    // extract cube footprint data as grayscale pixels
-    ofPixels cubeFootprintPixels;
-    drawBuffer.readToPixels(cubeFootprintPixels);
-    cubeFootprintPixels.setNumChannels(1);
     
     // cap sword pixel heights at footprint pixel depressions
-    for (int i = 0; i < swordPixels.size(); i++) {
-        if (swordPixels[i] > cubeFootprintPixels[i]) {
-            swordPixels[i] = cubeFootprintPixels[i];
-        }
-    }
-    
-    // draw the swords
-    ofSetColor(255);
-    ofImage(swordPixels).draw(0,0);
+    heightMapCompositor.pushLayer(swordPixels, BLEND_REPLACE);
+    heightMapCompositor.pushLayer(drawBuffer, BLEND_MIN);
 }
 
 void HybridTokens::keyPressed(int key) {
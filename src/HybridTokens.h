@@ -14,8 +14,9 @@
 #include "CameraCalibration.h"
 #include "Rectangle.h"
 #include "DrawingUtils.h"
-#include "ofFbo.h"
-#include "ofxKCore.h"
+#include "PinRasterizer.h"
+#include "ConvexPolygon.h"
+#include "HeightMapCompositor.h"
 
 
 enum HybridTokensMode {
@@ -37,6 +38,7 @@ public:
     void drawHeightMap();
     void drawGraphics();
     void update(float dt);
+    bool composeHeightMap(HeightMapCompositor &compositor);
 
     void keyPressed(int key);
 
@@ -50,24 +52,30 @@ public:
 
 private:
     KinectTracker *kinectTracker;
-    ofFbo pinHeightMapImage;                  // FBO where we render height map
-    ofFbo cubeFootprintsFbo;                  // FBO describing space covered by cubes
-    ofPixels cubeFootprintPixels;             // pixels object of cube locations, to avoid painting on cubes
+    HeightMapCompositor heightMapCompositor;  // composites the layers below into the height map
+    PinRasterizer swordsLayer;                // swords, or the swords' union
+    PinRasterizer overlayLayer;               // shapes combined on top of the swords
+    PinRasterizer clearingsLayer;             // cube footprint depressions in a white background
+    PinRasterizer risersLayer;                // touched cube risers
+    PinRasterizer heightMapCanvas;            // pin resolution canvas holding the composited height map
+    PinRasterizer cubeFootprintsCanvas;       // canvas describing space covered by cubes, to avoid painting on cubes
+    HeightMapCompositor reprojectionCompositor;
+    PinRasterizer reprojectionHeightsCanvas;  // height map with cubes stacked on top, for reprojection
+    ofImage pinHeightMapImage;                // height map content uploaded for drawing
     ofPixels pinHeightMapContentPixels;       // pixels object for computing on pin height map content
     ofPixels pinGraphicsPixels;               // pixels object where we render graphics
     ofPixels reprojectedPinGraphicsPixels;    // pixels object whose graphics account for the underlying pin heights
 
     void updateGraphics();
-    void setCubeHeight(Cube &cube, int height, float edgeLengthMultiplier = 1.0);
-    void setCubeHeights(int height, float edgeLengthMultiplier = 1.0, TouchCondition touchCondition=UNDEFINED);
-    void drawSword(int height=STANDARD_CUBE_HEIGHT, int farHeight=-1);
-    void drawSword(vector<pair<float, float> > &interpolationPoints);
-    void drawSwordForCube(Cube &cube, int height=STANDARD_CUBE_HEIGHT, int farHeight=-1);
-    void drawSwordForCube(Cube &cube, vector<pair<float, float> > &interpolationPoints);
+    void setCubeHeight(PinRasterizer &canvas, Cube &cube, int height, float edgeLengthMultiplier = 1.0);
+    void setCubeHeights(PinRasterizer &canvas, int height, float edgeLengthMultiplier = 1.0, TouchCondition touchCondition=UNDEFINED);
+    void drawSword(PinRasterizer &canvas, int height=STANDARD_CUBE_HEIGHT, int farHeight=-1);
+    void drawSword(PinRasterizer &canvas, vector<pair<float, float> > &interpolationPoints);
+    void drawSwordForCube(PinRasterizer &canvas, Cube &cube, int height=STANDARD_CUBE_HEIGHT, int farHeight=-1);
+    void drawSwordForCube(PinRasterizer &canvas, Cube &cube, vector<pair<float, float> > &interpolationPoints);
     void drawStandardClearingsAndRisers();
-    void getSwordsIntersectionAndUnion(ofPixels &swordsIntersection, ofPixels &swordsUnion);
+    void getSwordPolygons(vector<ConvexPolygon> &swords);
     void getSwordsAxesIntersectionPoint(Cube &firstCube, Cube &secondCube, ofPoint &dst);
-    void getCenterOfImageBlob(ofPixels &thresholdedPixels, ofPoint &dst);
     void drawSwords();
     void drawBooleanSwords();
     void drawFlexibleSwords(int height=STANDARD_CUBE_HEIGHT);
@@ -77,7 +85,6 @@ private:
     TiltDirection getPhysicsSwordTiltDirection(Cube &topCube, Cube &bottomCube);
 
     Rectangle swordRectangle;
-    ContourFinder blobFinder;
 
     char pinColorIfHigh[3] = {255, 135, 0}; // yellow
     char pinColorIfOn[3] = {255, 12, 16}; // red
@@ -91,8 +98,6 @@ private:
 
     float flexibleExtensionSize;
 
-    bool initializedInUpdate = false; // hack to fix an ofPixels bug. see .cpp for details
-
     int physicsTopSwordHeightNearCube = 0;
     int physicsTopSwordHeightFarFromCube = 0;
 
@@ -9,6 +9,10 @@
 
 #include "CalibrationUtils.h"
 #include <cmath>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 //set some default values
@@ -17,14 +21,23 @@ CalibrationUtils::CalibrationUtils()
 	//Default values
 	_camWidth = 320;
 	_camHeight = 240;
+
+	screenPoints = NULL;
+	cameraPoints = NULL;
+	triangles = NULL;
+	cameraToScreenMap = NULL;
+	cameraToScreenCellValid = NULL;
+	bCameraToScreenMapComputed = false;
+	bTriangleIndexBuilt = false;
 }
 
 CalibrationUtils::~CalibrationUtils()
 {
-    //delete screenPoints;
-	//delete cameraPoints;
-    //delete triangles;
-	//delete cameraToScreenMap;
+	delete [] screenPoints;
+	delete [] cameraPoints;
+	delete [] triangles;
+	delete [] cameraToScreenMap;
+	delete [] cameraToScreenCellValid;
 }
 
 //--------------------------------------------------------------
@@ -105,7 +118,7 @@ void CalibrationUtils::loadXMLSettings()
 
 	//Set the camera calibated box.
 	calculateBox();
-//	computeCameraToScreenMap();
+	computeCameraToScreenMap();
 }
 
 
@@ -123,7 +136,17 @@ void CalibrationUtils::setScreenBBox(rect2df &box)
 //Compute a map of camera to screen coordinates
 void CalibrationUtils::computeCameraToScreenMap()
 {
+	bCameraToScreenMapComputed = false;
+
+	//the map is filled through the triangle index, which must match the current camera points
+	buildTriangleIndex();
+
+	delete [] cameraToScreenMap;
+	delete [] cameraToScreenCellValid;
 	cameraToScreenMap = new vector2df[_camWidth * _camHeight];
+	cameraToScreenCellValid = new unsigned char[_camWidth * _camHeight];
+
+	unsigned char* sampleValid = new unsigned char[_camWidth * _camHeight];
 
 	int p = 0;
 	for(int y = 0; y < _camHeight; y++)
@@ -135,12 +158,201 @@ void CalibrationUtils::computeCameraToScreenMap()
 			float transformedY = (float)y;
 
 			//convert camera to screen space for all possible camera positions
-			cameraToScreenSpace(transformedX, transformedY);
+			sampleValid[p] = interpolateWithinMesh(transformedX, transformedY) ? 1 : 0;
 			//save these into a map of transformed camera to screen space positions
 			cameraToScreenMap[p] = vector2df(transformedX, transformedY);
 			p++;
 		}
 	}
+
+	//a cell (x, y)-(x+1, y+1) can be interpolated only if all four of its samples are inside the mesh
+	for(int y = 0; y < _camHeight; y++)
+	{
+		for(int x = 0; x < _camWidth; x++)
+		{
+			p = x + y * _camWidth;
+			cameraToScreenCellValid[p] = (x + 1 < _camWidth && y + 1 < _camHeight &&
+				sampleValid[p] && sampleValid[p + 1] && sampleValid[p + _camWidth] && sampleValid[p + _camWidth + 1]) ? 1 : 0;
+		}
+	}
+	delete [] sampleValid;
+
+	bCameraToScreenMapComputed = true;
+}
+
+//Bilinearly interpolate the dense map; returns false if the point is outside the map or its cell is invalid
+bool CalibrationUtils::lookupCameraToScreenMap(float &x, float &y)
+{
+	if(!bCameraToScreenMapComputed || !(x >= 0) || !(y >= 0) || x >= _camWidth - 1 || y >= _camHeight - 1)
+		return false;
+
+	int cellX = (int)x;
+	int cellY = (int)y;
+	int p = cellX + cellY * _camWidth;
+	if(!cameraToScreenCellValid[p])
+		return false;
+
+	float fx = x - cellX;
+	float fy = y - cellY;
+	vector2df &a = cameraToScreenMap[p];
+	vector2df &b = cameraToScreenMap[p + 1];
+	vector2df &c = cameraToScreenMap[p + _camWidth];
+	vector2df &d = cameraToScreenMap[p + _camWidth + 1];
+
+	float topX = a.X + (b.X - a.X) * fx;
+	float topY = a.Y + (b.Y - a.Y) * fx;
+	float bottomX = c.X + (d.X - c.X) * fx;
+	float bottomY = c.Y + (d.Y - c.Y) * fx;
+	x = topX + (bottomX - topX) * fy;
+	y = topY + (bottomY - topY) * fy;
+	return true;
+}
+
+//Transform arrays of camera space coordinates in place. Points inside the dense map are
+//interpolated four at a time; anything else falls back to the triangle mesh
+void CalibrationUtils::cameraToScreenPositions(float *x, float *y, int count)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	if(bCameraToScreenMapComputed)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 maxX = _mm_set1_ps((float)(_camWidth - 1));
+		const __m128 maxY = _mm_set1_ps((float)(_camHeight - 1));
+
+		for(; i + 4 <= count; i += 4)
+		{
+			__m128 xs = _mm_loadu_ps(x + i);
+			__m128 ys = _mm_loadu_ps(y + i);
+
+			//lanes outside the map are handled by the scalar path below
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(xs, zero), _mm_cmplt_ps(xs, maxX)),
+									   _mm_and_ps(_mm_cmpge_ps(ys, zero), _mm_cmplt_ps(ys, maxY)));
+			int insideMask = _mm_movemask_ps(inside);
+
+			//truncation is floor for the in-range lanes; clamp the others so their indices stay in bounds
+			__m128i cellX = _mm_cvttps_epi32(_mm_and_ps(xs, inside));
+			__m128i cellY = _mm_cvttps_epi32(_mm_and_ps(ys, inside));
+			__m128 fx = _mm_sub_ps(xs, _mm_cvtepi32_ps(cellX));
+			__m128 fy = _mm_sub_ps(ys, _mm_cvtepi32_ps(cellY));
+
+			int cellXs[4], cellYs[4];
+			_mm_storeu_si128((__m128i *)cellXs, cellX);
+			_mm_storeu_si128((__m128i *)cellYs, cellY);
+
+			//gather the four corner samples of each lane's cell
+			float ax[4], ay[4], bx[4], by[4], cx[4], cy[4], dx[4], dy[4];
+			for(int k = 0; k < 4; k++)
+			{
+				int q = cellXs[k] + cellYs[k] * _camWidth;
+				if(!(insideMask & (1 << k)) || !cameraToScreenCellValid[q])
+				{
+					insideMask &= ~(1 << k);
+					q = 0;
+				}
+				ax[k] = cameraToScreenMap[q].X;                  ay[k] = cameraToScreenMap[q].Y;
+				bx[k] = cameraToScreenMap[q + 1].X;              by[k] = cameraToScreenMap[q + 1].Y;
+				cx[k] = cameraToScreenMap[q + _camWidth].X;      cy[k] = cameraToScreenMap[q + _camWidth].Y;
+				dx[k] = cameraToScreenMap[q + _camWidth + 1].X;  dy[k] = cameraToScreenMap[q + _camWidth + 1].Y;
+			}
+
+			__m128 topX = _mm_add_ps(_mm_loadu_ps(ax), _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bx), _mm_loadu_ps(ax)), fx));
+			__m128 topY = _mm_add_ps(_mm_loadu_ps(ay), _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(by), _mm_loadu_ps(ay)), fx));
+			__m128 bottomX = _mm_add_ps(_mm_loadu_ps(cx), _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(dx), _mm_loadu_ps(cx)), fx));
+			__m128 bottomY = _mm_add_ps(_mm_loadu_ps(cy), _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(dy), _mm_loadu_ps(cy)), fx));
+			float resultX[4], resultY[4];
+			_mm_storeu_ps(resultX, _mm_add_ps(topX, _mm_mul_ps(_mm_sub_ps(bottomX, topX), fy)));
+			_mm_storeu_ps(resultY, _mm_add_ps(topY, _mm_mul_ps(_mm_sub_ps(bottomY, topY), fy)));
+
+			for(int k = 0; k < 4; k++)
+			{
+				if(insideMask & (1 << k))
+				{
+					x[i + k] = resultX[k];
+					y[i + k] = resultY[k];
+				}
+				else
+				{
+					cameraToScreenSpace(x[i + k], y[i + k]);
+				}
+			}
+		}
+	}
+#endif
+
+	for(; i < count; i++)
+		cameraToScreenPosition(x[i], y[i]);
+}
+
+//Bucket every mesh triangle into the uniform grid cells its bounding box overlaps
+void CalibrationUtils::buildTriangleIndex()
+{
+	bTriangleIndexBuilt = false;
+	if(GRID_X <= 0 || GRID_Y <= 0)
+		return;
+
+	//bounds of the camera-space mesh
+	float minX = cameraPoints[0].X, maxX = cameraPoints[0].X;
+	float minY = cameraPoints[0].Y, maxY = cameraPoints[0].Y;
+	for(int i = 1; i < GRID_POINTS; i++)
+	{
+		minX = MIN(minX, cameraPoints[i].X);
+		maxX = MAX(maxX, cameraPoints[i].X);
+		minY = MIN(minY, cameraPoints[i].Y);
+		maxY = MAX(maxY, cameraPoints[i].Y);
+	}
+
+	//one index cell per mesh cell keeps each bucket to a few triangles
+	triangleIndexCellsX = GRID_X;
+	triangleIndexCellsY = GRID_Y;
+	triangleIndexMinX = minX;
+	triangleIndexMinY = minY;
+	triangleIndexCellWidth = MAX(maxX - minX, 1e-3f) / triangleIndexCellsX;
+	triangleIndexCellHeight = MAX(maxY - minY, 1e-3f) / triangleIndexCellsY;
+
+	int numCells = triangleIndexCellsX * triangleIndexCellsY;
+	triangleIndexCellStart.assign(numCells + 1, 0);
+
+	//two passes: count the entries of each cell, then fill them in
+	for(int pass = 0; pass < 2; pass++)
+	{
+		vector<int> cellFill;
+		if(pass == 1)
+		{
+			for(int c = 0; c < numCells; c++)
+				triangleIndexCellStart[c + 1] += triangleIndexCellStart[c];
+			triangleIndexEntries.resize(triangleIndexCellStart[numCells]);
+			cellFill.assign(triangleIndexCellStart.begin(), triangleIndexCellStart.end() - 1);
+		}
+
+		for(int t = 0; t < GRID_INDICES; t += 3)
+		{
+			vector2df &a = cameraPoints[triangles[t]];
+			vector2df &b = cameraPoints[triangles[t+1]];
+			vector2df &c = cameraPoints[triangles[t+2]];
+			int x0 = (int)((MIN(a.X, MIN(b.X, c.X)) - triangleIndexMinX) / triangleIndexCellWidth);
+			int x1 = (int)((MAX(a.X, MAX(b.X, c.X)) - triangleIndexMinX) / triangleIndexCellWidth);
+			int y0 = (int)((MIN(a.Y, MIN(b.Y, c.Y)) - triangleIndexMinY) / triangleIndexCellHeight);
+			int y1 = (int)((MAX(a.Y, MAX(b.Y, c.Y)) - triangleIndexMinY) / triangleIndexCellHeight);
+			x0 = MAX(0, x0); y0 = MAX(0, y0);
+			x1 = MIN(triangleIndexCellsX - 1, x1); y1 = MIN(triangleIndexCellsY - 1, y1);
+
+			for(int cy = y0; cy <= y1; cy++)
+			{
+				for(int cx = x0; cx <= x1; cx++)
+				{
+					int cell = cx + cy * triangleIndexCellsX;
+					if(pass == 0)
+						triangleIndexCellStart[cell + 1]++;
+					else
+						triangleIndexEntries[cellFill[cell]++] = t;
+				}
+			}
+		}
+	}
+
+	bTriangleIndexBuilt = true;
 }
 
 void CalibrationUtils::setGrid(int x, int y)
@@ -151,6 +363,13 @@ void CalibrationUtils::setGrid(int x, int y)
 	GRID_POINTS = ((GRID_X+1) * (GRID_Y+1));
     GRID_INDICES = (GRID_X * GRID_Y * 3 * 2);
 
+	//the map and triangle index describe the old mesh until they are recomputed
+	bCameraToScreenMapComputed = false;
+	bTriangleIndexBuilt = false;
+
+	delete [] screenPoints;
+	delete [] cameraPoints;
+	delete [] triangles;
 	screenPoints = new vector2df[GRID_POINTS];
 	cameraPoints = new vector2df[GRID_POINTS];
 	triangles    = new int[GRID_INDICES];
@@ -168,6 +387,9 @@ void CalibrationUtils::setCamRes(int camWidth = 320, int camHeight = 240)
 {
 	_camWidth = camWidth;
 	_camHeight = camHeight;
+
+	//the map is sized and sampled for the old resolution until it is recomputed
+	bCameraToScreenMapComputed = false;
 }
 
 void CalibrationUtils::initTriangles()
@@ -247,6 +469,9 @@ float CalibrationUtils::getScreenScale()
 
 void CalibrationUtils::cameraToScreenPosition(float &x, float &y)
 {
+	if(lookupCameraToScreenMap(x, y))
+		return;
+
 	cameraToScreenSpace(x, y);
 
 	//is this right to avoid boundingbox overflow? this overflow occurs due to new angle box
@@ -286,6 +511,35 @@ void CalibrationUtils::transformDimension(float &width, float &height)
 	height = std::fabs(ulY - lrY);
 }
 
+//Batch version of transformDimension: transforms every box's corners with one cameraToScreenPositions call
+void CalibrationUtils::transformDimensions(float *width, float *height, int count)
+{
+	if(count <= 0)
+		return;
+
+	float centerX = ((maxBoxX - minBoxX)/2) + minBoxX;
+	float centerY = ((maxBoxY - minBoxY)/2) + minBoxY;
+
+	//upper left corners in [0, count), lower right corners in [count, 2 * count)
+	std::vector<float> cornerX(count * 2);
+	std::vector<float> cornerY(count * 2);
+	for(int i = 0; i < count; i++)
+	{
+		cornerX[i] = centerX - width[i] * 0.5f;
+		cornerY[i] = centerY - height[i] * 0.5f;
+		cornerX[count + i] = centerX + width[i] * 0.5f;
+		cornerY[count + i] = centerY + height[i] * 0.5f;
+	}
+
+	cameraToScreenPositions(&cornerX[0], &cornerY[0], count * 2);
+
+	for(int i = 0; i < count; i++)
+	{
+		width[i] = std::fabs(cornerX[count + i] - cornerX[i]);
+		height[i] = std::fabs(cornerY[i] - cornerY[count + i]);
+	}
+}
+
 void CalibrationUtils::calculateBox()
 {
 	//reset variables
@@ -305,6 +559,17 @@ void CalibrationUtils::calculateBox()
 
 // Transforms a camera space coordinate into a screen space coord
 void CalibrationUtils::cameraToScreenSpace(float &x, float &y)
+{
+	if(interpolateWithinMesh(x, y))
+		return;
+
+	x = 0;
+	y = 0;
+	// FIXME: what to do in the case that it's outside the mesh?
+}
+
+// Barycentric interpolation within the containing mesh triangle; returns false if outside the mesh
+bool CalibrationUtils::interpolateWithinMesh(float &x, float &y)
 {
 	vector2df pt(x, y);
 	int t = findTriangleWithin(pt);
@@ -335,11 +600,9 @@ void CalibrationUtils::cameraToScreenSpace(float &x, float &y)
 
 		x = transformedPos.X;
 		y = transformedPos.Y;
-		return;
+		return true;
 	}
-	x = 0;
-	y = 0;
-	// FIXME: what to do in the case that it's outside the mesh?
+	return false;
 }
 
 bool CalibrationUtils::isPointInTriangle(vector2df p, vector2df a, vector2df b, vector2df c)
@@ -352,6 +615,27 @@ bool CalibrationUtils::isPointInTriangle(vector2df p, vector2df a, vector2df b,
 
 int CalibrationUtils::findTriangleWithin(vector2df pt)
 {
+	//camera points move while calibrating, so only trust the index outside of calibration
+	if(bTriangleIndexBuilt && !bCalibrating)
+	{
+		int cx = (int)floor((pt.X - triangleIndexMinX) / triangleIndexCellWidth);
+		int cy = (int)floor((pt.Y - triangleIndexMinY) / triangleIndexCellHeight);
+		//points exactly on the far mesh boundary belong to the last cell
+		if(cx == triangleIndexCellsX) cx--;
+		if(cy == triangleIndexCellsY) cy--;
+		if(cx < 0 || cy < 0 || cx >= triangleIndexCellsX || cy >= triangleIndexCellsY)
+			return -1;
+
+		int cell = cx + cy * triangleIndexCellsX;
+		for(int e = triangleIndexCellStart[cell]; e < triangleIndexCellStart[cell + 1]; e++)
+		{
+			int t = triangleIndexEntries[e];
+			if(isPointInTriangle(pt, cameraPoints[triangles[t]], cameraPoints[triangles[t+1]], cameraPoints[triangles[t+2]]) )
+				return t;
+		}
+		return -1;
+	}
+
 	for(int t = 0; t < GRID_INDICES; t += 3)
 	{
 		if(isPointInTriangle(pt, cameraPoints[triangles[t]], cameraPoints[triangles[t+1]], cameraPoints[triangles[t+2]]) )
@@ -377,7 +661,7 @@ void CalibrationUtils::nextCalibrationStep()
 			calibrationStep = 0;
 			saveCalibration();
 			calculateBox();
-// 			computeCameraToScreenMap();
+			computeCameraToScreenMap();
 
             saveCalibration();
 		}
@@ -15,6 +15,7 @@
 //Used other calibration
 #include "rect2d.h"
 #include "vector2d.h"
+#include <vector>
 
 class CalibrationUtils
 {
@@ -33,8 +34,10 @@ class CalibrationUtils
 		void initTriangles();
 		void computeCameraToScreenMap();
 		void cameraToScreenPosition(float &x, float &y);
+		void cameraToScreenPositions(float *x, float *y, int count); // batch version of cameraToScreenPosition
 		void cameraToScreenSpace(float &x, float &y);
 		void transformDimension(float &width, float &height);
+		void transformDimensions(float *width, float *height, int count); // batch version of transformDimension
 		void initScreenPoints();
 		void initCameraPoints(int camWidth, int camHeight);
 		void calculateBox(); //calculates min/max calibration rect
@@ -73,7 +76,27 @@ class CalibrationUtils
 
 	private:
 
+		// dense camera to screen map, sampled at every camera pixel and bilinearly interpolated
+		// between samples. cells touching a pixel outside the calibration mesh are marked invalid
+		// and fall back to the exact triangle lookup
 		vector2df* cameraToScreenMap;
+		unsigned char* cameraToScreenCellValid;
+		bool bCameraToScreenMapComputed;
+		bool lookupCameraToScreenMap(float &x, float &y);
+		bool interpolateWithinMesh(float &x, float &y);
+
+		// uniform grid over camera space listing the mesh triangles overlapping each cell, so
+		// findTriangleWithin only tests a handful of triangles instead of the whole mesh
+		void buildTriangleIndex();
+		bool bTriangleIndexBuilt;
+		int triangleIndexCellsX;
+		int triangleIndexCellsY;
+		float triangleIndexMinX;
+		float triangleIndexMinY;
+		float triangleIndexCellWidth;
+		float triangleIndexCellHeight;
+		std::vector<int> triangleIndexCellStart;	// cell c lists entries [start[c], start[c+1])
+		std::vector<int> triangleIndexEntries;		// triangle offsets into triangles[]
 		//set Calibration Points
 		int GRID_INDICES;
 		int* triangles;	// GRID_X * GRID_Y * 2t * 3i indices for the points
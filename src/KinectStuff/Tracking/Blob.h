@@ -25,6 +25,8 @@ public:
     float               widthScale;  // width of blob's original image
     float               heightScale; // height of blob's original image
     float               angle;
+    float               mu20, mu11, mu02;   // central second-order moments, normalized by area
+    float               c4Real, c4Imag;     // fourth-order complex moment, normalized by area (see ContourFinder)
     float				maccel;  //distance traveled since last frame
     float				age;     //how long the blob has been at war
     float				sitting; //how long hes been sitting in the same place
@@ -43,6 +45,8 @@ public:
     Blob() 
     {
         area 		= 0.0f;
+        mu20 = mu11 = mu02 = 0.0f;
+        c4Real = c4Imag = 0.0f;
         length 		= 0.0f;
         hole 		= false;
         nPts        = 0;
@@ -8,6 +8,43 @@
 */
 
 #include "ContourFinder.h"
+#include <complex>
+
+//--------------------------------------------------------------------------------
+// area-normalized fourth-order complex moment (1/A) * integral of (z - c)^4 dA of a
+// closed polygon, evaluated exactly along its contour with Green's theorem. for a
+// square rotated by phi the result is proportional to -exp(4 i phi), so it recovers
+// the orientation of 4-fold symmetric shapes whose second-order moments are isotropic.
+static void polygonFourthOrderMoment(vector<ofPoint> &pts, ofPoint &center, float &re, float &im) {
+	typedef std::complex<double> cplx;
+
+	// 3-point gauss-legendre quadrature is exact for the degree-5 integrand on each edge
+	const double nodes[3] = {0.5 - 0.5 * sqrt(0.6), 0.5, 0.5 + 0.5 * sqrt(0.6)};
+	const double weights[3] = {5.0 / 18, 8.0 / 18, 5.0 / 18};
+
+	cplx momentSum = 0;
+	cplx areaSum = 0;
+	int n = pts.size();
+	for (int i = 0; i < n; i++) {
+		cplx a(pts[i].x - center.x, pts[i].y - center.y);
+		cplx b(pts[(i + 1) % n].x - center.x, pts[(i + 1) % n].y - center.y);
+		cplx d = b - a;
+		for (int k = 0; k < 3; k++) {
+			cplx z = a + nodes[k] * d;
+			momentSum += weights[k] * z * z * z * z * conj(z) * d;
+		}
+		areaSum += conj(a + 0.5 * d) * d;
+	}
+
+	// the common 1/2i factor of both contour integrals cancels in the ratio
+	if (abs(areaSum) < 1e-9) {
+		re = im = 0;
+		return;
+	}
+	cplx normalized = momentSum / areaSum;
+	re = normalized.real();
+	im = normalized.imag();
+}
 
 //--------------------------------------------------------------------------------
 ContourFinder::ContourFinder(){
@@ -133,6 +170,9 @@ int ContourFinder::findContours(	ofxCvGrayscaleImage&  input,
 			blob.centroid.y 		 = (myMoments->m01 / myMoments->m00);
 			blob.lastCentroid.x 	 = 0;
 			blob.lastCentroid.y 	 = 0;
+			blob.mu20				 = myMoments->mu20 / myMoments->m00;
+			blob.mu11				 = myMoments->mu11 / myMoments->m00;
+			blob.mu02				 = myMoments->mu02 / myMoments->m00;
 
 			// get the points for the blob:
 			CvPoint           pt;
@@ -144,6 +184,7 @@ int ContourFinder::findContours(	ofxCvGrayscaleImage&  input,
 				blob.pts.push_back( ofPoint((float)pt.x, (float)pt.y) );
 			}
 			blob.nPts = blob.pts.size();
+			polygonFourthOrderMoment(blob.pts, blob.centroid, blob.c4Real, blob.c4Imag);
 
 			objects.push_back(blob);
 			
@@ -182,6 +223,10 @@ int ContourFinder::findContours(	ofxCvGrayscaleImage&  input,
 				blob.centroid.y 		 = (myMoments->m01 / myMoments->m00);
 				blob.lastCentroid.x 	 = 0;
 				blob.lastCentroid.y 	 = 0;
+				// central moments come for free with the centroid; keep them for pose estimation
+				blob.mu20				 = myMoments->mu20 / myMoments->m00;
+				blob.mu11				 = myMoments->mu11 / myMoments->m00;
+				blob.mu02				 = myMoments->mu02 / myMoments->m00;
 				
 				// get the points for the blob:
 				CvPoint           pt;
@@ -193,6 +238,7 @@ int ContourFinder::findContours(	ofxCvGrayscaleImage&  input,
 					blob.pts.push_back( ofPoint((float)pt.x, (float)pt.y) );
 				}
 				blob.nPts = blob.pts.size();
+				polygonFourthOrderMoment(blob.pts, blob.centroid, blob.c4Real, blob.c4Imag);
 				
 				blobs.push_back(blob);
 			}
@@ -52,6 +52,20 @@ void BlobTracker::track(ContourFinder* newBlobs){
 		}
 	}
 	
+	//convert every object's centroid and size to screen space in one batch
+	std::vector<float> objectX(newBlobs->nObjects), objectY(newBlobs->nObjects);
+	std::vector<float> objectWidth(newBlobs->nObjects), objectHeight(newBlobs->nObjects);
+	for (int i = 0; i < newBlobs->nObjects; i++){
+		objectX[i] = newBlobs->objects[i].centroid.x;
+		objectY[i] = newBlobs->objects[i].centroid.y;
+		objectWidth[i] = newBlobs->objects[i].angleBoundingRect.width;
+		objectHeight[i] = newBlobs->objects[i].angleBoundingRect.height;
+	}
+	if(newBlobs->nObjects > 0){
+		calibrate->cameraToScreenPositions(&objectX[0], &objectY[0], newBlobs->nObjects);
+		calibrate->transformDimensions(&objectWidth[0], &objectHeight[0], newBlobs->nObjects);
+	}
+
 	//handle the object tracking if present
 	for (int i = 0; i < newBlobs->nObjects; i++){
 		int ID = newBlobs->objects[i].id;
@@ -67,17 +81,17 @@ void BlobTracker::track(ContourFinder* newBlobs){
 			
 			
 			//Camera to Screen Position Conversion
-			calibrate->cameraToScreenPosition(calibratedObjects[i].centroid.x,calibratedObjects[i].centroid.y);
-			calibrate->transformDimension(calibratedObjects[i].angleBoundingRect.width,calibratedObjects[i].angleBoundingRect.height);
+			calibratedObjects[i].centroid.x = objectX[i];
+			calibratedObjects[i].centroid.y = objectY[i];
+			calibratedObjects[i].angleBoundingRect.width = objectWidth[i];
+			calibratedObjects[i].angleBoundingRect.height = objectHeight[i];
 		} else { //Do all the calculations
 			float xOld = trackedObjects[ID].centroid.x;
 			float yOld = trackedObjects[ID].centroid.y;
 
-			float xNew = newBlobs->objects[i].centroid.x;
-			float yNew = newBlobs->objects[i].centroid.y;
-
-			//converting xNew and yNew to calibrated ones
-			calibrate->cameraToScreenPosition(xNew,yNew);
+			//calibrated xNew and yNew
+			float xNew = objectX[i];
+			float yNew = objectY[i];
 
 			double dx = xNew-xOld;
 			double dy = yNew-yOld;
@@ -88,9 +102,10 @@ void BlobTracker::track(ContourFinder* newBlobs){
 
 			calibratedObjects[i].maccel = sqrtf((dx*dx+dy*dy)/(now - trackedObjects[ID].lastTimeTimeWasChecked));
 
-			
-			calibrate->cameraToScreenPosition(calibratedObjects[i].centroid.x,calibratedObjects[i].centroid.y);
-			calibrate->transformDimension(calibratedObjects[i].angleBoundingRect.width,calibratedObjects[i].angleBoundingRect.height);
+			calibratedObjects[i].centroid.x = xNew;
+			calibratedObjects[i].centroid.y = yNew;
+			calibratedObjects[i].angleBoundingRect.width = objectWidth[i];
+			calibratedObjects[i].angleBoundingRect.height = objectHeight[i];
 		}
 
 		trackedObjects[ID] = newBlobs->objects[i];
@@ -329,69 +344,41 @@ void BlobTracker::track(ContourFinder* newBlobs){
 					if(trackedBlobs[i].sitting > 1.0f)
 					{
 						//SEND BLOB HELD EVENT
-						TouchEvents.messenger = trackedBlobs[i];
-
-						if(isCalibrating)
-						{
-							TouchEvents.RAWmessenger = trackedBlobs[i];
-							TouchEvents.notifyRAWTouchHeld(NULL);
-						}
+						Blob messenger = trackedBlobs[i];
 
-						//calibrated values
-						calibrate->transformDimension(TouchEvents.messenger.boundingRect.width, TouchEvents.messenger.boundingRect.height);
-						calibrate->cameraToScreenPosition(TouchEvents.messenger.centroid.x, TouchEvents.messenger.centroid.y);
-						calibrate->cameraToScreenPosition(TouchEvents.messenger.lastCentroid.x, TouchEvents.messenger.lastCentroid.y);
-						
 						//Calibrated dx/dy
-						TouchEvents.messenger.D.set(trackedBlobs[i].centroid.x - trackedBlobs[i].lastCentroid.x, 
-												trackedBlobs[i].centroid.y - trackedBlobs[i].lastCentroid.y);
+						messenger.D.set(trackedBlobs[i].centroid.x - trackedBlobs[i].lastCentroid.x, 
+										trackedBlobs[i].centroid.y - trackedBlobs[i].lastCentroid.y);
 
 						//calibrated acceleration
-						ofPoint tD = TouchEvents.messenger.D;
-						TouchEvents.messenger.maccel = sqrtf((tD.x*tD.x)+(tD.y*tD.y)) / (now - TouchEvents.messenger.lastTimeTimeWasChecked);
-						TouchEvents.messenger.lastTimeTimeWasChecked = now;
+						ofPoint tD = messenger.D;
+						messenger.maccel = sqrtf((tD.x*tD.x)+(tD.y*tD.y)) / (now - messenger.lastTimeTimeWasChecked);
+						messenger.lastTimeTimeWasChecked = now;
 
-						//add to calibration map
-						calibratedBlobs[TouchEvents.messenger.id] = TouchEvents.messenger;
+						//calibrated values are filled in with the rest of this frame's events
+						queueTouchEvent(trackedBlobs[i], messenger, TOUCH_HELD);
 
                         //held event only happens once so set to -1
                         trackedBlobs[i].sitting = -1;
-
-						TouchEvents.notifyTouchHeld(NULL);
 					} 
 					else 
 					{
 						//printf("(%f, %f) -> (%f, %f) \n", trackedBlobs[i].lastCentroid.x, trackedBlobs[i].lastCentroid.y, trackedBlobs[i].centroid.x, trackedBlobs[i].centroid.y);
 
 						//SEND BLOB MOVED EVENT
-						TouchEvents.messenger = trackedBlobs[i];
-
-						if(isCalibrating)
-						{
-							TouchEvents.RAWmessenger = trackedBlobs[i];
-							TouchEvents.notifyRAWTouchMoved(NULL);
-						}
-
-						//calibrated values
-						calibrate->transformDimension(TouchEvents.messenger.boundingRect.width, TouchEvents.messenger.boundingRect.height);
-						calibrate->cameraToScreenPosition(TouchEvents.messenger.centroid.x, TouchEvents.messenger.centroid.y);
-						calibrate->cameraToScreenPosition(TouchEvents.messenger.lastCentroid.x, TouchEvents.messenger.lastCentroid.y);
+						Blob messenger = trackedBlobs[i];
 
 						//Calibrated dx/dy
-						TouchEvents.messenger.D.set(trackedBlobs[i].centroid.x - trackedBlobs[i].lastCentroid.x, 
-												trackedBlobs[i].centroid.y - trackedBlobs[i].lastCentroid.y);
+						messenger.D.set(trackedBlobs[i].centroid.x - trackedBlobs[i].lastCentroid.x, 
+										trackedBlobs[i].centroid.y - trackedBlobs[i].lastCentroid.y);
 
-						//printf("d(%0.4f, %0.4f)\n", TouchEvents.messenger.D.x, TouchEvents.messenger.D.y);
-				
 						//calibrated acceleration
-						ofPoint tD = TouchEvents.messenger.D;
-						TouchEvents.messenger.maccel = sqrtf((tD.x*tD.x)+(tD.y*tD.y)) / (now - TouchEvents.messenger.lastTimeTimeWasChecked);
-						TouchEvents.messenger.lastTimeTimeWasChecked = now;
-
-						//add to calibration map
-						calibratedBlobs[TouchEvents.messenger.id] = TouchEvents.messenger;
+						ofPoint tD = messenger.D;
+						messenger.maccel = sqrtf((tD.x*tD.x)+(tD.y*tD.y)) / (now - messenger.lastTimeTimeWasChecked);
+						messenger.lastTimeTimeWasChecked = now;
 
-						TouchEvents.notifyTouchMoved(NULL);
+						//calibrated values are filled in with the rest of this frame's events
+						queueTouchEvent(trackedBlobs[i], messenger, TOUCH_MOVED);
 					}
 					// AlexP
 					// The last lastTimeTimeWasChecked is updated at the end after all acceleration values are calculated
@@ -421,24 +408,13 @@ void BlobTracker::track(ContourFinder* newBlobs){
             //Set color
             newBlobs->blobs[i].color = rgbNum;
 
-			//Add to blob messenger
-			TouchEvents.messenger = newBlobs->blobs[i];
-
-			if(isCalibrating)
-			{
-				TouchEvents.RAWmessenger = newBlobs->blobs[i];
-				TouchEvents.notifyRAWTouchDown(NULL);
-			}
-            calibrate->transformDimension(TouchEvents.messenger.boundingRect.width, TouchEvents.messenger.boundingRect.height);
-            calibrate->cameraToScreenPosition(TouchEvents.messenger.centroid.x, TouchEvents.messenger.centroid.y);
-			//add to calibrated blob map
-			calibratedBlobs[TouchEvents.messenger.id] = TouchEvents.messenger;
-
-			//Send Event
-			TouchEvents.notifyTouchDown(NULL);
+			//Add to blob messenger, calibrated and sent with the rest of this frame's events
+			queueTouchEvent(newBlobs->blobs[i], newBlobs->blobs[i], TOUCH_DOWN);
 			trackedBlobs.push_back(newBlobs->blobs[i]);
 		}
 	}
+
+	sendTouchEvents(calibratedBlobs);
 	
 	
 	
@@ -650,65 +626,39 @@ void BlobTracker::track(ContourFinder* newBlobs){
 					//if blob has been 'holding/sitting' for 1 second send a held event
 					if(trackedFingers[i].sitting > 1.0f){
 						//SEND BLOB HELD EVENT
-						TouchEvents.messenger = trackedFingers[i];
-						
-						if(isCalibrating){
-							TouchEvents.RAWmessenger = trackedFingers[i];
-							TouchEvents.notifyRAWTouchHeld(NULL);
-						}
-						
-						//calibrated values
-						calibrate->transformDimension(TouchEvents.messenger.boundingRect.width, TouchEvents.messenger.boundingRect.height);
-						calibrate->cameraToScreenPosition(TouchEvents.messenger.centroid.x, TouchEvents.messenger.centroid.y);
-						calibrate->cameraToScreenPosition(TouchEvents.messenger.lastCentroid.x, TouchEvents.messenger.lastCentroid.y);
-						
+						Blob messenger = trackedFingers[i];
+
 						//Calibrated dx/dy
-						TouchEvents.messenger.D.set(trackedFingers[i].centroid.x - trackedFingers[i].lastCentroid.x, 
-													trackedFingers[i].centroid.y - trackedFingers[i].lastCentroid.y);
-						
+						messenger.D.set(trackedFingers[i].centroid.x - trackedFingers[i].lastCentroid.x, 
+										trackedFingers[i].centroid.y - trackedFingers[i].lastCentroid.y);
+
 						//calibrated acceleration
-						ofPoint tD = TouchEvents.messenger.D;
-						TouchEvents.messenger.maccel = sqrtf((tD.x*tD.x)+(tD.y*tD.y)) / (now - TouchEvents.messenger.lastTimeTimeWasChecked);
-						TouchEvents.messenger.lastTimeTimeWasChecked = now;
-						
-						//add to calibration map
-						calibratedFingers[TouchEvents.messenger.id] = TouchEvents.messenger;
-						
+						ofPoint tD = messenger.D;
+						messenger.maccel = sqrtf((tD.x*tD.x)+(tD.y*tD.y)) / (now - messenger.lastTimeTimeWasChecked);
+						messenger.lastTimeTimeWasChecked = now;
+
+						//calibrated values are filled in with the rest of this frame's events
+						queueTouchEvent(trackedFingers[i], messenger, TOUCH_HELD);
+
                         //held event only happens once so set to -1
                         trackedFingers[i].sitting = -1;
-						
-						TouchEvents.notifyTouchHeld(NULL);
 					} else {
 						//printf("(%f, %f) -> (%f, %f) \n", trackedBlobs[i].lastCentroid.x, trackedBlobs[i].lastCentroid.y, trackedBlobs[i].centroid.x, trackedBlobs[i].centroid.y);
 						
 						//SEND BLOB MOVED EVENT
-						TouchEvents.messenger = trackedFingers[i];
-						
-						if(isCalibrating) {
-							TouchEvents.RAWmessenger = trackedFingers[i];
-							TouchEvents.notifyRAWTouchMoved(NULL);
-						}
-						
-						//calibrated values
-						calibrate->transformDimension(TouchEvents.messenger.boundingRect.width, TouchEvents.messenger.boundingRect.height);
-						calibrate->cameraToScreenPosition(TouchEvents.messenger.centroid.x, TouchEvents.messenger.centroid.y);
-						calibrate->cameraToScreenPosition(TouchEvents.messenger.lastCentroid.x, TouchEvents.messenger.lastCentroid.y);
-						
+						Blob messenger = trackedFingers[i];
+
 						//Calibrated dx/dy
-						TouchEvents.messenger.D.set(trackedFingers[i].centroid.x - trackedFingers[i].lastCentroid.x, 
-													trackedFingers[i].centroid.y - trackedFingers[i].lastCentroid.y);
-						
-						//printf("d(%0.4f, %0.4f)\n", TouchEvents.messenger.D.x, TouchEvents.messenger.D.y);
-						
+						messenger.D.set(trackedFingers[i].centroid.x - trackedFingers[i].lastCentroid.x, 
+										trackedFingers[i].centroid.y - trackedFingers[i].lastCentroid.y);
+
 						//calibrated acceleration
-						ofPoint tD = TouchEvents.messenger.D;
-						TouchEvents.messenger.maccel = sqrtf((tD.x*tD.x)+(tD.y*tD.y)) / (now - TouchEvents.messenger.lastTimeTimeWasChecked);
-						TouchEvents.messenger.lastTimeTimeWasChecked = now;
-						
-						//add to calibration map
-						calibratedFingers[TouchEvents.messenger.id] = TouchEvents.messenger;
-						
-						TouchEvents.notifyTouchMoved(NULL);
+						ofPoint tD = messenger.D;
+						messenger.maccel = sqrtf((tD.x*tD.x)+(tD.y*tD.y)) / (now - messenger.lastTimeTimeWasChecked);
+						messenger.lastTimeTimeWasChecked = now;
+
+						//calibrated values are filled in with the rest of this frame's events
+						queueTouchEvent(trackedFingers[i], messenger, TOUCH_MOVED);
 					}
 					// AlexP
 					// The last lastTimeTimeWasChecked is updated at the end after all acceleration values are calculated
@@ -738,27 +688,91 @@ void BlobTracker::track(ContourFinder* newBlobs){
             //Set color
             newBlobs->fingers[i].color = rgbNum;
 			
-			//Add to blob messenger
-			TouchEvents.messenger = newBlobs->fingers[i];
-			
-			if(isCalibrating){
-				TouchEvents.RAWmessenger = newBlobs->fingers[i];
-				TouchEvents.notifyRAWTouchDown(NULL);
-			}
-            calibrate->transformDimension(TouchEvents.messenger.boundingRect.width, TouchEvents.messenger.boundingRect.height);
-            calibrate->cameraToScreenPosition(TouchEvents.messenger.centroid.x, TouchEvents.messenger.centroid.y);
-			//add to calibrated blob map
-			calibratedFingers[TouchEvents.messenger.id] = TouchEvents.messenger;
-			
-			//Send Event
-			TouchEvents.notifyTouchDown(NULL);
+			//Add to blob messenger, calibrated and sent with the rest of this frame's events
+			queueTouchEvent(newBlobs->fingers[i], newBlobs->fingers[i], TOUCH_DOWN);
 			trackedFingers.push_back(newBlobs->fingers[i]);
 		}
 	}
+
+	sendTouchEvents(calibratedFingers);
 	
 	
 }
 
+//queues a touch event; raw is sent to the RAW listeners as is, messenger is calibrated first
+void BlobTracker::queueTouchEvent(const Blob &raw, const Blob &messenger, int type){
+	queuedRawTouches.push_back(raw);
+	queuedTouches.push_back(messenger);
+	queuedTouchTypes.push_back(type);
+}
+
+//converts the queued touches to screen space with one batch lookup for their sizes and one
+//for their positions, then sends the events in the order they were queued
+void BlobTracker::sendTouchEvents(std::map<int, Blob> &calibrated){
+	int count = queuedTouches.size();
+	if(count == 0)
+		return;
+
+	//down events only carry a centroid, moved and held events also carry the last centroid
+	std::vector<float> widths(count), heights(count);
+	std::vector<float> xs, ys;
+	xs.reserve(count * 2);
+	ys.reserve(count * 2);
+	for(int k = 0; k < count; k++){
+		Blob &touch = queuedTouches[k];
+		widths[k] = touch.boundingRect.width;
+		heights[k] = touch.boundingRect.height;
+		xs.push_back(touch.centroid.x);
+		ys.push_back(touch.centroid.y);
+		if(queuedTouchTypes[k] != TOUCH_DOWN){
+			xs.push_back(touch.lastCentroid.x);
+			ys.push_back(touch.lastCentroid.y);
+		}
+	}
+
+	calibrate->transformDimensions(&widths[0], &heights[0], count);
+	calibrate->cameraToScreenPositions(&xs[0], &ys[0], xs.size());
+
+	int p = 0;
+	for(int k = 0; k < count; k++){
+		Blob &touch = queuedTouches[k];
+		touch.boundingRect.width = widths[k];
+		touch.boundingRect.height = heights[k];
+		touch.centroid.x = xs[p];
+		touch.centroid.y = ys[p];
+		p++;
+		if(queuedTouchTypes[k] != TOUCH_DOWN){
+			touch.lastCentroid.x = xs[p];
+			touch.lastCentroid.y = ys[p];
+			p++;
+		}
+	}
+
+	for(int k = 0; k < count; k++){
+		int type = queuedTouchTypes[k];
+
+		if(isCalibrating){
+			TouchEvents.RAWmessenger = queuedRawTouches[k];
+			if(type == TOUCH_DOWN)			TouchEvents.notifyRAWTouchDown(NULL);
+			else if(type == TOUCH_HELD)		TouchEvents.notifyRAWTouchHeld(NULL);
+			else							TouchEvents.notifyRAWTouchMoved(NULL);
+		}
+
+		TouchEvents.messenger = queuedTouches[k];
+
+		//add to calibration map
+		calibrated[TouchEvents.messenger.id] = TouchEvents.messenger;
+
+		if(type == TOUCH_DOWN)			TouchEvents.notifyTouchDown(NULL);
+		else if(type == TOUCH_HELD)		TouchEvents.notifyTouchHeld(NULL);
+		else							TouchEvents.notifyTouchMoved(NULL);
+	}
+
+	queuedRawTouches.clear();
+	queuedTouches.clear();
+	queuedTouchTypes.clear();
+}
+
 std::map<int, Blob> BlobTracker::getTrackedBlobs(){
     return calibratedBlobs;
 }
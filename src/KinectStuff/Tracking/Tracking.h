@@ -39,6 +39,14 @@ public:
 
 private:
 	int trackKnn(ContourFinder *newBlobs, Blob *track, int k, double thresh, bool fingers);
+
+	//touch events are queued while tracking and calibrated in one batch before they are sent
+	enum { TOUCH_DOWN, TOUCH_MOVED, TOUCH_HELD };
+	void queueTouchEvent(const Blob &raw, const Blob &messenger, int type);
+	void sendTouchEvents(std::map<int, Blob> &calibrated);
+	std::vector<Blob>		queuedRawTouches;
+	std::vector<Blob>		queuedTouches;
+	std::vector<int>		queuedTouchTypes;
 	int	IDCounter;	  //counter of last blob
 	int	fightMongrel;
 	
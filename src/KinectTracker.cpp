@@ -10,8 +10,9 @@
 
 void KinectTracker::setup(){
     ofSetLogLevel(OF_LOG_VERBOSE);
-	// enable depth->video image calibration
-	kinect.setRegistration(true);
+    // enable depth->video image calibration, unless our remap tables already register depth
+    cameraRemap.loadSettings("cameraRemapSettings.xml");
+	kinect.setRegistration(!cameraRemap.hasRegistration());
 
     // set depth range of interest in mm
 	kinect.setDepthClipping(800, 1050); // 0.8 to 1.05 meters
@@ -19,11 +20,12 @@ void KinectTracker::setup(){
 	kinect.init();
 	kinect.open();		// opens first available kinect
 
-    colorImgRaw.allocate(kinect.width, kinect.height);
-	depthImgRaw.allocate(kinect.width, kinect.height);
-
-    colorImgRaw.setROI(223, 158, frameWidth, frameHeight);
-    depthImgRaw.setROI(223, 158, frameWidth, frameHeight);
+    // crop to the table as located by the table frame
+    tableFrame.loadSettings("tableFrameSettings.xml");
+    cameraRemap.setup(frameWidth, frameHeight, kinect.width, kinect.height);
+    rebuildCameraRemap();
+    colorRemapPixels.allocate(frameWidth, frameHeight, OF_IMAGE_COLOR);
+    depthRemapPixels.allocate(frameWidth, frameHeight, OF_IMAGE_GRAYSCALE);
 
     colorImg.allocate(frameWidth, frameHeight);
 	depthImg.allocate(frameWidth, frameHeight);
@@ -43,15 +45,6 @@ void KinectTracker::setup(){
     cornerLikelihoodsRawF.allocate(frameWidth, frameHeight);
     cornerLikelihoods.allocate(frameWidth, frameHeight);
 
-    src[0] = ofPoint(6, 4);
-    src[1] = ofPoint(188, 6);
-    src[2] = ofPoint(190, 189);
-    src[3] = ofPoint(1, 187);
-    dst[0] = ofPoint(0, 0);
-    dst[1] = ofPoint(frameWidth, 0);
-    dst[2] = ofPoint(frameWidth, frameHeight);
-    dst[3] = ofPoint(0, frameHeight);
-
     hsvImage.allocate(frameWidth, frameHeight);
     hue.allocate(frameWidth, frameHeight);
     sat.allocate(frameWidth, frameHeight);
@@ -79,12 +72,18 @@ void KinectTracker::setup(){
 }
 
 void KinectTracker::exit() {
+    cameraRemap.exit();
     kinect.setCameraTiltAngle(0); // zero the tilt on exit
 	kinect.close();
     
 }
 
 void KinectTracker::update(){
+    // pick up remap tables rebuilt after a calibration change
+    if (cameraRemap.update()) {
+        loadDepthBackground();
+    }
+
     kinect.update();
 	
 	// there is a new frame and we are connected
@@ -118,14 +117,71 @@ void KinectTracker::update(){
     }
 }
 
+void KinectTracker::rebuildCameraRemap() {
+    cameraRoi = tableFrame.getCameraRoi(frameWidth, frameHeight);
+    cameraRemap.rebuild(tableFrame, cameraRoi, useKeystone);
+
+    // locate each roi pixel on the table, for sampling table-space height maps
+    roiTableX.resize(frameWidth * frameHeight);
+    roiTableY.resize(frameWidth * frameHeight);
+    for (int y = 0; y < frameHeight; y++) {
+        for (int x = 0; x < frameWidth; x++) {
+            int i = y * frameWidth + x;
+            roiTableX[i] = useKeystone ? (float) x / frameWidth : cameraRoi.x + x;
+            roiTableY[i] = useKeystone ? (float) y / frameHeight : cameraRoi.y + y;
+        }
+    }
+    if (!useKeystone) {
+        tableFrame.cameraToTable(&roiTableX[0], &roiTableY[0], frameWidth * frameHeight);
+    }
+}
+
+// recalibrate the table corners; remap tables follow once rebuilt in the background
+void KinectTracker::setTableCorners(ofPoint corners[4]) {
+    tableFrame.setCameraCorners(corners);
+    tableFrame.saveSettings("tableFrameSettings.xml");
+    rebuildCameraRemap();
+}
+
+void KinectTracker::setKeystone(bool enabled) {
+    if (enabled != useKeystone) {
+        useKeystone = enabled;
+        rebuildCameraRemap();
+    }
+}
+
+// install a calibrated depth to color registration and save it. the remap tables then register
+// depth themselves, so the driver's registration should be off (see setDriverRegistration)
+void KinectTracker::setRegistration(ofPoint scale, ofPoint offset) {
+    cameraRemap.setRegistration(scale, offset);
+    cameraRemap.saveSettings("cameraRemapSettings.xml");
+    rebuildCameraRemap();
+}
+
+// the driver only applies registration when the kinect is opened, so reopen it
+void KinectTracker::setDriverRegistration(bool enabled) {
+    kinect.close();
+    kinect.setRegistration(enabled);
+    kinect.open();
+}
+
+// keystoned images are already in table coordinates and only need normalizing
+ofPoint KinectTracker::roiToTable(ofPoint roiPoint) {
+    if (useKeystone) {
+        return ofPoint(roiPoint.x / frameWidth, roiPoint.y / frameHeight);
+    }
+    ofPoint point(roiPoint.x + cameraRoi.x, roiPoint.y + cameraRoi.y);
+    tableFrame.cameraToTable(point);
+    return point;
+}
+
 void KinectTracker::updateInputImages(){
-    // get color image data in region of interest
-    colorImgRaw.setFromPixels(kinect.getPixels(), kinect.width, kinect.height);
-    colorImg.setFromPixels(colorImgRaw.getRoiPixels(), frameWidth, frameHeight);
-    
-    // get depth image data in region of interest
-    depthImgRaw.setFromPixels(kinect.getDepthPixels(), kinect.width, kinect.height);
-    depthImg.setFromPixels(depthImgRaw.getRoiPixels(), frameWidth, frameHeight);
+    // gather color and depth image data in region of interest directly from the kinect frames
+    cameraRemap.remapColor(kinect.getPixels(), colorRemapPixels.getPixels());
+    colorImg.setFromPixels(colorRemapPixels.getPixels(), frameWidth, frameHeight);
+
+    cameraRemap.remapDepth(kinect.getDepthPixels(), depthRemapPixels.getPixels());
+    depthImg.setFromPixels(depthRemapPixels.getPixels(), frameWidth, frameHeight);
     depthImg.dilate();
     depthImg.erode();
     
@@ -306,6 +362,11 @@ void KinectTracker::findCubes(ColorBand cubeColor, ColorBand markerColor, ColorB
     newCubeBlobs.clear();
     unmatchedCubes.clear();
 
+    // cubes report table coordinates, like fingers. keystoned blobs are already on the table
+    for (cubes_itr = cubes.begin(); cubes_itr < cubes.end(); cubes_itr++) {
+        cubes_itr->setTableFrame(useKeystone ? NULL : &tableFrame, cameraRoi.getPosition());
+    }
+
     // get blobs that match cubes, hands, or both; reject blobs too much larger than a cube.
     // since hands are much larger than cubes, this will only match previously found cubes
     // if those cubes are not being touched by hands.
@@ -380,7 +441,6 @@ void KinectTracker::findCubes(ColorBand cubeColor, ColorBand markerColor, ColorB
 
 void KinectTracker::findBlobs(ColorBand blobColor, float minArea, float maxArea, vector<Blob>& blobs, bool dilateHue, bool trackBlobs){
     hsvImage.setFromPixels(dThresholdedColor.getPixelsRef());
-    //hsvImage.warpIntoMe(thresholdedColor, src, dst); // use to better align input image
     hsvImage.convertRgbToHsv();
     hsvImage.convertToGrayscalePlanarImages(hue, sat, bri);
 
@@ -407,112 +467,93 @@ void KinectTracker::findBlobs(ColorBand blobColor, float minArea, float maxArea,
 }
 
 void KinectTracker::findFingers(vector<ofPoint> &points) {
-    
-    int nearThreshold = 255;
-	int farThreshold = 200;
-    
-    unsigned char * pix = depthImg.getPixels();
-    unsigned char * filteredPix = depthFiltered.getPixels();
     unsigned char * bgPix = depthBG.getPixels();
-    
-    for(int i = 0; i < depthImg.getWidth() * depthImg.getHeight(); i++){
-        filteredPix[i] = (pix[i]>(bgPix[i]+1))?pix[i]:0;
-        pix[i] = (filteredPix[i] < nearThreshold && filteredPix[i] > farThreshold)?255:0;
-        
-    }
-    depthImg.erode_3x3();
-    depthImg.dilate_3x3();
+    filterFingers(bgPix, bgPix, points, NULL);
+}
 
-    finger_contourFinder.findContours(depthImg,  (2 * 2) + 1, ((640 * 480) * .4) * (100 * .001), 20, 20.0, false);
-    
-    finger_tracker.track(&finger_contourFinder);
-    
-    points.clear();
-    
-    for(vector<Blob>::iterator itr = finger_contourFinder.fingers.begin(); itr < finger_contourFinder.fingers.end(); itr++){
-        ofPoint tempPt = itr->centroid;
-        tempPt.z = filteredPix[ int((tempPt.y*kinect.width) + tempPt.x) ] - bgPix[ int((tempPt.y*kinect.width) + tempPt.x) ] -1;
-        //cout<<tempPt.x << " " << tempPt.y <<endl;
-        
-        //Not just any magic numbers! These are magic bean numbers. You put them in the ground and then they grow ; )
-        //But serously these numbers convert from kinect space to display space (use them wisely)
-        // corners of table are roughly... starting from top left clockwise (236,154), (427,152), (232, 345), (426, 345)
-        //I know I suck (sean)
-        tempPt.x = ((tempPt.x -232.0)/(427.0-232.0))*900.0;
-        tempPt.y = ((tempPt.y - 152.0)/(345-152))*900.0;
-        points.push_back(tempPt);
+// find fingers above the pins. heightMap is the rendered pin height map, covering the table;
+// it is sampled at each roi pixel's table position and raises the background by up to 7 depth
+// levels at full pin height. roi pixels off the table see flat pins.
+void KinectTracker::findFingersAboveSurface(vector<ofPoint> &points, ofPixels &heightMap) {
+    unsigned char * bgROIPix = depthBG.getPixels();
+    unsigned char * bgPixAdded = depthBGPlusSurface.getPixels();
+    unsigned char * heightMapPix = heightMap.getPixels();
+    int heightMapWidth = heightMap.getWidth();
+    int heightMapHeight = heightMap.getHeight();
+    int heightMapChannels = heightMap.getNumChannels();
+
+    for (int i = 0; i < frameWidth * frameHeight; i++) {
+        int x = (int) floor(roiTableX[i] * heightMapWidth);
+        int y = (int) floor(roiTableY[i] * heightMapHeight);
+        int pinHeight = 0;
+        if (x >= 0 && x < heightMapWidth && y >= 0 && y < heightMapHeight) {
+            pinHeight = heightMapPix[(y * heightMapWidth + x) * heightMapChannels];
+        }
+        bgPixAdded[i] = bgROIPix[i] + pinHeight / 33;
     }
+
+    filterFingers(bgROIPix, bgPixAdded, points, &absFingers);
 }
 
-void KinectTracker::findFingersAboveSurface(vector<ofPoint> &points) {
-    
+// segment fingers standing proud of the given surface and report them in projector pixels. z is
+// the height above the surface, or above the bare background for the optional absolute points.
+// all depth buffers here are roi-local, frameWidth x frameHeight.
+void KinectTracker::filterFingers(unsigned char *bgPix, unsigned char *surfacePix, vector<ofPoint>& points, vector<ofPoint> *absPoints) {
     int nearThreshold = 255;
 	int farThreshold = 200;
 
-    int roiStartX = 232;
-    int roiStartY =  152;
-    int roiWidth = 427-232;
-    int roiHeight = 345-152;
-    
-    unsigned char * bgROIPix = depthBG.getPixels();
-    unsigned char * bgPixAdded = depthBGPlusSurface.getPixels();
-    
-    ofxCvGrayscaleImage tempDepth;
-    tempDepth.allocate(roiWidth, roiHeight);
-
-    unsigned char * tempDepthPix = tempDepth.getPixels();
-    
-    //cout<<int(tempDepthPix[3])<<endl;
-    int counter =0;
-    
-    for(int i = (232+152*kinect.width); i <  (427+345*kinect.width); i++){
-        if(((i%kinect.width)>(roiStartX-1)) && ((i%kinect.width)<(roiStartX+roiWidth)) ){
-            bgPixAdded[i] = bgROIPix[i]+ (tempDepthPix[counter])/33; //-1;
-            //tempDepthPix[i]=50;
-            counter++;
-        }
-    }
-    
     unsigned char * pix = depthImg.getPixels();
     unsigned char * filteredPix = depthFiltered.getPixels();
 
-    for(int i = 0; i < depthImg.getWidth() * depthImg.getHeight(); i++){
-        filteredPix[i] = (pix[i]>(bgPixAdded[i]+1))?pix[i]:0;
+    for(int i = 0; i < frameWidth * frameHeight; i++){
+        filteredPix[i] = (pix[i]>(surfacePix[i]+1))?pix[i]:0;
         pix[i] = (filteredPix[i] < nearThreshold && filteredPix[i] > farThreshold)?255:0;
-        
     }
     depthImg.erode_3x3();
     depthImg.dilate_3x3();
 
     finger_contourFinder.findContours(depthImg,  (2 * 2) + 1, ((640 * 480) * .4) * (100 * .001), 20, 20.0, false);
-    
+
     finger_tracker.track(&finger_contourFinder);
-    
-    absFingers.clear();
+
+    vector<Blob> &found = finger_contourFinder.fingers;
+    int count = found.size();
+    tableFrameX.resize(count);
+    tableFrameY.resize(count);
+
     points.clear();
-    for(vector<Blob>::iterator itr = finger_contourFinder.fingers.begin(); itr < finger_contourFinder.fingers.end(); itr++){
-        ofPoint tempPt = itr->centroid;
-        int tmpx = tempPt.x;
-        int tmpy = tempPt.y;
-        //maybe this should be changed from bgPixAdded to bgRoiPix
-        tempPt.z = filteredPix[ int((tempPt.y*kinect.width) + tempPt.x) ] - bgPixAdded[ int((tempPt.y*kinect.width) + tempPt.x) ] -1;
-        //cout<<tempPt.x << " " << tempPt.y <<endl;
-        
-        //Not just any magic numbers! These are magic bean numbers. You put them in the ground and then they grow ; )
-        //But serously these numbers convert from kinect space to display space (use them wisely)
-        // corners of table are roughly... starting from top left clockwise (236,154), (427,152), (232, 345), (426, 345)
-        //I know I suck (sean)
-        tempPt.x = ((tempPt.x -232.0)/(427.0-232.0))*900.0;
-        tempPt.y = ((tempPt.y - 152.0)/(345-152))*900.0;
-        points.push_back(tempPt);
-        
-        ofPoint tempPt2;
-        //if there is some error in the finger tracking the problem could be here, that I am modifying tempPt after I pushed it to points vector
-        
-        tempPt2.x = ((tmpx -232.0)/(427.0-232.0))*900.0;
-        tempPt2.y = ((tmpy - 152.0)/(345-152))*900.0;
-        tempPt2.z = filteredPix[ int((tmpy*kinect.width) + tmpx) ] - bgROIPix[ int((tmpy*kinect.width) + tmpx) ] -1;
-        absFingers.push_back(tempPt2);
+    if (absPoints) {
+        absPoints->clear();
+    }
+    for (int i = 0; i < count; i++) {
+        int x = ofClamp(found[i].centroid.x, 0, frameWidth - 1);
+        int y = ofClamp(found[i].centroid.y, 0, frameHeight - 1);
+        int index = y * frameWidth + x;
+        points.push_back(ofPoint(0, 0, filteredPix[index] - surfacePix[index] - 1));
+        if (absPoints) {
+            absPoints->push_back(ofPoint(0, 0, filteredPix[index] - bgPix[index] - 1));
+        }
+        tableFrameX[i] = found[i].centroid.x + cameraRoi.x;
+        tableFrameY[i] = found[i].centroid.y + cameraRoi.y;
+    }
+
+    // convert from kinect space to display space in one pass. keystoned images are already in
+    // table coordinates and only need scaling
+    if (useKeystone) {
+        for (int i = 0; i < count; i++) {
+            tableFrameX[i] = found[i].centroid.x * RELIEF_PROJECTOR_SIZE_X / frameWidth;
+            tableFrameY[i] = found[i].centroid.y * RELIEF_PROJECTOR_SIZE_Y / frameHeight;
+        }
+    } else if (count) {
+        tableFrame.cameraToTable(&tableFrameX[0], &tableFrameY[0], count, RELIEF_PROJECTOR_SIZE_X, RELIEF_PROJECTOR_SIZE_Y);
+    }
+    for (int i = 0; i < count; i++) {
+        points[i].x = tableFrameX[i];
+        points[i].y = tableFrameY[i];
+        if (absPoints) {
+            (*absPoints)[i].x = tableFrameX[i];
+            (*absPoints)[i].y = tableFrameY[i];
+        }
     }
 }
 
@@ -522,11 +563,17 @@ void KinectTracker::saveDepthImage(){
     tempBG.saveImage("background.png");
 }
 
+// load the full-frame background and remap it like depthImg so the two line up
 void KinectTracker::loadDepthBackground(){
     ofImage tempBG;
     tempBG.loadImage("backgroundGood.png");
-    depthBG.setFromPixels(tempBG.getPixels(), kinect.width, kinect.height);
-    depthBGPlusSurface.setFromPixels(tempBG.getPixels(), kinect.width, kinect.height);
+    if (tempBG.getWidth() != kinect.width || tempBG.getHeight() != kinect.height) {
+        cout << "Error: depth background does not match the kinect frame size" << endl;
+        return;
+    }
+    cameraRemap.remapDepth(tempBG.getPixels(), depthRemapPixels.getPixels());
+    depthBG.setFromPixels(depthRemapPixels.getPixels(), frameWidth, frameHeight);
+    depthBGPlusSurface.setFromPixels(depthRemapPixels.getPixels(), frameWidth, frameHeight);
 }
 
 void KinectTracker::drawColorImage(int x, int y, int width, int height) {
@@ -556,4 +603,10 @@ void KinectTracker::drawCornerLikelihoods(int x, int y, int width, int height) {
     ofSetColor(255, 255, 255);
     cornerLikelihoodsDisplayImage.update();
     cornerLikelihoodsDisplayImage.draw(x,y,width,height);
+}
+
+// the full kinect color frame, for locating the table corners
+void KinectTracker::drawRawColorImage(int x, int y, int width, int height) {
+    ofSetColor(255, 255, 255);
+    kinect.draw(x,y,width,height);
 }
\ No newline at end of file
@@ -12,6 +12,8 @@
 #include "Constants.h"
 #include "ColorBand.h"
 #include "Cube.h"
+#include "TableFrame.h"
+#include "CameraRemap.h"
 
 
 #ifndef __Relief2__KinectTracker__
@@ -40,12 +42,19 @@ public:
     void drawDetectedObjects(int x, int y, int width, int height);
     void drawDepthThresholdedColorImage(int x, int y, int width, int height);
     void drawCornerLikelihoods(int x, int y, int width, int height);
+    void drawRawColorImage(int x, int y, int width, int height);
     void update();
 
     void findCubes(ColorBand cubeColor, ColorBand markerColor, ColorBand cubePlusHandColor, vector<Cube>& cubes);
     void findBlobs(ColorBand blobColor, float minArea, float maxArea, vector<Blob>& blobs, bool dilateHue=false, bool trackBlobs=false);
     void findFingers(vector<ofPoint>& points);
-    void findFingersAboveSurface(vector<ofPoint>& points);
+    void findFingersAboveSurface(vector<ofPoint>& points, ofPixels &heightMap);
+
+    void setTableCorners(ofPoint corners[4]);
+    void setKeystone(bool enabled);
+    void setRegistration(ofPoint scale, ofPoint offset);
+    void setDriverRegistration(bool enabled);
+    ofPoint roiToTable(ofPoint roiPoint);       // roi pixels to normalized table coordinates
 
     void saveDepthImage();
     void loadDepthBackground();
@@ -54,7 +63,13 @@ public:
     vector<ofPoint> fingers;                    // fingers detected (z is relative above height map)
     vector<ofPoint> absFingers;                 // fingers detected (z is absolute)
 
-    ofPoint src[4], dst[4];
+    TableFrame tableFrame;                      // maps camera pixels onto the table surface
+    ofRectangle cameraRoi;                      // inFORM region of the raw kinect images
+    CameraRemap cameraRemap;                    // gathers input images from raw kinect frames
+
+    // keystone correction resamples the input images onto the table frame. either way, cube and
+    // finger positions come out in table coordinates
+    bool useKeystone = false;
 
     int frameWidth = 190;
     int frameHeight = 190;
@@ -62,14 +77,12 @@ public:
     // unclear why, but the natural calculation for pinArea significantly overestimates pin sizes, so multiply by 0.8
     float pinArea = 0.8 * frameWidth * frameHeight / (RELIEF_SIZE_X * RELIEF_SIZE_Y);
 
-    ofxCvColorImage colorImgRaw;                // color straight from kinect
     ofxCvColorImage colorImg;                   // color restricted to inFORM ROI
     ofxCvColorImage depthThresholdC;            // depth threshold as a color image
     ofxCvColorImage depthThresholdDilatedC;     // dilated depth threshold as a color image
     ofxCvColorImage dThresholdedColor;          // depth-thresholded color
     ofxCvColorImage dThresholdedColorDilated;   // dilated depth-thresholded color
 
-    ofxCvGrayscaleImage depthImgRaw;            // depth straight from kinect
     ofxCvGrayscaleImage depthImg;               // depth restricted to inFORM ROI
     ofxCvGrayscaleImage depthNearThreshold;     // helper for removing depths that are too close
     ofxCvGrayscaleImage depthThreshold;         // threshold rejecting pixels of uninteresting depth
@@ -107,9 +120,11 @@ public:
     
 private:
     void updateInputImages();
+    void rebuildCameraRemap();
     void updateDepthThresholds();
     void generateBlobDescriptors(vector<Cube> cubes);
     void detectCorners(ofxCvGrayscaleImage &imageIn, vector<ofPoint>& cornersOut);
+    void filterFingers(unsigned char *bgPix, unsigned char *surfacePix, vector<ofPoint>& points, vector<ofPoint> *absPoints);
 
     // cube detection colors
     ColorBand redColor;
@@ -118,6 +133,18 @@ private:
 
     int nextCubeId = 0; // assign cube tracking ids from this value
 
+    // remapped frame buffers
+    ofPixels colorRemapPixels;
+    ofPixels depthRemapPixels;
+
+    // scratch coordinate buffers for batched table frame transforms
+    vector<float> tableFrameX;
+    vector<float> tableFrameY;
+
+    // normalized table coordinates of every roi pixel, rebuilt with the camera remap
+    vector<float> roiTableX;
+    vector<float> roiTableY;
+
 };
 
 #endif /* defined(__Relief2__KinectTracker__) */
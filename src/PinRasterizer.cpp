@@ -0,0 +1,244 @@
+//
+//  PinRasterizer.cpp
+//  Relief2
+//
+//
+
+#include "PinRasterizer.h"
+#include "HeightMapCompositor.h"
+
+
+PinRasterizer::PinRasterizer(int width, int height) : width(width), height(height) {
+    data.assign(width * height, 0);
+    coverage.assign(width * height, 0);
+    Affine identity = {1, 0, 0, 1, 0, 0};
+    transform = identity;
+}
+
+void PinRasterizer::clear(int value) {
+    std::fill(data.begin(), data.end(), (unsigned char) ofClamp(value, 0, 255));
+}
+
+void PinRasterizer::pushMatrix() {
+    transformStack.push_back(transform);
+}
+
+void PinRasterizer::popMatrix() {
+    if (transformStack.empty()) {
+        cout << "Error: PinRasterizer::popMatrix called on an empty stack" << endl;
+        return;
+    }
+    transform = transformStack.back();
+    transformStack.pop_back();
+}
+
+void PinRasterizer::translate(float x, float y) {
+    transform.tx += transform.a * x + transform.b * y;
+    transform.ty += transform.c * x + transform.d * y;
+}
+
+// rotate about the z axis. as with glRotatef in a y-down image, positive angles turn clockwise
+void PinRasterizer::rotate(float degrees) {
+    float radians = ofDegToRad(degrees);
+    float cosine = cos(radians);
+    float sine = sin(radians);
+    Affine rotated = transform;
+    rotated.a = transform.a * cosine + transform.b * sine;
+    rotated.b = -transform.a * sine + transform.b * cosine;
+    rotated.c = transform.c * cosine + transform.d * sine;
+    rotated.d = -transform.c * sine + transform.d * cosine;
+    transform = rotated;
+}
+
+ofPoint PinRasterizer::transformed(float x, float y) {
+    return ofPoint(transform.a * x + transform.b * y + transform.tx, transform.c * x + transform.d * y + transform.ty);
+}
+
+void PinRasterizer::fillRect(float left, float top, float width, float height) {
+    vector<ofPoint> corners(4);
+    corners[0] = transformed(left, top);
+    corners[1] = transformed(left + width, top);
+    corners[2] = transformed(left + width, top + height);
+    corners[3] = transformed(left, top + height);
+    accumulateCoverage(corners);
+    resolveCoverage(NULL, NULL);
+}
+
+void PinRasterizer::fillRect(Rectangle &rect) {
+    fillRect(rect.left, rect.top, rect.width, rect.height);
+}
+
+void PinRasterizer::fillPolygon(vector<ofPoint> &points) {
+    vector<ofPoint> canvasPoints(points.size());
+    for (int i = 0; i < points.size(); i++) {
+        canvasPoints[i] = transformed(points[i].x, points[i].y);
+    }
+    accumulateCoverage(canvasPoints);
+    resolveCoverage(NULL, NULL);
+}
+
+// like a GL triangle strip, the gradient covers only the profile's span of the rectangle
+void PinRasterizer::fillGradientRect(Rectangle &rect, vector<pair<float, float> > &profile) {
+    if (profile.empty()) {
+        return;
+    }
+
+    // the profile must be ordered for lookups
+    vector<pair<float, float> > sortedProfile = profile;
+    std::stable_sort(sortedProfile.begin(), sortedProfile.end());
+
+    float top = rect.top + rect.height * sortedProfile.front().first;
+    float bottom = rect.top + rect.height * sortedProfile.back().first;
+    vector<ofPoint> corners(4);
+    corners[0] = transformed(rect.left, top);
+    corners[1] = transformed(rect.left + rect.width, top);
+    corners[2] = transformed(rect.left + rect.width, bottom);
+    corners[3] = transformed(rect.left, bottom);
+    accumulateCoverage(corners);
+    resolveCoverage(&rect, &sortedProfile);
+}
+
+void PinRasterizer::fillVerticalLinearGradientRect(Rectangle &rect, int valueTop, int valueBottom) {
+    vector<pair<float, float> > profile;
+    profile.push_back(pair<float, float>(0, valueTop));
+    profile.push_back(pair<float, float>(1, valueBottom));
+    fillGradientRect(rect, profile);
+}
+
+void PinRasterizer::copyFrom(PinRasterizer &other) {
+    if (other.width != width || other.height != height) {
+        cout << "Error: PinRasterizer::copyFrom dimensions do not match" << endl;
+        return;
+    }
+    data = other.data;
+}
+
+void PinRasterizer::minimumWith(PinRasterizer &other) {
+    if (other.width != width || other.height != height) {
+        cout << "Error: PinRasterizer::minimumWith dimensions do not match" << endl;
+        return;
+    }
+    HeightMapCompositor::blend(&data[0], &other.data[0], data.size(), BLEND_MIN);
+}
+
+// expand to gray pixels with an opaque alpha channel, as a readback from a GL_RGBA fbo would give
+void PinRasterizer::toPixels(ofPixels &pixels, int numChannels) {
+    if (!pixels.isAllocated() || pixels.getWidth() != width || pixels.getHeight() != height || pixels.getNumChannels() != numChannels) {
+        pixels.allocate(width, height, numChannels);
+    }
+    unsigned char *output = pixels.getPixels();
+    for (int i = 0; i < data.size(); i++, output += numChannels) {
+        for (int channel = 0; channel < numChannels; channel++) {
+            output[channel] = (channel == 3) ? 255 : data[i];
+        }
+    }
+}
+
+// add each pixel's covered area to the coverage buffer. crossings are found on sub-scanlines
+// and the spans between them are integrated exactly along x
+void PinRasterizer::accumulateCoverage(vector<ofPoint> &canvasPoints) {
+    int n = canvasPoints.size();
+    coverageMinX = width;
+    coverageMaxX = -1;
+    coverageMinY = height;
+    coverageMaxY = -1;
+    if (n < 3) {
+        return;
+    }
+
+    float minY = canvasPoints[0].y, maxY = canvasPoints[0].y;
+    for (int i = 1; i < n; i++) {
+        minY = min(minY, canvasPoints[i].y);
+        maxY = max(maxY, canvasPoints[i].y);
+    }
+    int firstRow = max(0, (int) floor(minY));
+    int lastRow = min(height - 1, (int) floor(maxY));
+
+    vector<float> crossings;
+    for (int row = firstRow; row <= lastRow; row++) {
+        float *rowCoverage = &coverage[row * width];
+        for (int sub = 0; sub < subScanlines; sub++) {
+            float y = row + (sub + 0.5) / subScanlines;
+
+            crossings.clear();
+            for (int i = 0, j = n - 1; i < n; j = i++) {
+                ofPoint &p = canvasPoints[i];
+                ofPoint &q = canvasPoints[j];
+                if ((p.y <= y) != (q.y <= y)) {
+                    crossings.push_back(p.x + (y - p.y) * (q.x - p.x) / (q.y - p.y));
+                }
+            }
+            std::sort(crossings.begin(), crossings.end());
+
+            for (int k = 0; k + 1 < crossings.size(); k += 2) {
+                float x0 = max(0.0f, crossings[k]);
+                float x1 = min((float) width, crossings[k + 1]);
+                if (x1 <= x0) {
+                    continue;
+                }
+                int firstColumn = (int) x0;
+                int lastColumn = min(width - 1, (int) ceil(x1) - 1);
+                for (int column = firstColumn; column <= lastColumn; column++) {
+                    float overlap = min(x1, column + 1.0f) - max(x0, (float) column);
+                    rowCoverage[column] += overlap / subScanlines;
+                }
+                coverageMinX = min(coverageMinX, firstColumn);
+                coverageMaxX = max(coverageMaxX, lastColumn);
+                coverageMinY = min(coverageMinY, row);
+                coverageMaxY = max(coverageMaxY, row);
+            }
+        }
+    }
+}
+
+// write the current value, or the gradient profile's value, into covered pixels and reset the
+// coverage buffer
+void PinRasterizer::resolveCoverage(Rectangle *gradientRect, vector<pair<float, float> > *profile) {
+    // inverse transform, for finding a pixel's position along the gradient
+    float determinant = transform.a * transform.d - transform.b * transform.c;
+    bool gradient = gradientRect && profile && determinant != 0 && gradientRect->height != 0;
+
+    for (int row = coverageMinY; row <= coverageMaxY; row++) {
+        for (int column = coverageMinX; column <= coverageMaxX; column++) {
+            int i = row * width + column;
+            float covered = min(1.0f, coverage[i]);
+            coverage[i] = 0;
+            if (covered <= 0) {
+                continue;
+            }
+
+            float value = currentValue;
+            if (gradient) {
+                float dx = column + 0.5 - transform.tx;
+                float dy = row + 0.5 - transform.ty;
+                float localY = (-transform.c * dx + transform.a * dy) / determinant;
+                value = profileValue(*profile, (localY - gradientRect->top) / gradientRect->height);
+            }
+
+            if (coverageMode == COVERAGE_THRESHOLD) {
+                if (covered >= 0.5) {
+                    data[i] = value + 0.5;
+                }
+            } else {
+                data[i] = data[i] * (1 - covered) + value * covered + 0.5;
+            }
+        }
+    }
+}
+
+// piecewise linear lookup into a sorted profile, clamped at its ends and to valid heights
+float PinRasterizer::profileValue(vector<pair<float, float> > &profile, float u) {
+    float value;
+    if (u <= profile.front().first) {
+        value = profile.front().second;
+    } else if (u >= profile.back().first) {
+        value = profile.back().second;
+    } else {
+        int k = std::upper_bound(profile.begin(), profile.end(), pair<float, float>(u, -FLT_MAX)) - profile.begin();
+        pair<float, float> &a = profile[k - 1];
+        pair<float, float> &b = profile[k];
+        float t = (b.first == a.first) ? 0 : (u - a.first) / (b.first - a.first);
+        value = a.second + (b.second - a.second) * t;
+    }
+    return ofClamp(value, 0, 255);
+}
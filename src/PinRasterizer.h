@@ -0,0 +1,84 @@
+//
+//  PinRasterizer.h
+//  Relief2
+//
+//
+
+#ifndef __Relief2__PinRasterizer__
+#define __Relief2__PinRasterizer__
+
+#include "ofMain.h"
+#include "Constants.h"
+#include "Rectangle.h"
+
+
+// how a shape's value is combined with a partially covered pixel
+enum CoverageMode {
+    COVERAGE_THRESHOLD,     // write pixels at least half covered; keeps exact height values
+    COVERAGE_ANTIALIASED    // blend by covered area
+};
+
+
+// CPU rasterizer for height maps at pin resolution. Shapes are filled into an 8-bit grayscale
+// grid using each pixel's covered area, computed exactly along x on four sub-scanlines per row.
+// A GL-style transform stack lets shapes be drawn in a cube's reference frame, so height map
+// code can move between ofFbo drawing and this class with few changes.
+
+class PinRasterizer {
+public:
+    PinRasterizer(int width=RELIEF_SIZE_X, int height=RELIEF_SIZE_Y);
+
+    void clear(int value=0);
+    void setValue(int value) { currentValue = ofClamp(value, 0, 255); }
+    void setCoverageMode(CoverageMode mode) { coverageMode = mode; }
+
+    // transform stack, matching glPushMatrix/glTranslatef/glRotatef about the z axis
+    void pushMatrix();
+    void popMatrix();
+    void translate(float x, float y);
+    void rotate(float degrees);
+
+    void fillRect(float left, float top, float width, float height);
+    void fillRect(Rectangle &rect);
+    void fillPolygon(vector<ofPoint> &points);  // even-odd fill, like ofBeginShape
+
+    // fill a rectangle whose value follows a (fraction of height, value) profile from top to bottom
+    void fillGradientRect(Rectangle &rect, vector<pair<float, float> > &profile);
+    void fillVerticalLinearGradientRect(Rectangle &rect, int valueTop, int valueBottom);
+
+    // per-pixel operations against another canvas of the same size
+    void copyFrom(PinRasterizer &other);
+    void minimumWith(PinRasterizer &other);
+
+    void toPixels(ofPixels &pixels, int numChannels=4);
+
+    int getWidth() { return width; }
+    int getHeight() { return height; }
+    unsigned char *getData() { return &data[0]; }
+    unsigned char &operator[](int i) { return data[i]; }
+    int size() { return data.size(); }
+
+private:
+    struct Affine {
+        float a, b, c, d, tx, ty;   // x' = a x + b y + tx, y' = c x + d y + ty
+    };
+
+    void accumulateCoverage(vector<ofPoint> &canvasPoints);
+    void resolveCoverage(Rectangle *gradientRect, vector<pair<float, float> > *profile);
+    float profileValue(vector<pair<float, float> > &profile, float u);
+    ofPoint transformed(float x, float y);
+
+    int width, height;
+    vector<unsigned char> data;
+    vector<float> coverage;
+    int coverageMinX, coverageMaxX, coverageMinY, coverageMaxY;
+
+    Affine transform;
+    vector<Affine> transformStack;
+    int currentValue = 255;
+    CoverageMode coverageMode = COVERAGE_THRESHOLD;
+
+    static const int subScanlines = 4;
+};
+
+#endif /* defined(__Relief2__PinRasterizer__) */
@@ -0,0 +1,315 @@
+//
+//  ProjectorCameraCalibrator.cpp
+//  Relief2
+//
+//
+
+#include "ProjectorCameraCalibrator.h"
+
+
+// least squares fit of y = scale * x + offset
+static bool fitLine(vector<float> &x, vector<float> &y, float &scale, float &offset) {
+    int n = x.size();
+    if (n < 2) {
+        return false;
+    }
+    double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    for (int i = 0; i < n; i++) {
+        sumX += x[i];
+        sumY += y[i];
+        sumXX += x[i] * x[i];
+        sumXY += x[i] * y[i];
+    }
+    double denominator = n * sumXX - sumX * sumX;
+    if (fabs(denominator) < 1e-9) {
+        return false;
+    }
+    scale = (n * sumXY - sumX * sumY) / denominator;
+    offset = (sumY - scale * sumX) / n;
+    return true;
+}
+
+void ReprojectionModelFitter::fit(vector<CalibrationSample> &cameraSamples, vector<CalibrationSample> &projectorSamples, vector<float> &heights) {
+    this->cameraSamples = cameraSamples;
+    this->projectorSamples = projectorSamples;
+    this->heights = heights;
+    finished = false;
+    startThread(true, false);   // blocking, not verbose
+}
+
+bool ReprojectionModelFitter::isFinished() {
+    lock();
+    bool result = finished;
+    unlock();
+    return result;
+}
+
+void ReprojectionModelFitter::threadedFunction() {
+    vector<ReprojectionModel> fitted;
+
+    for (int h = 0; h < heights.size(); h++) {
+        ReprojectionModel model;
+        model.height = heights[h];
+
+        // camera model: observed camera coordinate -> known table coordinate
+        vector<float> cameraX, cameraY, tableX, tableY;
+        for (int i = 0; i < cameraSamples.size(); i++) {
+            if (cameraSamples[i].height != heights[h]) continue;
+            cameraX.push_back(cameraSamples[i].observed.x);
+            cameraY.push_back(cameraSamples[i].observed.y);
+            tableX.push_back(cameraSamples[i].known.x);
+            tableY.push_back(cameraSamples[i].known.y);
+        }
+        if (!fitLine(cameraX, tableX, model.cameraScale.x, model.cameraOffset.x) ||
+            !fitLine(cameraY, tableY, model.cameraScale.y, model.cameraOffset.y)) {
+            cout << "Warning: not enough camera samples at height " << heights[h] << "; skipping" << endl;
+            continue;
+        }
+
+        // projector model: known projector coordinate -> table coordinate seen through the camera
+        vector<float> projectorX, projectorY, surfaceX, surfaceY;
+        for (int i = 0; i < projectorSamples.size(); i++) {
+            if (projectorSamples[i].height != heights[h]) continue;
+            projectorX.push_back(projectorSamples[i].known.x);
+            projectorY.push_back(projectorSamples[i].known.y);
+            surfaceX.push_back(model.cameraScale.x * projectorSamples[i].observed.x + model.cameraOffset.x);
+            surfaceY.push_back(model.cameraScale.y * projectorSamples[i].observed.y + model.cameraOffset.y);
+        }
+        if (!fitLine(projectorX, surfaceX, model.projectorScale.x, model.projectorOffset.x) ||
+            !fitLine(projectorY, surfaceY, model.projectorScale.y, model.projectorOffset.y)) {
+            cout << "Warning: not enough projector samples at height " << heights[h] << "; skipping" << endl;
+            continue;
+        }
+
+        fitted.push_back(model);
+    }
+
+    lock();
+    models = fitted;
+    finished = true;
+    unlock();
+}
+
+
+ProjectorCameraCalibrator::ProjectorCameraCalibrator(KinectTracker *tracker) {
+    kinectTracker = tracker;
+
+    // sample heights span the pin range; cube height is included since cubes use it directly
+    heights.push_back(50);
+    heights.push_back(100);
+    heights.push_back(STANDARD_CUBE_HEIGHT);
+    heights.push_back(190);
+    heights.push_back(240);
+
+    referenceImage.allocate(kinectTracker->frameWidth, kinectTracker->frameHeight);
+    currentImage.allocate(kinectTracker->frameWidth, kinectTracker->frameHeight);
+}
+
+void ProjectorCameraCalibrator::start() {
+    cameraSamples.clear();
+    projectorSamples.clear();
+    for (int pass = 0; pass < 2; pass++) {
+        registrationCentroids[pass].assign(gridSize * gridSize, ofPoint());
+        registrationFound[pass].assign(gridSize * gridSize, false);
+    }
+    registrationPass = 0;
+    heightIndex = 0;
+    step = 0;
+    stageTime = 0;
+    stage = REGISTRATION_REFERENCE;
+    kinectTracker->setDriverRegistration(true);
+}
+
+// table position of a block's center
+ofPoint ProjectorCameraCalibrator::blockCenter(int block) {
+    int column = block % gridSize;
+    int row = block / gridSize;
+    int span = RELIEF_SIZE_X - blockSize;
+    int left = span * (column + 1) / (gridSize + 1);
+    int top = span * (row + 1) / (gridSize + 1);
+    return ofPoint((left + blockSize / 2.0) / RELIEF_SIZE_X, (top + blockSize / 2.0) / RELIEF_SIZE_Y);
+}
+
+// normalized projector position of a dot
+ofPoint ProjectorCameraCalibrator::dotPosition(int dot) {
+    int column = dot % gridSize;
+    int row = dot / gridSize;
+    return ofPoint((column + 1.0) / (gridSize + 1), (row + 1.0) / (gridSize + 1));
+}
+
+// find the centroid of pixels that differ from the reference by more than threshold, in pixels
+bool ProjectorCameraCalibrator::findCentroid(unsigned char *current, unsigned char *reference, int width, int height, int threshold, ofPoint &centroid) {
+    double sumX = 0, sumY = 0;
+    int count = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int i = y * width + x;
+            if (current[i] > reference[i] + threshold) {
+                sumX += x;
+                sumY += y;
+                count++;
+            }
+        }
+    }
+    if (count < minimumMaskSize) {
+        return false;
+    }
+    centroid.set(sumX / count, sumY / count);
+    return true;
+}
+
+// fit color = scale * depth + offset per axis from the blocks found in both registration passes
+void ProjectorCameraCalibrator::fitRegistration() {
+    vector<float> depthX, depthY, colorX, colorY;
+    for (int i = 0; i < gridSize * gridSize; i++) {
+        if (!registrationFound[0][i] || !registrationFound[1][i]) continue;
+        colorX.push_back(registrationCentroids[0][i].x);
+        colorY.push_back(registrationCentroids[0][i].y);
+        depthX.push_back(registrationCentroids[1][i].x);
+        depthY.push_back(registrationCentroids[1][i].y);
+    }
+
+    ofPoint scale, offset;
+    if (fitLine(depthX, colorX, scale.x, offset.x) && fitLine(depthY, colorY, scale.y, offset.y)) {
+        kinectTracker->setRegistration(scale, offset);
+        cout << "Depth registration saved: scale (" << scale.x << ", " << scale.y << "), offset (" << offset.x << ", " << offset.y << ")" << endl;
+    } else {
+        cout << "Warning: not enough registration blocks found; keeping the previous registration" << endl;
+        kinectTracker->setDriverRegistration(!kinectTracker->cameraRemap.hasRegistration());
+    }
+}
+
+void ProjectorCameraCalibrator::update(float dt) {
+    if (stage == IDLE) {
+        return;
+    }
+
+    if (stage == FITTING) {
+        if (fitter.isFinished()) {
+            if (fitter.models.empty()) {
+                cout << "Error: projector-camera calibration failed; keeping previous models" << endl;
+            } else {
+                saveReprojectionModels(fitter.models, modelsFileName);
+                setReprojectionModels(fitter.models);
+                cout << "Projector-camera calibration saved to " << modelsFileName << endl;
+            }
+            stage = IDLE;
+        }
+        return;
+    }
+
+    stageTime += dt;
+    bool blockOrDotStage = stage == REGISTRATION_BLOCKS || stage == CAMERA_BLOCKS || stage == PROJECTOR_DOTS;
+    float settleTime = (stage == PROJECTOR_DOTS) ? dotSettleTime : (stage == REGISTRATION_REFERENCE) ? kinectReopenTime : pinSettleTime;
+    if (stageTime < settleTime) {
+        return;
+    }
+
+    float height = heights[heightIndex];
+    ofPoint centroid;
+    int roiWidth = kinectTracker->frameWidth;
+    int roiHeight = kinectTracker->frameHeight;
+    int rawWidth = kinectTracker->kinect.width;
+    int rawHeight = kinectTracker->kinect.height;
+
+    if (stage == REGISTRATION_REFERENCE) {
+        rawReferencePixels.setFromPixels(kinectTracker->kinect.getDepthPixels(), rawWidth, rawHeight, 1);
+    } else if (stage == REGISTRATION_BLOCKS) {
+        rawCurrentPixels.setFromPixels(kinectTracker->kinect.getDepthPixels(), rawWidth, rawHeight, 1);
+        if (findCentroid(rawCurrentPixels.getPixels(), rawReferencePixels.getPixels(), rawWidth, rawHeight, depthThreshold, centroid)) {
+            registrationCentroids[registrationPass][step] = centroid;
+            registrationFound[registrationPass][step] = true;
+        } else {
+            cout << "Warning: registration block " << step << " not found in pass " << registrationPass << endl;
+        }
+    } else if (stage == CAMERA_REFERENCE) {
+        referenceImage = kinectTracker->depthImg;
+    } else if (stage == CAMERA_BLOCKS) {
+        currentImage = kinectTracker->depthImg;
+        if (findCentroid(currentImage.getPixels(), referenceImage.getPixels(), roiWidth, roiHeight, depthThreshold, centroid)) {
+            CalibrationSample sample = {height, blockCenter(step), kinectTracker->roiToTable(centroid)};
+            cameraSamples.push_back(sample);
+        } else {
+            cout << "Warning: calibration block " << step << " not found at height " << height << endl;
+        }
+    } else if (stage == PROJECTOR_REFERENCE) {
+        referenceImage.setFromColorImage(kinectTracker->colorImg);
+    } else if (stage == PROJECTOR_DOTS) {
+        currentImage.setFromColorImage(kinectTracker->colorImg);
+        if (findCentroid(currentImage.getPixels(), referenceImage.getPixels(), roiWidth, roiHeight, brightnessThreshold, centroid)) {
+            CalibrationSample sample = {height, dotPosition(step), kinectTracker->roiToTable(centroid)};
+            projectorSamples.push_back(sample);
+        } else {
+            cout << "Warning: calibration dot " << step << " not found at height " << height << endl;
+        }
+    }
+
+    if (blockOrDotStage && step < gridSize * gridSize - 1) {
+        step++;
+        stageTime = 0;
+    } else {
+        advance();
+    }
+}
+
+void ProjectorCameraCalibrator::advance() {
+    step = 0;
+    stageTime = 0;
+    if (stage == REGISTRATION_REFERENCE) {
+        stage = REGISTRATION_BLOCKS;
+    } else if (stage == REGISTRATION_BLOCKS) {
+        // measure again in raw depth pixels, then fit the registration between the two passes
+        if (registrationPass == 0) {
+            registrationPass = 1;
+            stage = REGISTRATION_REFERENCE;
+            kinectTracker->setDriverRegistration(false);
+        } else {
+            fitRegistration();
+            stage = CAMERA_REFERENCE;
+        }
+    } else if (stage == CAMERA_REFERENCE) {
+        stage = CAMERA_BLOCKS;
+    } else if (stage == CAMERA_BLOCKS) {
+        stage = PROJECTOR_REFERENCE;
+    } else if (stage == PROJECTOR_REFERENCE) {
+        stage = PROJECTOR_DOTS;
+    } else if (stage == PROJECTOR_DOTS) {
+        heightIndex++;
+        if (heightIndex < heights.size()) {
+            stage = CAMERA_REFERENCE;
+        } else {
+            stage = FITTING;
+            fitter.fit(cameraSamples, projectorSamples, heights);
+        }
+    }
+}
+
+// height map is drawn directly in pin units
+void ProjectorCameraCalibrator::drawHeightMap() {
+    if (stage == IDLE || stage == FITTING) {
+        return;
+    }
+
+    if (stage == REGISTRATION_BLOCKS) {
+        ofPoint center = blockCenter(step);
+        ofSetColor(registrationHeight);
+        ofRect(center.x * RELIEF_SIZE_X - blockSize / 2.0, center.y * RELIEF_SIZE_Y - blockSize / 2.0, blockSize, blockSize);
+        return;
+    }
+
+    ofSetColor((int) heights[heightIndex]);
+    if (stage == CAMERA_BLOCKS) {
+        ofPoint center = blockCenter(step);
+        ofRect(center.x * RELIEF_SIZE_X - blockSize / 2.0, center.y * RELIEF_SIZE_Y - blockSize / 2.0, blockSize, blockSize);
+    } else if (stage == PROJECTOR_REFERENCE || stage == PROJECTOR_DOTS) {
+        ofRect(0, 0, RELIEF_SIZE_X, RELIEF_SIZE_Y);
+    }
+}
+
+void ProjectorCameraCalibrator::drawGraphics() {
+    if (stage == PROJECTOR_DOTS) {
+        ofPoint dot = dotPosition(step);
+        ofSetColor(255);
+        ofCircle(dot.x * RELIEF_PROJECTOR_SIZE_X, dot.y * RELIEF_PROJECTOR_SIZE_Y, 12);
+    }
+}
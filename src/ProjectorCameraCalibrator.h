@@ -0,0 +1,109 @@
+//
+//  ProjectorCameraCalibrator.h
+//  Relief2
+//
+//
+
+#ifndef __Relief2__ProjectorCameraCalibrator__
+#define __Relief2__ProjectorCameraCalibrator__
+
+#include "RenderableObject.h"
+#include "KinectTracker.h"
+#include "CameraCalibration.h"
+#include "ofThread.h"
+
+
+// one observation: a known table or projector position and where the camera saw it
+struct CalibrationSample {
+    float height;
+    ofPoint known;      // table coordinate for camera samples, projector coordinate for projector samples
+    ofPoint observed;   // camera coordinate, mapped onto the table through the table frame
+};
+
+
+// fits per-height reprojection models from collected samples off the main thread
+class ReprojectionModelFitter : public ofThread {
+public:
+    void fit(vector<CalibrationSample> &cameraSamples, vector<CalibrationSample> &projectorSamples, vector<float> &heights);
+    bool isFinished();
+    vector<ReprojectionModel> models;
+
+private:
+    void threadedFunction();
+
+    vector<CalibrationSample> cameraSamples;
+    vector<CalibrationSample> projectorSamples;
+    vector<float> heights;
+    bool finished = false;
+};
+
+
+// Calibration mode for depth registration and the projector and camera reprojection models.
+// It first raises small blocks of pins at known table positions and finds them in the raw depth
+// image twice, with the kinect driver's depth to color registration on and then off, which fits
+// the registration the camera remap uses in place of the driver's. Then, at each of several pin
+// heights it:
+//   1. raises small blocks of pins at known table positions and finds them in the depth image,
+//      which fits the camera model at that height
+//   2. raises all pins and projects single dots at known projector positions, finds them in the
+//      color image, and maps them to the table through the fresh camera model, which fits the
+//      projector model
+// Fitted models are saved to disk and installed once the whole sequence finishes. The depth
+// background ('p') should be saved again after a registration change.
+
+class ProjectorCameraCalibrator : public RenderableObject {
+public:
+    ProjectorCameraCalibrator(KinectTracker *tracker);
+
+    void start();
+    bool isRunning() { return stage != IDLE; }
+
+    void update(float dt);
+    void drawHeightMap();
+    void drawGraphics();
+
+    string modelsFileName = "projectorCameraCalibration.xml";
+
+private:
+    enum Stage {IDLE, REGISTRATION_REFERENCE, REGISTRATION_BLOCKS, CAMERA_REFERENCE, CAMERA_BLOCKS, PROJECTOR_REFERENCE, PROJECTOR_DOTS, FITTING};
+
+    void advance();
+    void fitRegistration();
+    bool findCentroid(unsigned char *current, unsigned char *reference, int width, int height, int threshold, ofPoint &centroid);
+    ofPoint blockCenter(int block);
+    ofPoint dotPosition(int dot);
+
+    KinectTracker *kinectTracker;
+    ReprojectionModelFitter fitter;
+
+    Stage stage = IDLE;
+    int heightIndex;
+    int step;                   // block or dot index within the current stage
+    float stageTime;            // seconds spent in the current step
+
+    vector<float> heights;
+    vector<CalibrationSample> cameraSamples;
+    vector<CalibrationSample> projectorSamples;
+
+    // registration passes: 0 with driver registration (color pixels), 1 without (depth pixels)
+    int registrationPass;
+    vector<ofPoint> registrationCentroids[2];   // raw pixel centroid of each block, per pass
+    vector<bool> registrationFound[2];
+
+    ofxCvGrayscaleImage referenceImage;
+    ofxCvGrayscaleImage currentImage;
+    ofPixels rawReferencePixels;                // full kinect depth frames for registration
+    ofPixels rawCurrentPixels;
+
+    const int gridSize = 3;             // blocks and dots are laid out on a gridSize x gridSize grid
+    const int blockSize = 2;            // raised blocks are blockSize x blockSize pins
+    const float pinSettleTime = 1.5;    // seconds for pins to reach a new height
+    const float kinectReopenTime = 3;   // seconds for the kinect to stream again after reopening
+    const int registrationHeight = 255; // blocks stand at full height for the registration passes
+    const float dotSettleTime = 0.3;    // seconds for a projected dot to reach the camera
+    const int depthThreshold = 8;
+    const int brightnessThreshold = 40;
+    const int minimumMaskSize = 6;      // pixels needed to accept a detection
+};
+
+#endif /* defined(__Relief2__ProjectorCameraCalibrator__) */
@@ -31,6 +31,7 @@ void ReliefApplication::setup(){
     
 	// initialize communication with Relief table
 	mIOManager = new ReliefIOManager();
+    pinMappingMicros = mIOManager->benchmarkFrameConversion(1000);
     
     float gain_P = 1.3;
     float gain_I = 0.2;
@@ -39,12 +40,18 @@ void ReliefApplication::setup(){
     int gravityComp = 0;
     int maxSpeed = 220;
     
-    mIOManager->sendValueToAllBoards(TERM_ID_GAIN_P, (unsigned char) (gain_P * 25));
-    mIOManager->sendValueToAllBoards(TERM_ID_GAIN_I, (unsigned char) (gain_I * 100));
-    mIOManager->sendValueToAllBoards(TERM_ID_MAX_I, (unsigned char)max_I);
-    mIOManager->sendValueToAllBoards(TERM_ID_DEADZONE, (unsigned char)deadZone);
-    mIOManager->sendValueToAllBoards(TERM_ID_GRAVITYCOMP, (unsigned char)gravityComp);
-    mIOManager->sendValueToAllBoards(TERM_ID_MAXSPEED, (unsigned char)(maxSpeed/2));
+    reliefParameter parameters[] = {
+        {TERM_ID_GAIN_P, (unsigned char) (gain_P * 25)},
+        {TERM_ID_GAIN_I, (unsigned char) (gain_I * 100)},
+        {TERM_ID_MAX_I, (unsigned char)max_I},
+        {TERM_ID_DEADZONE, (unsigned char)deadZone},
+        {TERM_ID_GRAVITYCOMP, (unsigned char)gravityComp},
+        {TERM_ID_MAXSPEED, (unsigned char)(maxSpeed/2)}
+    };
+    if (!mIOManager->sendConfiguration(parameters, 6)) {
+        ofLog(OF_LOG_WARNING, "ReliefApplication: not every board confirmed its parameters; ports that come up later get them then");
+    }
+    mIOManager->startOutputThread(PIN_OUTPUT_RATE);
     
     colorInputImage.allocate(RELIEF_PROJECTOR_SIZE_X, RELIEF_PROJECTOR_SIZE_X, GL_RGBA);
     depthInputImage.allocate(RELIEF_PROJECTOR_SIZE_X, RELIEF_PROJECTOR_SIZE_X, GL_RGBA);
@@ -76,6 +83,10 @@ void ReliefApplication::setup(){
 
     myHybridTokens = new HybridTokens(&kinectTracker);
     myStaticManipulator = new StaticManipulator(&kinectTracker);
+    myCalibrator = new ProjectorCameraCalibrator(&kinectTracker);
+
+    // use fitted reprojection models if a calibration has been run
+    loadReprojectionModels(myCalibrator->modelsFileName);
 
     myCurrentRenderedObject = myHybridTokens;
 }
@@ -92,6 +103,11 @@ void ReliefApplication::update(){
     if (!paused) {
         myCurrentRenderedObject->update(dt);
     }
+
+    // return to the previous application once calibration completes
+    if (myCurrentRenderedObject == myCalibrator && !myCalibrator->isRunning()) {
+        myCurrentRenderedObject = objectBeforeCalibration;
+    }
     
     // render input color image
     colorInputImage.begin();
@@ -108,7 +124,17 @@ void ReliefApplication::update(){
     
     ofBackground(0);
 
-    kinectTracker.drawColorImage(0, 0, RELIEF_PROJECTOR_SIZE_X, RELIEF_PROJECTOR_SIZE_X);
+    if (calibratingTableCorners) {
+        // the raw frame keeps its aspect ratio, scaled to the panel's width
+        float cameraScale = (float) RELIEF_PROJECTOR_SIZE_X / kinectTracker.kinect.width;
+        kinectTracker.drawRawColorImage(0, 0, RELIEF_PROJECTOR_SIZE_X, kinectTracker.kinect.height * cameraScale);
+        ofPushMatrix();
+        ofScale(cameraScale, cameraScale);
+        tableCornerAligner.draw(0, 0, 4 / cameraScale);
+        ofPopMatrix();
+    } else {
+        kinectTracker.drawColorImage(0, 0, RELIEF_PROJECTOR_SIZE_X, RELIEF_PROJECTOR_SIZE_X);
+    }
     
     colorInputImage.end();
     
@@ -170,11 +196,27 @@ void ReliefApplication::update(){
         debugImage4.end();
     }
 
+    // composite the height map on the cpu if the object supports it
+    heightMapCompositor.clear();
+    heightMapComposed = myCurrentRenderedObject->composeHeightMap(heightMapCompositor);
+    if (heightMapComposed) {
+        heightMapCompositor.compose(composedHeightMap);
+        composedHeightMap.toPixels(composedHeightMapPixels);
+        if (!composedHeightMapTexture.isAllocated()) {
+            composedHeightMapTexture.allocate(composedHeightMapPixels);
+        }
+        composedHeightMapTexture.loadData(composedHeightMapPixels);
+    }
+
     // render heightmap
     pinHeightMapImageForPins.begin();
     ofBackground(0);
     ofSetColor(255);
-    myCurrentRenderedObject->drawHeightMap();
+    if (heightMapComposed) {
+        composedHeightMapTexture.draw(0, 0);
+    } else {
+        myCurrentRenderedObject->drawHeightMap();
+    }
     pinHeightMapImageForPins.end();
 
     // render graphics
@@ -241,6 +283,78 @@ void ReliefApplication::draw(){
     ofDrawBitmapString((string) "   ' ' : " + (paused ? "play application" : "pause application"), menuLeftCoordinate, menuHeight); menuHeight += 20;
     ofDrawBitmapString((string) "   'z' : turn pins " + (drawPins ? "off" : "on"), menuLeftCoordinate, menuHeight); menuHeight += 20;
     ofDrawBitmapString((string) "   'x' : turn graphics " + (paintGraphics ? "off" : "on"), menuLeftCoordinate, menuHeight); menuHeight += 20;
+    ofDrawBitmapString((string) "   'v' : use " + (getReprojectionMode() == REPROJECT_CONTINUOUS ? "3-level" : "continuous") + " graphics reprojection (" + ofToString(getReprojectionMillis(), 1) + " ms)", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    ofDrawBitmapString((string) "   'b' : use " + (useAsyncReadback ? "synchronous" : "asynchronous") + " height map readback", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    if (!heightMapComposed && useAsyncReadback) {
+        int latencyFrames = heightMapReader.getLatencyFrames();
+        ofDrawBitmapString("         pin latency: " + ofToString(latencyFrames) + (latencyFrames == 1 ? " frame, " : " frames, ") + ofToString(heightMapReader.getLatencyMillis(), 1) + " ms", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    } else {
+        ofDrawBitmapString((string) "         pin latency: none (" + (heightMapComposed ? "composited on cpu" : "synchronous readback") + ")", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    }
+    ofDrawBitmapString((string) "   'c' : " + (myCalibrator->isRunning() ? "calibrating projector and camera..." : "calibrate projector and camera"), menuLeftCoordinate, menuHeight); menuHeight += 20;
+    ofDrawBitmapString((string) "   'y' : turn keystone correction " + (kinectTracker.useKeystone ? "off" : "on"), menuLeftCoordinate, menuHeight); menuHeight += 20;
+    ofDrawBitmapString((string) "   'k' : " + (calibratingTableCorners ? "save table corners (drag them in the camera image)" : "calibrate table corners"), menuLeftCoordinate, menuHeight); menuHeight += 20;
+
+    // draw serial queue health: the deepest queue and slowest enqueue-to-write time over all ports
+    int serialQueueDepth = 0;
+    float serialLatencyMillis = 0;
+    int serialPortsUp = 0;
+    for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+        reliefSerialStats stats = mIOManager->getSerialStats(i);
+        if (stats.portUp) serialPortsUp++;
+        serialQueueDepth = max(serialQueueDepth, stats.queueDepth);
+        serialLatencyMillis = max(serialLatencyMillis, stats.averageLatencyMillis);
+    }
+    ofDrawBitmapString("   serial queue: " + ofToString(serialQueueDepth) + " messages, " + ofToString(serialLatencyMillis, 1) + " ms to write, " +
+            ofToString(serialPortsUp) + " of " + ofToString(NUM_SERIAL_CONNECTIONS) + " ports up", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    if (mIOManager->getBusEmulator()) {
+        reliefBusStats busStats = mIOManager->getBusEmulator()->getStats();
+        ofDrawBitmapString("   emulated table: " + ofToString(busStats.messagesPerSecond, 0) + " messages/s, stalest board " + ofToString(busStats.maxUpdateAgeMillis, 0) + " ms, " +
+                ofToString(busStats.messagesDropped) + " dropped, " + ofToString(busStats.messagesLate) + " late", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    }
+    reliefOutputStats outputStats = mIOManager->getOutputStats();
+    if (outputStats.ticksPerSecond > 0) {
+        ofDrawBitmapString("   pin output: " + ofToString(outputStats.ticksPerSecond, 0) + " Hz, " + ofToString(outputStats.averageJitterMillis, 1) + " ms jitter, heights " +
+                ofToString(outputStats.averageFrameAgeMillis, 1) + " ms old when sent", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    }
+    ofDrawBitmapString("   idle motors: " + ofToString(mIOManager->getNumIdlePins()) + " of " + ofToString(NUM_ARDUINOS * NUM_PINS_ARDUINO) + " powered down", menuLeftCoordinate, menuHeight); menuHeight += 20;
+
+    // draw pin feedback: how far the pins that report back are from where they were sent
+    int boardsReporting = 0, pinFaults = 0;
+    float pinError = 0;
+    for (int i = 0; i < NUM_ARDUINOS; i++) {
+        if (!mIOManager->hasPinFeedback(i)) continue;
+        boardsReporting++;
+        for (int j = 0; j < NUM_PINS_ARDUINO; j++) {
+            pinError += abs(mIOManager->getPinError(i, j));
+            if (mIOManager->getPinFaults(i, j)) pinFaults++;
+        }
+    }
+    if (boardsReporting > 0) {
+        ofDrawBitmapString("   pin feedback: " + ofToString(boardsReporting) + " boards, " + ofToString(pinError / (boardsReporting * NUM_PINS_ARDUINO), 1) +
+                " average error, " + ofToString(pinFaults) + " faults", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    }
+    ofDrawBitmapString((string) "   'm' : send heights as " + (mIOManager->getPortProtocol(0) == PROTOCOL_V2_FRAMES ? "one message per board" : "v2 frames"), menuLeftCoordinate, menuHeight); menuHeight += 20;
+    ofDrawBitmapString((string) "   'n' : " + (mIOManager->getQueueMode() == QUEUE_MODE_MAILBOX ? "send every queued message" : "send only the newest heights per board"), menuLeftCoordinate, menuHeight); menuHeight += 20;
+    if (outputStats.ticksPerSecond > 0) {
+        ReliefTrajectoryMode trajectoryMode = mIOManager->getTrajectoryMode();
+        ofDrawBitmapString((string) "   'j' : " + (trajectoryMode == TRAJECTORY_OFF ? "interpolate pin motion between frames" :
+                trajectoryMode == TRAJECTORY_INTERPOLATE ? "extrapolate pin motion past the newest frame" : "send frames as rendered"), menuLeftCoordinate, menuHeight); menuHeight += 20;
+    }
+    if (mIOManager->isBoardMapLoaded()) {
+        ofDrawBitmapString("   'l' : reload the board map (" + ofToString(pinMappingMicros, 2) + " us per frame to map pins)", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    } else {
+        ofDrawBitmapString((string) "   'l' : load the board map from " + RELIEFSETTINGS + " (none is loaded, the pins are not driven)", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    }
+    if (mIOManager->getBusEmulator()) {
+        ofDrawBitmapString("   'u' : unplug the first emulated port for 3 seconds", menuLeftCoordinate, menuHeight); menuHeight += 20;
+    }
+    ofDrawBitmapString((string) "   'g' : " + (serialBenchmark.isRunning() ? "benchmarking serial writes against an emulated table..." :
+            "benchmark serial writes against an emulated table for " + ofToString(BENCHMARK_SECONDS) + " seconds at each of " +
+            ofToString(BENCHMARK_NUM_BAUD_RATES) + " baud rates"), menuLeftCoordinate, menuHeight); menuHeight += 20;
+    for (int n = 0; n < serialBenchmark.getNumResults(); n++) {
+        ofDrawBitmapString("         " + serialBenchmark.getSummary(n), menuLeftCoordinate, menuHeight); menuHeight += 20;
+    }
 
     // draw application selection instructions
     if (myCurrentRenderedObject == myHybridTokens) {
@@ -388,10 +502,78 @@ void ReliefApplication::keyPressed(int key){
         paintGraphics = !paintGraphics;
     }
 
+    if(key == 'v') {
+        setReprojectionMode(getReprojectionMode() == REPROJECT_CONTINUOUS ? REPROJECT_HEIGHT_LEVELS : REPROJECT_CONTINUOUS);
+    }
+
+    if(key == 'b') {
+        useAsyncReadback = !useAsyncReadback;
+        heightMapReader.clear(); // drop reads queued before the switch
+    }
+
+    if(key == 'n') {
+        mIOManager->setQueueMode(mIOManager->getQueueMode() == QUEUE_MODE_MAILBOX ? QUEUE_MODE_FIFO : QUEUE_MODE_MAILBOX);
+    }
+
+    // the board map is checked before use; a bad one is logged and the current one kept
+    if(key == 'l') {
+        mIOManager->loadSettings(RELIEFSETTINGS);
+        pinMappingMicros = mIOManager->benchmarkFrameConversion(1000);
+    }
+
+    // pull the cable on the first emulated port for a few seconds, to watch it reconnect
+    if(key == 'u' && mIOManager->getBusEmulator()) {
+        mIOManager->getBusEmulator()->unplugPort(0, 3000);
+    }
+
+    // stream a frame of heights to every emulated board at 60 fps, counting writes per frame,
+    // at 115200 baud and up
+    if(key == 'g') {
+        serialBenchmark.start();
+    }
+
+    // step through trajectory shaping modes: off, interpolate, extrapolate
+    if(key == 'j') {
+        mIOManager->setTrajectoryMode((ReliefTrajectoryMode) ((mIOManager->getTrajectoryMode() + 1) % 3));
+    }
+
+    // only for boards running firmware that decodes v2 frames
+    if(key == 'm') {
+        ReliefProtocol protocol = mIOManager->getPortProtocol(0) == PROTOCOL_V2_FRAMES ? PROTOCOL_V1_MESSAGES : PROTOCOL_V2_FRAMES;
+        for (int i = 0; i < NUM_SERIAL_CONNECTIONS; i++) {
+            mIOManager->setPortProtocol(i, protocol);
+        }
+    }
+
     // other keys
     if(key == 'p') {
         kinectTracker.saveDepthImage();
     }
+
+    // locate the table in the camera image. the new corners are saved and every tracker follows
+    if(key == 'k' && USE_KINECT) {
+        if (calibratingTableCorners) {
+            kinectTracker.setTableCorners(tableCornerAligner.fHandles);
+        } else {
+            tableCornerAligner.setup(0, 0, 1, 1, 1, 1);
+            for (int i = 0; i < 4; i++) {
+                tableCornerAligner.fHandles[i] = kinectTracker.tableFrame.cameraCorners[i];
+            }
+        }
+        calibratingTableCorners = !calibratingTableCorners;
+    }
+
+    // resample the tracker's input images onto the table frame
+    if(key == 'y' && USE_KINECT) {
+        kinectTracker.setKeystone(!kinectTracker.useKeystone);
+    }
+
+    // run the projector-camera calibration sequence; clear the table first
+    if(key == 'c' && USE_KINECT && myCurrentRenderedObject != myCalibrator) {
+        objectBeforeCalibration = myCurrentRenderedObject;
+        myCalibrator->start();
+        myCurrentRenderedObject = myCalibrator;
+    }
 }
 
 //--------------------------------------------------------------
@@ -406,12 +588,13 @@ void ReliefApplication::mouseMoved(int x, int y){
 
 //--------------------------------------------------------------
 void ReliefApplication::mouseDragged(int x, int y, int button){
-    
-    
+    adjustTableCorner(x, y);
 }
 
 //--------------------------------------------------------------
 void ReliefApplication::mousePressed(int x, int y, int button){
+    adjustTableCorner(x, y);
+
     //test->position.animateTo(ofPoint((x - 2)*3, (y - 2)*3, 50));
     //printf("%f, %f, %f \n",renderableObjects[0].position.getCurrentPosition().x, renderableObjects[0].position.getCurrentPosition().y, renderableObjects[0].position.getCurrentPosition().z);
 
@@ -433,32 +616,45 @@ void ReliefApplication::gotMessage(ofMessage msg){
     
 }
 
+//--------------------------------------------------------------
+// move the table corner closest to a click in the color panel, which is drawn at (2, 2, 300, 300)
+void ReliefApplication::adjustTableCorner(int x, int y){
+    if (!calibratingTableCorners || x < 2 || x >= 302 || y < 2 || y >= 302) {
+        return;
+    }
+    float cameraScale = 300.0 / kinectTracker.kinect.width;
+    tableCornerAligner.adjustHandle((x - 2) / cameraScale, (y - 2) / cameraScale);
+}
+
 //-----------------------------------------------------------
 void ReliefApplication::sendHeightToRelief(){
     
-    unsigned char* pixels;
-    ofPixels tempPixels;
-    pinHeightMapImageForPins.readToPixels(tempPixels);
-    //Rotate to align all coordinate systems
-    tempPixels.rotate90(1);
-    tempPixels.mirror(true, false);
-    pixels = tempPixels.getPixels();
-    
-    for (int j = 0; j < RELIEF_SIZE_Y; j ++) {
-        for (int i = 0; i < RELIEF_SIZE_X; i ++) {
-            if (drawPins) {
-                int y = j;
-                int x = RELIEF_SIZE_X - 1 - i;
-                int heightMapValue = pixels[((x + (y * RELIEF_SIZE_X)) * 4)];
-                mPinHeightToRelief[i][j] = heightMapValue;
-            } else {
-                mPinHeightToRelief[i][j] = 0;
+    // the io manager maps the height map as rendered straight to the boards, including
+    // rotating it to align all coordinate systems
+    const unsigned char* pixels;
+    int numChannels;
+    if (!drawPins) {
+        static unsigned char flatHeightMap[RELIEF_SIZE_X * RELIEF_SIZE_Y] = {0};
+        pixels = flatHeightMap;
+        numChannels = 1;
+    } else if (heightMapComposed) {
+        pixels = composedHeightMap.getData();
+        numChannels = 1;
+    } else {
+        if (useAsyncReadback) {
+            // pins follow the previous frame's height map, without stalling on the gpu
+            if (!heightMapReader.readToPixels(pinHeightMapImageForPins, heightMapReadbackPixels)) {
+                return;
             }
+        } else {
+            pinHeightMapImageForPins.readToPixels(heightMapReadbackPixels);
         }
+        pixels = heightMapReadbackPixels.getPixels();
+        numChannels = heightMapReadbackPixels.getNumChannels();
     }
     
     // send the height map to the hardware interface
-	mIOManager->sendPinHeightToRelief(mPinHeightToRelief);
+	mIOManager->sendPinHeightToRelief(pixels, numChannels);
 }
 
 //------------------------------------------------------------
@@ -466,6 +662,10 @@ void ReliefApplication::exit(){
     if (USE_KINECT) {
         kinectTracker.exit();
     }
+    // let the last heights go out, so none of them turns a motor back on, then turn every
+    // motor off and return as soon as that has gone out too
+    mIOManager->stopOutputThread();
+    mIOManager->waitUntilFlushed(500);
     mIOManager->sendValueToAllBoards(TERM_ID_MAXSPEED, (unsigned char) 0);
-    ofSleepMillis(1000);
+    mIOManager->waitUntilFlushed(1000);
 }
\ No newline at end of file
@@ -2,10 +2,14 @@
 
 #include "ofMain.h"
 #include "ReliefIOManager.h"
+#include "ReliefSerialBenchmark.h"
 #include "RenderableObject.h"
 #include "KinectTracker.h"
 #include "HybridTokens.h"
 #include "StaticManipulator.h"
+#include "ProjectorCameraCalibrator.h"
+#include "HeightMapCompositor.h"
+#include "AsyncPixelReader.h"
 
 class ReliefApplication : public ofBaseApp {
 public:
@@ -27,7 +31,9 @@ public:
     void sendHeightToRelief();
     
     ReliefIOManager * mIOManager;
-	unsigned char mPinHeightToRelief [RELIEF_SIZE_X][RELIEF_SIZE_Y];
+    float pinMappingMicros = 0;                 // per frame, timed whenever the board map is loaded
+    ReliefSerialBenchmark serialBenchmark;      // serial writer cost against an emulated table
+    ofPixels heightMapReadbackPixels;
 
     bool paused = false;
     bool drawPins = true;
@@ -44,6 +50,17 @@ public:
     ofFbo pinDisplayImage;                      // render graphics for projection onto pins here
     ofFbo pinHeightMapImageForPins;             // render height map for setting pin height here
 
+    // height maps composited on the cpu skip rendering and reading back pinHeightMapImageForPins
+    HeightMapCompositor heightMapCompositor;
+    PinRasterizer composedHeightMap;
+    ofPixels composedHeightMapPixels;
+    ofTexture composedHeightMapTexture;         // reuploaded each frame for the preview
+    bool heightMapComposed = false;
+
+    // height maps rendered on the gpu are read back through pixel buffers one frame late
+    AsyncPixelReader heightMapReader;
+    bool useAsyncReadback = true;
+
     int projectorOffsetX;
 
     // pin height map generators
@@ -51,6 +68,13 @@ public:
     RenderableObject * myCurrentRenderedObject;
     HybridTokens * myHybridTokens;
     StaticManipulator * myStaticManipulator;
+    ProjectorCameraCalibrator * myCalibrator;
+    RenderableObject * objectBeforeCalibration;
 
     KinectTracker kinectTracker;
+
+    // table corner calibration: drag the corners over the raw camera image in the color panel
+    bool calibratingTableCorners = false;
+    CBoxAligner tableCornerAligner;             // handles in raw camera pixels
+    void adjustTableCorner(int x, int y);
 };
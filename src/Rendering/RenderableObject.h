@@ -14,6 +14,8 @@
 #include "ofxAnimatableOfColor.h"
 #include "Constants.h"
 
+class HeightMapCompositor;
+
 class RenderableObject {
 public:
     ofShader heightMapShader;
@@ -29,6 +31,10 @@ public:
     virtual void update(float dt) {};
     virtual void drawHeightMap(){};
     virtual void drawGraphics(){};
+
+    // objects that build their height map on the cpu push layers here and return true;
+    // the application then uses the composite instead of drawHeightMap
+    virtual bool composeHeightMap(HeightMapCompositor & compositor) {return false;};
     
     virtual void touchTest(vector<ofPoint> & touchPoints){};
     virtual void objectTest(vector<ofPoint> & objectCentroids){};
@@ -0,0 +1,174 @@
+//
+//  TableFrame.cpp
+//  Relief2
+//
+//
+
+#include "TableFrame.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+TableFrame::TableFrame() {
+    // default table corners, measured on inFORM 1 with kinect registration enabled
+    cameraCorners[0].set(229, 162);
+    cameraCorners[1].set(411, 164);
+    cameraCorners[2].set(413, 347);
+    cameraCorners[3].set(224, 345);
+    fitHomography();
+}
+
+void TableFrame::setCameraCorners(ofPoint corners[4]) {
+    for (int i = 0; i < 4; i++) {
+        cameraCorners[i] = corners[i];
+    }
+    fitHomography();
+}
+
+void TableFrame::setCameraCorners(CBoxAligner &aligner) {
+    setCameraCorners(aligner.fHandles);
+}
+
+// load corners from xml, keeping the defaults for any that are missing
+void TableFrame::loadSettings(string fileName) {
+    ofxXmlSettings xml;
+    if (!xml.loadFile(fileName)) {
+        return;
+    }
+    int numCorners = min(4, xml.getNumTags("CORNER"));
+    for (int i = 0; i < numCorners; i++) {
+        cameraCorners[i].x = xml.getValue("CORNER:X", cameraCorners[i].x, i);
+        cameraCorners[i].y = xml.getValue("CORNER:Y", cameraCorners[i].y, i);
+    }
+    fitHomography();
+}
+
+void TableFrame::saveSettings(string fileName) {
+    ofxXmlSettings xml;
+    for (int i = 0; i < 4; i++) {
+        xml.setValue("CORNER:X", cameraCorners[i].x, i);
+        xml.setValue("CORNER:Y", cameraCorners[i].y, i);
+    }
+    xml.saveFile(fileName);
+}
+
+// fit the homography taking the unit square onto the camera corners (Heckbert's projective
+// mapping), then invert it to get the camera to table mapping
+void TableFrame::fitHomography() {
+    float x0 = cameraCorners[0].x, y0 = cameraCorners[0].y;
+    float x1 = cameraCorners[1].x, y1 = cameraCorners[1].y;
+    float x2 = cameraCorners[2].x, y2 = cameraCorners[2].y;
+    float x3 = cameraCorners[3].x, y3 = cameraCorners[3].y;
+
+    float sx = x0 - x1 + x2 - x3;
+    float sy = y0 - y1 + y2 - y3;
+    float dx1 = x1 - x2, dx2 = x3 - x2;
+    float dy1 = y1 - y2, dy2 = y3 - y2;
+    float det = dx1 * dy2 - dx2 * dy1;
+    if (fabs(det) < 1e-9) {
+        cout << "Error: TableFrame corners are degenerate" << endl;
+        return;
+    }
+    float g = (sx * dy2 - dx2 * sy) / det;
+    float h = (dx1 * sy - sx * dy1) / det;
+
+    float *m = tableToCameraMatrix;
+    m[0] = x1 - x0 + g * x1;  m[1] = x3 - x0 + h * x3;  m[2] = x0;
+    m[3] = y1 - y0 + g * y1;  m[4] = y3 - y0 + h * y3;  m[5] = y0;
+    m[6] = g;                 m[7] = h;                 m[8] = 1;
+
+    // invert via the adjugate; the overall scale of a homography is irrelevant
+    float *n = cameraToTableMatrix;
+    n[0] = m[4] * m[8] - m[5] * m[7];
+    n[1] = m[2] * m[7] - m[1] * m[8];
+    n[2] = m[1] * m[5] - m[2] * m[4];
+    n[3] = m[5] * m[6] - m[3] * m[8];
+    n[4] = m[0] * m[8] - m[2] * m[6];
+    n[5] = m[2] * m[3] - m[0] * m[5];
+    n[6] = m[3] * m[7] - m[4] * m[6];
+    n[7] = m[1] * m[6] - m[0] * m[7];
+    n[8] = m[0] * m[4] - m[1] * m[3];
+}
+
+void TableFrame::cameraToTable(ofPoint &point) {
+    float *n = cameraToTableMatrix;
+    float w = n[6] * point.x + n[7] * point.y + n[8];
+    float x = (n[0] * point.x + n[1] * point.y + n[2]) / w;
+    float y = (n[3] * point.x + n[4] * point.y + n[5]) / w;
+    point.x = x;
+    point.y = y;
+}
+
+void TableFrame::tableToCamera(ofPoint &point) {
+    float *m = tableToCameraMatrix;
+    float w = m[6] * point.x + m[7] * point.y + m[8];
+    float x = (m[0] * point.x + m[1] * point.y + m[2]) / w;
+    float y = (m[3] * point.x + m[4] * point.y + m[5]) / w;
+    point.x = x;
+    point.y = y;
+}
+
+void TableFrame::cameraToTable(float *x, float *y, int count, float scaleX, float scaleY) {
+    // fold the output scale into the matrix rows
+    float n[9];
+    for (int i = 0; i < 3; i++) {
+        n[i] = cameraToTableMatrix[i] * scaleX;
+        n[i + 3] = cameraToTableMatrix[i + 3] * scaleY;
+        n[i + 6] = cameraToTableMatrix[i + 6];
+    }
+
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 n0 = _mm_set1_ps(n[0]), n1 = _mm_set1_ps(n[1]), n2 = _mm_set1_ps(n[2]);
+    __m128 n3 = _mm_set1_ps(n[3]), n4 = _mm_set1_ps(n[4]), n5 = _mm_set1_ps(n[5]);
+    __m128 n6 = _mm_set1_ps(n[6]), n7 = _mm_set1_ps(n[7]), n8 = _mm_set1_ps(n[8]);
+    for (; i + 4 <= count; i += 4) {
+        __m128 xs = _mm_loadu_ps(x + i);
+        __m128 ys = _mm_loadu_ps(y + i);
+        __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n6, xs), _mm_mul_ps(n7, ys)), n8);
+        __m128 tx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n0, xs), _mm_mul_ps(n1, ys)), n2);
+        __m128 ty = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n3, xs), _mm_mul_ps(n4, ys)), n5);
+        _mm_storeu_ps(x + i, _mm_div_ps(tx, w));
+        _mm_storeu_ps(y + i, _mm_div_ps(ty, w));
+    }
+#endif
+    for (; i < count; i++) {
+        float w = n[6] * x[i] + n[7] * y[i] + n[8];
+        float tx = (n[0] * x[i] + n[1] * y[i] + n[2]) / w;
+        float ty = (n[3] * x[i] + n[4] * y[i] + n[5]) / w;
+        x[i] = tx;
+        y[i] = ty;
+    }
+}
+
+void TableFrame::cameraToTable(vector<ofPoint> &points, float scaleX, float scaleY) {
+    int count = points.size();
+    scratchX.resize(count);
+    scratchY.resize(count);
+    for (int i = 0; i < count; i++) {
+        scratchX[i] = points[i].x;
+        scratchY[i] = points[i].y;
+    }
+    if (count) {
+        cameraToTable(&scratchX[0], &scratchY[0], count, scaleX, scaleY);
+    }
+    for (int i = 0; i < count; i++) {
+        points[i].x = scratchX[i];
+        points[i].y = scratchY[i];
+    }
+}
+
+ofRectangle TableFrame::getCameraRoi(int width, int height) {
+    float minX = cameraCorners[0].x, maxX = cameraCorners[0].x;
+    float minY = cameraCorners[0].y, maxY = cameraCorners[0].y;
+    for (int i = 1; i < 4; i++) {
+        minX = min(minX, cameraCorners[i].x);
+        maxX = max(maxX, cameraCorners[i].x);
+        minY = min(minY, cameraCorners[i].y);
+        maxY = max(maxY, cameraCorners[i].y);
+    }
+    int left = (int) ((minX + maxX - width) / 2);
+    int top = (int) ((minY + maxY - height) / 2);
+    return ofRectangle(left, top, width, height);
+}
@@ -0,0 +1,55 @@
+//
+//  TableFrame.h
+//  Relief2
+//
+//
+
+#ifndef __Relief2__TableFrame__
+#define __Relief2__TableFrame__
+
+#include "ofMain.h"
+#include "ofxXmlSettings.h"
+#include "KinectStuff/Calibration/boxAlign.h"
+
+
+// The table frame maps raw camera pixels onto the table surface, normalized to [0, 1] with
+// (0, 0) at the table's top left corner. It is a perspective mapping (3x3 homography) fitted
+// from the camera positions of the four table corners, ordered like CBoxAligner handles:
+//
+//   0-----1
+//   |     |
+//   3-----2
+//
+// One frame is shared by all trackers; it also determines the camera region of interest.
+
+class TableFrame {
+public:
+    TableFrame();
+
+    void setCameraCorners(ofPoint corners[4]);
+    void setCameraCorners(CBoxAligner &aligner);
+    void loadSettings(string fileName);
+    void saveSettings(string fileName);
+
+    // single point and batched transforms. batched versions work in place on separate x and y
+    // arrays and scale their table coordinates by (scaleX, scaleY)
+    void cameraToTable(ofPoint &point);
+    void tableToCamera(ofPoint &point);
+    void cameraToTable(float *x, float *y, int count, float scaleX=1, float scaleY=1);
+    void cameraToTable(vector<ofPoint> &points, float scaleX=1, float scaleY=1);
+
+    // a width x height camera region centered on the table
+    ofRectangle getCameraRoi(int width, int height);
+
+    ofPoint cameraCorners[4];
+
+private:
+    void fitHomography();
+
+    float cameraToTableMatrix[9];   // row-major homography from camera pixels to table coordinates
+    float tableToCameraMatrix[9];   // its inverse
+
+    vector<float> scratchX, scratchY;
+};
+
+#endif /* defined(__Relief2__TableFrame__) */